@@ -0,0 +1,157 @@
+// MIT License
+//
+// Copyright (c) 2021 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef NTRIPLIB_BENCHMARKS_BENCH_UTIL_H_
+#define NTRIPLIB_BENCHMARKS_BENCH_UTIL_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>  // NOLINT.
+#include <string>
+#include <vector>
+
+
+namespace libntrip {
+namespace bench {
+
+inline
+int64_t NowNanoseconds(void) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Keep the optimizer from dropping a computed value.
+template <typename T>
+inline void DoNotOptimize(T const& value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// One result per line as JSON, so runs can be collected and compared.
+// `bytes_per_op` > 0 adds a throughput field.
+inline
+void PrintResult(std::string const& name, std::string const& params,
+    int64_t iterations, int64_t elapsed_ns, int64_t bytes_per_op = 0) {
+  double ns_per_op =
+      iterations > 0 ? static_cast<double>(elapsed_ns)/iterations : 0.0;
+  printf("{\"benchmark\":\"%s\",\"params\":\"%s\",\"iterations\":%lld,"
+      "\"ns_per_op\":%.2f", name.c_str(), params.c_str(),
+      static_cast<long long>(iterations), ns_per_op);
+  if (bytes_per_op > 0 && ns_per_op > 0) {
+    printf(",\"mb_per_s\":%.2f", bytes_per_op*1e3/ns_per_op);
+  }
+  printf("}\n");
+  fflush(stdout);
+}
+
+// Run body(iterations) with doubling iteration counts until one run lasts
+// at least `min_ns`, then print that run.
+template <typename Body>
+void RunBenchmark(std::string const& name, std::string const& params,
+    int64_t min_ns, int64_t bytes_per_op, Body&& body) {
+  int64_t iterations = 1;
+  while (true) {
+    int64_t beg = NowNanoseconds();
+    body(iterations);
+    int64_t elapsed = NowNanoseconds() - beg;
+    if (elapsed >= min_ns || iterations >= (int64_t{1} << 40)) {
+      PrintResult(name, params, iterations, elapsed, bytes_per_op);
+      return;
+    }
+    iterations *= 2;
+  }
+}
+
+// Log-linear histogram, 32 sub-buckets per power of two (about 3% error).
+// Recording is O(1) and histograms of several threads can be merged.
+class LatencyHistogram {
+ public:
+  LatencyHistogram() : buckets_(kBucketCount, 0) {}
+
+  void Record(int64_t value) {
+    if (value < 0) value = 0;
+    ++buckets_[Index(static_cast<uint64_t>(value))];
+    ++count_;
+    sum_ += value;
+    if (count_ == 1 || value < min_) min_ = value;
+    if (value > max_) max_ = value;
+  }
+  void Merge(LatencyHistogram const& other) {
+    if (other.count_ == 0) return;
+    for (int i = 0; i < kBucketCount; ++i) buckets_[i] += other.buckets_[i];
+    min_ = (count_ == 0) ? other.min_ : std::min(min_, other.min_);
+    max_ = std::max(max_, other.max_);
+    count_ += other.count_;
+    sum_ += other.sum_;
+  }
+  void Clear(void) {
+    std::fill(buckets_.begin(), buckets_.end(), 0);
+    count_ = sum_ = min_ = max_ = 0;
+  }
+  // `p` in [0, 100].
+  int64_t Percentile(double p) const {
+    if (count_ == 0) return 0;
+    uint64_t rank = static_cast<uint64_t>(p/100.0*(count_-1)) + 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < kBucketCount; ++i) {
+      seen += buckets_[i];
+      if (seen >= rank) {
+        return std::min(std::max(LowerBound(i), min_), max_);
+      }
+    }
+    return max_;
+  }
+  uint64_t count(void) const { return count_; }
+  int64_t min(void) const { return min_; }
+  int64_t max(void) const { return max_; }
+  double mean(void) const {
+    return count_ > 0 ? static_cast<double>(sum_)/count_ : 0.0;
+  }
+
+ private:
+  static constexpr int kSubBits = 5;
+  static constexpr int kBucketCount = (64-kSubBits+1) << kSubBits;
+
+  static int Index(uint64_t value) {
+    if (value < (2u << kSubBits)) return static_cast<int>(value);
+    int shift = 63 - __builtin_clzll(value) - kSubBits;
+    return (shift << kSubBits) + static_cast<int>(value >> shift);
+  }
+  static int64_t LowerBound(int index) {
+    if (index < (2 << kSubBits)) return index;
+    int shift = (index >> kSubBits) - 1;
+    return static_cast<int64_t>(
+        (index & ((1 << kSubBits)-1)) + (1 << kSubBits)) << shift;
+  }
+
+  std::vector<uint64_t> buckets_;
+  uint64_t count_ = 0;
+  int64_t sum_ = 0;
+  int64_t min_ = 0;
+  int64_t max_ = 0;
+};
+
+}  // namespace bench
+}  // namespace libntrip
+
+#endif  // NTRIPLIB_BENCHMARKS_BENCH_UTIL_H_
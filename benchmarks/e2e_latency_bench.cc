@@ -0,0 +1,310 @@
+// MIT License
+//
+// Copyright (c) 2021 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// End-to-end latency of NtripServer -> NtripCaster -> subscriber in one
+// process on loopback. The server sends synthetic RTCM frames stamped
+// with the send time, every subscriber decodes them and records the
+// one-way latency. Each configuration uses its own mountpoint.
+//
+// Subscribers are NtripClients decoding in their OnReceived callback, or
+// with "raw" plain blocking sockets, which leaves only the caster path.
+// Every configuration runs against a default caster and against a caster
+// in low-latency mode, and reports the process CPU it took.
+//
+// Usage: e2e_latency_bench [seconds_per_config] [port] [client|raw]
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>  // NOLINT.
+#include <memory>
+#include <string>
+#include <thread>  // NOLINT.
+#include <vector>
+
+#include "ntrip/ntrip_caster.h"
+#include "ntrip/ntrip_client.h"
+#include "ntrip/ntrip_server.h"
+#include "ntrip/ntrip_util.h"
+#include "ntrip/rtcm3_frame.h"
+#include "bench_util.h"
+#include "synthetic_rtcm.h"
+
+
+using libntrip::LowLatencyOptions;
+using libntrip::NtripCaster;
+using libntrip::NtripClient;
+using libntrip::NtripServer;
+using libntrip::Rtcm3Framer;
+using libntrip::SocketTuning;
+using libntrip::ThreadOptions;
+using libntrip::kSendWouldBlock;
+using libntrip::bench::LatencyHistogram;
+using libntrip::bench::MakeSyntheticFrame;
+using libntrip::bench::NowNanoseconds;
+using libntrip::bench::ParseSyntheticFrame;
+using libntrip::bench::SyntheticFrame;
+
+namespace {
+
+constexpr char kUser[] = "test01";
+constexpr char kPassword[] = "123456";
+constexpr double kWarmupSeconds = 0.5;
+
+struct Config {
+  int clients;
+  double rate;  // Frames per second.
+  int payload;  // Payload bytes per frame.
+};
+
+// Client count, message rate and payload size are varied one at a time
+// around 10 clients at 10 Hz with 200 byte payloads.
+Config const kConfigs[] = {
+  {1, 10, 200}, {10, 10, 200}, {100, 10, 200},
+  {10, 1, 200}, {10, 50, 200},
+  {10, 10, 32}, {10, 10, 1000},
+};
+
+// Owned by one receive thread until Stop().
+class Subscriber {
+ public:
+  explicit Subscriber(uint32_t warmup_frames)
+      : warmup_frames_(warmup_frames) {}
+  ~Subscriber() { Stop(); }
+
+  int Start(bool raw, int port, std::string const& mountpoint) {
+    if (!raw) {
+      client_.reset(new NtripClient);
+      client_->Init("127.0.0.1", port, kUser, kPassword, mountpoint);
+      client_->set_report_interval(3600);
+      client_->OnReceived([this] (char const* buffer, int size) {
+        OnData(buffer, size);
+      });
+      return client_->Run() ? 0 : -1;
+    }
+    fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    std::string credential;
+    libntrip::Base64Encode(std::string(kUser) + ":" + kPassword, &credential);
+    std::string request = "GET /" + mountpoint + " HTTP/1.1\r\n"
+        "Authorization: Basic " + credential + "\r\n\r\n";
+    if (connect(fd_, reinterpret_cast<struct sockaddr*>(&addr),
+        sizeof(addr)) != 0 ||
+        send(fd_, request.data(), request.size(), 0) !=
+        static_cast<ssize_t>(request.size())) {
+      return -1;
+    }
+    thread_ = std::thread(&Subscriber::ReceiveRaw, this);
+    return 0;
+  }
+  void Stop(void) {
+    if (client_) client_->Stop();
+    if (fd_ >= 0) shutdown(fd_, SHUT_RDWR);
+    if (thread_.joinable()) thread_.join();
+    if (fd_ >= 0) close(fd_);
+    fd_ = -1;
+  }
+  LatencyHistogram const& latency(void) const { return latency_; }
+  uint64_t received(void) const { return received_; }
+
+ private:
+  void ReceiveRaw(void) {
+    char buffer[4096];
+    std::string response;
+    bool streaming = false;
+    int ret;
+    while ((ret = recv(fd_, buffer, sizeof(buffer), 0)) > 0) {
+      if (streaming) {
+        OnData(buffer, ret);
+        continue;
+      }
+      response.append(buffer, ret);
+      auto pos = response.find("\r\n");
+      if (pos == std::string::npos) continue;
+      streaming = true;
+      if (response.size() > pos+2) {
+        OnData(response.data()+pos+2, static_cast<int>(response.size()-pos-2));
+      }
+    }
+  }
+  void OnData(char const* buffer, int size) {
+    int64_t now = NowNanoseconds();
+    framer_.Feed(buffer, size, [this, now] (char const* frame, int length) {
+      SyntheticFrame info;
+      if (ParseSyntheticFrame(frame, length, &info) != 0) return;
+      ++received_;
+      if (info.sequence < warmup_frames_) return;
+      latency_.Record(now - info.send_ns);
+    });
+  }
+
+  uint32_t warmup_frames_;
+  std::unique_ptr<NtripClient> client_;
+  int fd_ = -1;
+  std::thread thread_;
+  Rtcm3Framer framer_;
+  LatencyHistogram latency_;
+  uint64_t received_ = 0;
+};
+
+int64_t ProcessCpuNanoseconds(void) {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000LL +
+      (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000LL;
+}
+
+int RunConfig(Config const& config, int index, int port, double seconds,
+    bool raw, char const* caster_mode) {
+  char mountpoint[32];
+  snprintf(mountpoint, sizeof(mountpoint), "E2E%02d", index);
+  char ntrip_str[256];
+  snprintf(ntrip_str, sizeof(ntrip_str),
+      "STR;%s;%s;RTCM 3.2;%d(1);2;GPS;E2E;CHN;30.00;119.00;0;0;E2E;none;"
+      "B;N;0;", mountpoint, mountpoint,
+      libntrip::bench::kSyntheticMessageType);
+  NtripServer server;
+  server.Init("127.0.0.1", port, kUser, kPassword, mountpoint, ntrip_str);
+  if (!server.Run()) return -1;
+
+  uint32_t warmup_frames = static_cast<uint32_t>(config.rate*kWarmupSeconds);
+  std::vector<std::unique_ptr<Subscriber>> subscribers;
+  for (int i = 0; i < config.clients; ++i) {
+    subscribers.emplace_back(new Subscriber(warmup_frames));
+    if (subscribers.back()->Start(raw, port, mountpoint) != 0) {
+      subscribers.clear();
+      server.Stop();
+      return -1;
+    }
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  uint32_t total_frames =
+      static_cast<uint32_t>(config.rate*(seconds+kWarmupSeconds));
+  auto period = std::chrono::nanoseconds(
+      static_cast<int64_t>(1e9/config.rate));
+  auto next = std::chrono::steady_clock::now();
+  int64_t cpu_beg = ProcessCpuNanoseconds();
+  int64_t wall_beg = NowNanoseconds();
+  std::vector<char> frame;
+  for (uint32_t sequence = 0; sequence < total_frames; ++sequence) {
+    std::this_thread::sleep_until(next);
+    next += period;
+    SyntheticFrame info;
+    info.source_id = static_cast<uint32_t>(index);
+    info.sequence = sequence;
+    info.send_ns = NowNanoseconds();
+    MakeSyntheticFrame(info, config.payload, &frame);
+    int ret;
+    // A full send backlog means the caster is behind, wait for it.
+    while ((ret = server.SendData(frame.data(),
+        static_cast<int>(frame.size()))) == kSendWouldBlock) {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    if (ret != 0) {
+      printf("Send failed at frame %u\n", sequence);
+      break;
+    }
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  double cpu_percent = 100.0 * (ProcessCpuNanoseconds()-cpu_beg) /
+      (NowNanoseconds()-wall_beg);
+
+  LatencyHistogram latency;
+  uint64_t received = 0;
+  for (auto& subscriber : subscribers) {
+    subscriber->Stop();
+    latency.Merge(subscriber->latency());
+    received += subscriber->received();
+  }
+  server.Stop();
+  uint64_t expected = static_cast<uint64_t>(total_frames) * config.clients;
+  printf("{\"benchmark\":\"e2e_latency\",\"params\":\"caster=%s,"
+      "subscriber=%s,clients=%d,rate=%g,payload=%d\",\"samples\":%llu,"
+      "\"lost\":%llu,\"cpu_percent\":%.1f,\"mean_us\":%.1f,\"p50_us\":%.1f,"
+      "\"p90_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f,\"max_us\":%.1f}\n",
+      caster_mode, raw ? "raw" : "client", config.clients, config.rate,
+      config.payload, static_cast<unsigned long long>(latency.count()),
+      static_cast<unsigned long long>(
+          expected > received ? expected-received : 0), cpu_percent,
+      latency.mean()/1e3, latency.Percentile(50)/1e3,
+      latency.Percentile(90)/1e3, latency.Percentile(99)/1e3,
+      latency.Percentile(99.9)/1e3, latency.max()/1e3);
+  fflush(stdout);
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  double seconds = (argc > 1) ? atof(argv[1]) : 5.0;
+  int port = (argc > 2) ? atoi(argv[2]) : 2102;
+  bool raw = (argc > 3) && (strcmp(argv[3], "raw") == 0);
+  // The low-latency caster gets its own port, the default one leaves
+  // TIME_WAIT sockets behind on its port.
+  for (bool low_latency : {false, true}) {
+    char const* caster_mode = low_latency ? "low_latency" : "default";
+    NtripCaster caster;
+    ThreadOptions thread_options;
+    if (low_latency) {
+      // Keep the spinning loop off the CPU the process starts on.
+      int cpus = static_cast<int>(std::thread::hardware_concurrency());
+      if (cpus > 1) thread_options.cpus.push_back(cpus-1);
+      LowLatencyOptions options;
+      options.busy_poll = true;
+      options.socket_busy_poll_us = 50;
+      caster.set_low_latency_options(options);
+      SocketTuning tuning;
+      tuning.no_delay = true;
+      tuning.not_sent_lowat = 16*1024;
+      caster.set_socket_tuning("", tuning);
+    }
+    caster.Init(port, 1024, 100, thread_options);
+    caster.Run();
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    if (!caster.service_is_running()) {
+      printf("Caster start failed on port %d\n", port);
+      return 1;
+    }
+    int index = 0;
+    for (auto const& config : kConfigs) {
+      if (RunConfig(config, index++, port, seconds, raw, caster_mode) != 0) {
+        printf("Configuration %s clients=%d rate=%g payload=%d failed\n",
+            caster_mode, config.clients, config.rate, config.payload);
+      }
+    }
+    caster.Stop();
+    ++port;
+  }
+  return 0;
+}
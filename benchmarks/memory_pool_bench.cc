@@ -0,0 +1,165 @@
+// MIT License
+//
+// Copyright (c) 2021 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Connection churn with the system allocator against the slab and pooled
+// buffer allocators: every step closes a random live connection and
+// accepts a new one, as the caster does under reconnect storms.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <list>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>  // NOLINT.
+#include <vector>
+
+#include "ntrip/memory_pool.h"
+#include "ntrip/mount_point.h"
+#include "bench_util.h"
+
+
+using libntrip::BufferPool;
+using libntrip::ConnectionInformation;
+using libntrip::MemoryPoolStatistics;
+using libntrip::PooledBuffer;
+using libntrip::SlabAllocator;
+using libntrip::bench::DoNotOptimize;
+using libntrip::bench::NowNanoseconds;
+using libntrip::bench::PrintResult;
+
+namespace {
+
+constexpr uint32_t kSeed = 20220218;
+
+struct MallocConnection {
+  std::unique_ptr<ConnectionInformation> record;
+  std::unique_ptr<char[]> buffer;
+};
+
+struct PooledConnection {
+  ConnectionInformation* record = nullptr;
+  PooledBuffer buffer;
+};
+
+int64_t ChurnMalloc(int live, int steps, int buffer_size) {
+  std::mt19937 engine(kSeed);
+  std::vector<MallocConnection> connections(live);
+  int64_t beg = NowNanoseconds();
+  for (int i = 0; i < steps; ++i) {
+    auto& connection = connections[engine() % live];
+    connection.record.reset(new ConnectionInformation);
+    connection.record->fd = i;
+    connection.buffer.reset(new char[buffer_size]);
+    connection.buffer[0] = static_cast<char>(i);
+    DoNotOptimize(connection.buffer[0]);
+  }
+  return NowNanoseconds() - beg;
+}
+
+int64_t ChurnPooled(int live, int steps, int buffer_size,
+    SlabAllocator<ConnectionInformation>* slab) {
+  std::mt19937 engine(kSeed);
+  BufferPool* pool = BufferPool::Instance(buffer_size);
+  std::vector<PooledConnection> connections(live);
+  int64_t beg = NowNanoseconds();
+  for (int i = 0; i < steps; ++i) {
+    auto& connection = connections[engine() % live];
+    slab->Delete(connection.record);
+    connection.record = slab->New();
+    connection.record->fd = i;
+    connection.buffer = pool->Allocate();
+    connection.buffer.data()[0] = static_cast<char>(i);
+    DoNotOptimize(connection.buffer.data()[0]);
+  }
+  int64_t elapsed = NowNanoseconds() - beg;
+  for (auto& connection : connections) slab->Delete(connection.record);
+  return elapsed;
+}
+
+// Short-lived buffers on several threads, like client and server threads.
+int64_t ThreadedChurn(int threads, int steps, int buffer_size, bool pooled) {
+  std::vector<std::thread> workers;
+  int64_t beg = NowNanoseconds();
+  for (int t = 0; t < threads; ++t) {
+    workers.emplace_back([=] () {
+      BufferPool* pool = BufferPool::Instance(buffer_size);
+      for (int i = 0; i < steps; ++i) {
+        if (pooled) {
+          PooledBuffer buffer = pool->Allocate();
+          buffer.data()[0] = static_cast<char>(i);
+          DoNotOptimize(buffer.data()[0]);
+        } else {
+          std::unique_ptr<char[]> buffer(new char[buffer_size]);
+          buffer[0] = static_cast<char>(i);
+          DoNotOptimize(buffer[0]);
+        }
+      }
+    });
+  }
+  for (auto& worker : workers) worker.join();
+  return NowNanoseconds() - beg;
+}
+
+void PrintStatistics(char const* name, MemoryPoolStatistics const& stat) {
+  printf("{\"pool\":\"%s\",\"object_size\":%llu,\"capacity\":%llu,"
+      "\"in_use\":%llu,\"peak_in_use\":%llu,\"allocations\":%llu}\n", name,
+      static_cast<unsigned long long>(stat.object_size),
+      static_cast<unsigned long long>(stat.capacity),
+      static_cast<unsigned long long>(stat.in_use),
+      static_cast<unsigned long long>(stat.peak_in_use),
+      static_cast<unsigned long long>(stat.allocations));
+}
+
+}  // namespace
+
+// Usage: memory_pool_bench [steps]
+int main(int argc, char *argv[]) {
+  int steps = (argc > 1) ? atoi(argv[1]) : 1000000;
+  SlabAllocator<ConnectionInformation> slab;
+  for (int buffer_size : {4096, 65536}) {
+    for (int live : {100, 1000, 10000}) {
+      std::string params = "live=" + std::to_string(live) +
+          ",buffer=" + std::to_string(buffer_size);
+      PrintResult("churn/malloc", params, steps,
+          ChurnMalloc(live, steps, buffer_size));
+      PrintResult("churn/pooled", params, steps,
+          ChurnPooled(live, steps, buffer_size, &slab));
+    }
+  }
+  for (int threads : {1, 4, 16}) {
+    std::string params = "threads=" + std::to_string(threads) +
+        ",buffer=4096";
+    int64_t total = static_cast<int64_t>(steps) * threads;
+    PrintResult("threaded/malloc", params, total,
+        ThreadedChurn(threads, steps, 4096, false));
+    PrintResult("threaded/pooled", params, total,
+        ThreadedChurn(threads, steps, 4096, true));
+  }
+  PrintStatistics("connection", slab.statistics());
+  PrintStatistics("buffer_4096", BufferPool::Instance(4096)->statistics());
+  PrintStatistics("buffer_65536", BufferPool::Instance(65536)->statistics());
+  return 0;
+}
@@ -0,0 +1,821 @@
+// MIT License
+//
+// Copyright (c) 2021 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Load generator for NtripCaster: thousands of NTRIP servers push
+// synthetic RTCM and tens of thousands of rovers subscribe and send GGA,
+// all multiplexed on a few epoll threads. Reports aggregate throughput,
+// connect latency, per-client loss and delivery latency percentiles.
+//
+// Usage example against a caster on loopback:
+//   ntrip_loadgen --servers 1000 --rovers 20000 --threads 4 --rate 1
+//       --duration 30 --user test01 --password 123456
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>  // NOLINT.
+#include <functional>
+#include <memory>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>  // NOLINT.
+#include <vector>
+
+#include "ntrip/ntrip_util.h"
+#include "ntrip/rtcm3_frame.h"
+#include "bench_util.h"
+#include "synthetic_rtcm.h"
+
+
+using libntrip::Base64Encode;
+using libntrip::GGAFrameGenerate;
+using libntrip::Rtcm3Framer;
+using libntrip::bench::LatencyHistogram;
+using libntrip::bench::MakeSyntheticFrame;
+using libntrip::bench::NowNanoseconds;
+using libntrip::bench::ParseSyntheticFrame;
+using libntrip::bench::SyntheticFrame;
+
+namespace {
+
+constexpr int kBufferSize = 65536;
+constexpr int kMaxEvents = 512;
+constexpr int kMaxPollMs = 100;
+// A server whose socket backlog exceeds this skips frames instead of
+// queueing without bound; skipped frames are reported separately.
+constexpr size_t kMaxOutputBacklog = 256*1024;
+constexpr int64_t kNsPerSecond = 1000000000;
+
+struct Options {
+  std::string host = "127.0.0.1";
+  int port = 2101;
+  int servers = 100;
+  int rovers = 1000;
+  int threads = 4;
+  double rate = 1.0;            // Frames per second per server.
+  int payload = 200;            // Payload bytes per frame.
+  double gga_interval = 10.0;   // Seconds, 0 to disable.
+  double connect_rate = 500.0;  // New connections per second.
+  double duration = 30.0;       // Measurement seconds.
+  double connect_timeout = 10.0;
+  std::string user = "test01";
+  std::string password = "123456";
+  std::string prefix = "LG";
+  uint32_t seed = 1;
+  std::string per_client_output;
+};
+
+enum class Role { kServer, kRover };
+enum class State { kIdle, kConnecting, kHandshake, kStreaming, kClosed };
+enum class TimerKind { kConnect, kSendFrame, kSendGga };
+
+struct Connection {
+  Role role = Role::kServer;
+  State state = State::kIdle;
+  int index = 0;            // Server or rover index.
+  int mountpoint = 0;       // Server index this connection publishes/reads.
+  int fd = -1;
+  int64_t connect_start_ns = 0;
+  uint32_t sequence = 0;
+  std::string response;
+  std::string output;
+  Rtcm3Framer framer;
+  // Rover statistics.
+  bool has_sequence = false;
+  uint32_t last_sequence = 0;
+  uint64_t received = 0;
+  uint64_t lost = 0;
+  double latitude = 0.0;
+  double longitude = 0.0;
+};
+
+struct Timer {
+  int64_t when;
+  int connection;
+  TimerKind kind;
+  bool operator>(Timer const& other) const { return when > other.when; }
+};
+
+// Counters shared by all workers.
+struct Totals {
+  std::atomic<uint64_t> connect_ok{0};
+  std::atomic<uint64_t> connect_failed{0};
+  std::atomic<uint64_t> handshake_failed{0};
+  std::atomic<uint64_t> disconnected{0};
+  std::atomic<uint64_t> frames_sent{0};
+  std::atomic<uint64_t> frames_skipped{0};
+  std::atomic<uint64_t> bytes_sent{0};
+  std::atomic<uint64_t> frames_received{0};
+  std::atomic<uint64_t> bytes_received{0};
+  std::atomic<uint64_t> gga_sent{0};
+  std::atomic<int> servers_up{0};
+  std::atomic<int> rovers_up{0};
+};
+
+enum Phase { kPhaseServers = 1, kPhaseRovers = 2, kPhaseStop = 3 };
+
+inline
+void SetNonBlocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+std::string MountPointName(Options const& options, int index) {
+  char name[64];
+  snprintf(name, sizeof(name), "%s%05d", options.prefix.c_str(), index);
+  return name;
+}
+
+class Worker {
+ public:
+  Worker(Options const& options, Totals* totals, int id,
+      std::atomic<int>* phase, std::atomic<bool>* measuring)
+      : options_(options), totals_(totals), id_(id), phase_(phase),
+        measuring_(measuring), engine_(options.seed + id) {
+    std::string user_passwd = options_.user + ":" + options_.password;
+    Base64Encode(user_passwd, &credential_);
+  }
+
+  void AddServer(int index) {
+    Connection connection;
+    connection.role = Role::kServer;
+    connection.index = index;
+    connection.mountpoint = index;
+    connections_.push_back(std::move(connection));
+  }
+  void AddRover(int index, int mountpoint) {
+    std::uniform_real_distribution<double> offset(-0.5, 0.5);
+    Connection connection;
+    connection.role = Role::kRover;
+    connection.index = index;
+    connection.mountpoint = mountpoint;
+    connection.latitude = 30.0 + offset(engine_);
+    connection.longitude = 119.0 + offset(engine_);
+    connections_.push_back(std::move(connection));
+  }
+
+  void Start(void) { thread_ = std::thread(&Worker::Run, this); }
+  void Join(void) { if (thread_.joinable()) thread_.join(); }
+
+  std::vector<Connection> const& connections(void) const {
+    return connections_;
+  }
+  LatencyHistogram const& connect_latency(void) const {
+    return connect_latency_;
+  }
+  LatencyHistogram const& delivery_latency(void) const {
+    return delivery_latency_;
+  }
+
+ private:
+  void Run(void);
+  void ScheduleConnects(Role role, int64_t start_ns);
+  void OnTimer(Timer const& timer, int64_t now);
+  void Connect(int index, int64_t now);
+  void OnEvent(int index, uint32_t events);
+  void OnConnected(int index);
+  void OnReadable(int index);
+  void OnStreaming(Connection* connection, int64_t now);
+  void OnFrame(Connection* connection, char const* frame, int size);
+  void SendFrame(int index, int64_t now);
+  void SendGga(int index);
+  int Write(Connection* connection, char const* data, int size);
+  int Flush(Connection* connection);
+  void UpdateInterest(Connection* connection);
+  void Close(Connection* connection, bool failed);
+
+  Options const& options_;
+  Totals* totals_;
+  int id_;
+  std::atomic<int>* phase_;
+  std::atomic<bool>* measuring_;
+  std::mt19937 engine_;
+  std::string credential_;
+  int epoll_fd_ = -1;
+  std::vector<Connection> connections_;
+  std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers_;
+  std::vector<char> frame_;
+  LatencyHistogram connect_latency_;
+  LatencyHistogram delivery_latency_;
+  std::thread thread_;
+};
+
+void Worker::Run(void) {
+  epoll_fd_ = epoll_create1(0);
+  if (epoll_fd_ < 0) {
+    printf("Worker %d create epoll failed!!!\n", id_);
+    return;
+  }
+  struct epoll_event events[kMaxEvents];
+  int scheduled_phase = 0;
+  while (true) {
+    int phase = phase_->load();
+    if (phase == kPhaseStop) break;
+    int64_t now = NowNanoseconds();
+    if (phase > scheduled_phase) {
+      if (phase >= kPhaseServers && scheduled_phase < kPhaseServers) {
+        ScheduleConnects(Role::kServer, now);
+      }
+      if (phase >= kPhaseRovers && scheduled_phase < kPhaseRovers) {
+        ScheduleConnects(Role::kRover, now);
+      }
+      scheduled_phase = phase;
+    }
+    while (!timers_.empty() && timers_.top().when <= now) {
+      Timer timer = timers_.top();
+      timers_.pop();
+      OnTimer(timer, now);
+    }
+    int timeout = kMaxPollMs;
+    if (!timers_.empty()) {
+      int64_t wait_ms = (timers_.top().when - NowNanoseconds()) / 1000000;
+      timeout = static_cast<int>(
+          std::max<int64_t>(0, std::min<int64_t>(wait_ms, kMaxPollMs)));
+    }
+    int count = epoll_wait(epoll_fd_, events, kMaxEvents, timeout);
+    for (int i = 0; i < count; ++i) {
+      OnEvent(static_cast<int>(events[i].data.u32), events[i].events);
+    }
+  }
+  for (auto& connection : connections_) {
+    if (connection.fd > 0) close(connection.fd);
+    connection.fd = -1;
+  }
+  close(epoll_fd_);
+}
+
+void Worker::ScheduleConnects(Role role, int64_t start_ns) {
+  // Connections are spread over all workers, each worker paces its share.
+  double per_worker_rate = options_.connect_rate / options_.threads;
+  int64_t step = static_cast<int64_t>(kNsPerSecond / per_worker_rate);
+  int64_t when = start_ns;
+  for (int i = 0; i < static_cast<int>(connections_.size()); ++i) {
+    if (connections_[i].role != role) continue;
+    timers_.push(Timer{when, i, TimerKind::kConnect});
+    when += step;
+  }
+}
+
+void Worker::OnTimer(Timer const& timer, int64_t now) {
+  Connection& connection = connections_[timer.connection];
+  switch (timer.kind) {
+    case TimerKind::kConnect:
+      if (connection.state == State::kIdle) {
+        Connect(timer.connection, now);
+      } else if (connection.state == State::kConnecting ||
+          connection.state == State::kHandshake) {
+        // Connect timeout.
+        Close(&connection, true);
+      }
+      break;
+    case TimerKind::kSendFrame:
+      if (connection.state != State::kStreaming) break;
+      SendFrame(timer.connection, now);
+      timers_.push(Timer{timer.when + static_cast<int64_t>(
+          kNsPerSecond / options_.rate), timer.connection, timer.kind});
+      break;
+    case TimerKind::kSendGga:
+      if (connection.state != State::kStreaming) break;
+      SendGga(timer.connection);
+      timers_.push(Timer{timer.when + static_cast<int64_t>(
+          kNsPerSecond * options_.gga_interval), timer.connection,
+          timer.kind});
+      break;
+  }
+}
+
+void Worker::Connect(int index, int64_t now) {
+  Connection& connection = connections_[index];
+  connection.connect_start_ns = now;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    printf("Create socket failed, errno = %d\n", errno);
+    connection.state = State::kClosed;
+    totals_->connect_failed++;
+    return;
+  }
+  SetNonBlocking(fd);
+  int flag = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(options_.port);
+  addr.sin_addr.s_addr = inet_addr(options_.host.c_str());
+  connection.fd = fd;
+  if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr),
+      sizeof(addr)) < 0 && errno != EINPROGRESS) {
+    Close(&connection, true);
+    return;
+  }
+  connection.state = State::kConnecting;
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN | EPOLLOUT;
+  event.data.u32 = static_cast<uint32_t>(index);
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event);
+  timers_.push(Timer{now + static_cast<int64_t>(
+      options_.connect_timeout * kNsPerSecond), index, TimerKind::kConnect});
+}
+
+void Worker::OnEvent(int index, uint32_t events) {
+  Connection& connection = connections_[index];
+  if (connection.fd < 0) return;
+  if (connection.state == State::kConnecting) {
+    int error = 0;
+    socklen_t len = sizeof(error);
+    getsockopt(connection.fd, SOL_SOCKET, SO_ERROR, &error, &len);
+    if (error != 0 || (events & (EPOLLERR | EPOLLHUP))) {
+      Close(&connection, true);
+      return;
+    }
+    OnConnected(index);
+    return;
+  }
+  if (events & EPOLLOUT) {
+    if (Flush(&connection) < 0) {
+      Close(&connection, false);
+      return;
+    }
+  }
+  if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) OnReadable(index);
+}
+
+void Worker::OnConnected(int index) {
+  Connection& connection = connections_[index];
+  std::string mountpoint = MountPointName(options_, connection.mountpoint);
+  char request[1024];
+  int len = 0;
+  if (connection.role == Role::kServer) {
+    len = snprintf(request, sizeof(request),
+        "POST /%s HTTP/1.1\r\n"
+        "Host: %s:%d\r\n"
+        "Ntrip-Version: Ntrip/2.0\r\n"
+        "User-Agent: NTRIP LoadGen/1.0\r\n"
+        "Authorization: Basic %s\r\n"
+        "Ntrip-STR: STR;%s;%s;RTCM 3.2;%d(1);2;GPS;LG;CHN;30.00;119.00;0;0;"
+        "LoadGen;none;B;N;0;\r\n"
+        "Connection: close\r\n"
+        "\r\n",
+        mountpoint.c_str(), options_.host.c_str(), options_.port,
+        credential_.c_str(), mountpoint.c_str(), mountpoint.c_str(),
+        libntrip::bench::kSyntheticMessageType);
+  } else {
+    len = snprintf(request, sizeof(request),
+        "GET /%s HTTP/1.1\r\n"
+        "Host: %s:%d\r\n"
+        "Ntrip-Version: Ntrip/2.0\r\n"
+        "User-Agent: NTRIP LoadGen/1.0\r\n"
+        "Authorization: Basic %s\r\n"
+        "\r\n",
+        mountpoint.c_str(), options_.host.c_str(), options_.port,
+        credential_.c_str());
+  }
+  connection.state = State::kHandshake;
+  if (Write(&connection, request, len) < 0) Close(&connection, true);
+}
+
+void Worker::OnReadable(int index) {
+  Connection& connection = connections_[index];
+  char buffer[kBufferSize];
+  while (connection.fd > 0) {
+    int ret = recv(connection.fd, buffer, sizeof(buffer), 0);
+    if (ret < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+      if (errno == EINTR) continue;
+      Close(&connection, connection.state != State::kStreaming);
+      return;
+    }
+    if (ret == 0) {
+      Close(&connection, connection.state != State::kStreaming);
+      return;
+    }
+    totals_->bytes_received += ret;
+    int64_t now = NowNanoseconds();
+    if (connection.state == State::kHandshake) {
+      connection.response.append(buffer, ret);
+      auto pos = connection.response.find("\r\n");
+      if (pos == std::string::npos) continue;
+      if (connection.response.find(" 200 OK") > pos) {
+        printf("%s %s rejected: %s\n",
+            connection.role == Role::kServer ? "Server" : "Rover",
+            MountPointName(options_, connection.mountpoint).c_str(),
+            connection.response.substr(0, pos).c_str());
+        Close(&connection, true);
+        return;
+      }
+      std::string rest = connection.response.substr(pos+2);
+      connection.response.clear();
+      connection.response.shrink_to_fit();
+      OnStreaming(&connection, now);
+      if (!rest.empty() && connection.role == Role::kRover) {
+        connection.framer.Feed(rest.data(), static_cast<int>(rest.size()),
+            [&] (char const* frame, int size) {
+              OnFrame(&connection, frame, size);
+            });
+      }
+      continue;
+    }
+    if (connection.role == Role::kRover) {
+      connection.framer.Feed(buffer, ret,
+          [&] (char const* frame, int size) {
+            OnFrame(&connection, frame, size);
+          });
+    }
+  }
+}
+
+void Worker::OnStreaming(Connection* connection, int64_t now) {
+  connection->state = State::kStreaming;
+  connect_latency_.Record(now - connection->connect_start_ns);
+  totals_->connect_ok++;
+  int index = static_cast<int>(connection - connections_.data());
+  if (connection->role == Role::kServer) {
+    totals_->servers_up++;
+    // Spread the sources over the frame period.
+    std::uniform_int_distribution<int64_t> jitter(0,
+        static_cast<int64_t>(kNsPerSecond / options_.rate));
+    timers_.push(Timer{now + jitter(engine_), index, TimerKind::kSendFrame});
+  } else {
+    totals_->rovers_up++;
+    if (options_.gga_interval > 0) {
+      SendGga(index);
+      timers_.push(Timer{now + static_cast<int64_t>(
+          kNsPerSecond * options_.gga_interval), index, TimerKind::kSendGga});
+    }
+  }
+}
+
+void Worker::OnFrame(Connection* connection, char const* frame, int size) {
+  SyntheticFrame info;
+  if (ParseSyntheticFrame(frame, size, &info) != 0) return;
+  totals_->frames_received++;
+  connection->received++;
+  if (connection->has_sequence && info.sequence > connection->last_sequence) {
+    connection->lost += info.sequence - connection->last_sequence - 1;
+  }
+  if (!connection->has_sequence ||
+      info.sequence > connection->last_sequence) {
+    connection->last_sequence = info.sequence;
+    connection->has_sequence = true;
+  }
+  if (measuring_->load(std::memory_order_relaxed)) {
+    delivery_latency_.Record(NowNanoseconds() - info.send_ns);
+  }
+}
+
+void Worker::SendFrame(int index, int64_t now) {
+  Connection& connection = connections_[index];
+  if (connection.output.size() > kMaxOutputBacklog) {
+    totals_->frames_skipped++;
+    return;
+  }
+  SyntheticFrame info;
+  info.source_id = static_cast<uint32_t>(connection.index);
+  info.sequence = connection.sequence++;
+  info.send_ns = now;
+  MakeSyntheticFrame(info, options_.payload, &frame_);
+  if (Write(&connection, frame_.data(), static_cast<int>(frame_.size())) < 0) {
+    Close(&connection, false);
+    return;
+  }
+  totals_->frames_sent++;
+  totals_->bytes_sent += frame_.size();
+}
+
+void Worker::SendGga(int index) {
+  Connection& connection = connections_[index];
+  std::string gga;
+  GGAFrameGenerate(connection.latitude, connection.longitude, 10.0, &gga);
+  if (Write(&connection, gga.data(), static_cast<int>(gga.size())) < 0) {
+    Close(&connection, false);
+    return;
+  }
+  totals_->gga_sent++;
+}
+
+// Queue what the socket does not take now, return -1 on error.
+int Worker::Write(Connection* connection, char const* data, int size) {
+  if (!connection->output.empty()) {
+    connection->output.append(data, size);
+    return 0;
+  }
+  int ret = send(connection->fd, data, size, MSG_NOSIGNAL);
+  if (ret < 0) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+    ret = 0;
+  }
+  if (ret < size) {
+    connection->output.append(data+ret, size-ret);
+    UpdateInterest(connection);
+  } else if (connection->state == State::kHandshake) {
+    UpdateInterest(connection);
+  }
+  return 0;
+}
+
+int Worker::Flush(Connection* connection) {
+  if (connection->output.empty()) return 0;
+  int ret = send(connection->fd, connection->output.data(),
+      connection->output.size(), MSG_NOSIGNAL);
+  if (ret < 0) {
+    return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+  }
+  connection->output.erase(0, ret);
+  if (connection->output.empty()) UpdateInterest(connection);
+  return 0;
+}
+
+void Worker::UpdateInterest(Connection* connection) {
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  if (!connection->output.empty()) event.events |= EPOLLOUT;
+  event.data.u32 = static_cast<uint32_t>(connection - connections_.data());
+  epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, connection->fd, &event);
+}
+
+void Worker::Close(Connection* connection, bool failed) {
+  if (connection->fd > 0) {
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, connection->fd, nullptr);
+    close(connection->fd);
+  }
+  connection->fd = -1;
+  if (failed) {
+    if (connection->state == State::kHandshake) {
+      totals_->handshake_failed++;
+    } else {
+      totals_->connect_failed++;
+    }
+  } else if (connection->state == State::kStreaming) {
+    totals_->disconnected++;
+    if (connection->role == Role::kServer) {
+      totals_->servers_up--;
+    } else {
+      totals_->rovers_up--;
+    }
+  }
+  connection->state = State::kClosed;
+  connection->output.clear();
+}
+
+void RaiseFileLimit(int wanted) {
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) != 0) return;
+  if (limit.rlim_cur >= static_cast<rlim_t>(wanted)) return;
+  limit.rlim_cur = std::min<rlim_t>(limit.rlim_max, wanted);
+  setrlimit(RLIMIT_NOFILE, &limit);
+  if (limit.rlim_cur < static_cast<rlim_t>(wanted)) {
+    printf("Warning: open file limit %llu < %d connections\n",
+        static_cast<unsigned long long>(limit.rlim_cur), wanted);
+  }
+}
+
+// Wait until `up` reaches `target` or the timeout expires.
+void WaitForConnections(std::atomic<int> const& up, int target,
+    double connect_rate, double timeout) {
+  double seconds = target / connect_rate + timeout;
+  auto deadline = std::chrono::steady_clock::now() +
+      std::chrono::milliseconds(static_cast<int64_t>(seconds*1000));
+  while (up.load() < target && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+}
+
+void PrintUsage(char const* name) {
+  printf("Usage: %s [options]\n"
+      "  --host IP             caster address (127.0.0.1)\n"
+      "  --port N              caster port (2101)\n"
+      "  --servers N           NTRIP servers, one mountpoint each (100)\n"
+      "  --rovers N            NTRIP clients, spread over mountpoints (1000)\n"
+      "  --threads N           epoll threads (4)\n"
+      "  --rate HZ             frames per second per server (1)\n"
+      "  --payload N           payload bytes per frame, 18~1023 (200)\n"
+      "  --gga_interval S      rover GGA interval, 0 to disable (10)\n"
+      "  --connect_rate N      new connections per second (500)\n"
+      "  --connect_timeout S   connect and handshake timeout (10)\n"
+      "  --duration S          measurement duration (30)\n"
+      "  --user NAME --password PASS\n"
+      "  --prefix NAME         mountpoint prefix (LG)\n"
+      "  --seed N              random seed (1)\n"
+      "  --per_client FILE     write per-rover loss as CSV\n", name);
+}
+
+int ParseOptions(int argc, char *argv[], Options* options) {
+  static struct option const kLongOptions[] = {
+    {"host", required_argument, nullptr, 'h'},
+    {"port", required_argument, nullptr, 'p'},
+    {"servers", required_argument, nullptr, 's'},
+    {"rovers", required_argument, nullptr, 'r'},
+    {"threads", required_argument, nullptr, 't'},
+    {"rate", required_argument, nullptr, 'f'},
+    {"payload", required_argument, nullptr, 'l'},
+    {"gga_interval", required_argument, nullptr, 'g'},
+    {"connect_rate", required_argument, nullptr, 'c'},
+    {"connect_timeout", required_argument, nullptr, 'o'},
+    {"duration", required_argument, nullptr, 'd'},
+    {"user", required_argument, nullptr, 'u'},
+    {"password", required_argument, nullptr, 'w'},
+    {"prefix", required_argument, nullptr, 'm'},
+    {"seed", required_argument, nullptr, 'e'},
+    {"per_client", required_argument, nullptr, 'C'},
+    {"help", no_argument, nullptr, '?'},
+    {nullptr, 0, nullptr, 0}
+  };
+  int opt;
+  while ((opt = getopt_long(argc, argv, "", kLongOptions, nullptr)) != -1) {
+    switch (opt) {
+      case 'h': options->host = optarg; break;
+      case 'p': options->port = atoi(optarg); break;
+      case 's': options->servers = atoi(optarg); break;
+      case 'r': options->rovers = atoi(optarg); break;
+      case 't': options->threads = atoi(optarg); break;
+      case 'f': options->rate = atof(optarg); break;
+      case 'l': options->payload = atoi(optarg); break;
+      case 'g': options->gga_interval = atof(optarg); break;
+      case 'c': options->connect_rate = atof(optarg); break;
+      case 'o': options->connect_timeout = atof(optarg); break;
+      case 'd': options->duration = atof(optarg); break;
+      case 'u': options->user = optarg; break;
+      case 'w': options->password = optarg; break;
+      case 'm': options->prefix = optarg; break;
+      case 'e': options->seed = static_cast<uint32_t>(atoi(optarg)); break;
+      case 'C': options->per_client_output = optarg; break;
+      default: return -1;
+    }
+  }
+  if (options->servers < 1 || options->rovers < 0 || options->threads < 1 ||
+      options->rate <= 0 || options->connect_rate <= 0 ||
+      options->duration <= 0) {
+    return -1;
+  }
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  Options options;
+  if (ParseOptions(argc, argv, &options) != 0) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+  RaiseFileLimit(options.servers + options.rovers + 64);
+
+  Totals totals;
+  std::atomic<int> phase{0};
+  std::atomic<bool> measuring{false};
+  std::vector<std::unique_ptr<Worker>> workers;
+  for (int i = 0; i < options.threads; ++i) {
+    workers.emplace_back(
+        new Worker(options, &totals, i, &phase, &measuring));
+  }
+  for (int i = 0; i < options.servers; ++i) {
+    workers[i % options.threads]->AddServer(i);
+  }
+  for (int i = 0; i < options.rovers; ++i) {
+    workers[i % options.threads]->AddRover(i, i % options.servers);
+  }
+  for (auto& worker : workers) worker->Start();
+
+  printf("Connecting %d servers...\n", options.servers);
+  phase = kPhaseServers;
+  WaitForConnections(totals.servers_up, options.servers,
+      options.connect_rate, options.connect_timeout);
+  printf("%d servers up, connecting %d rovers...\n",
+      totals.servers_up.load(), options.rovers);
+  phase = kPhaseRovers;
+  WaitForConnections(totals.rovers_up, options.rovers,
+      options.connect_rate, options.connect_timeout);
+  printf("%d rovers up, measuring for %.1f s...\n",
+      totals.rovers_up.load(), options.duration);
+
+  uint64_t sent_beg = totals.bytes_sent;
+  uint64_t received_beg = totals.bytes_received;
+  uint64_t frames_sent_beg = totals.frames_sent;
+  uint64_t frames_received_beg = totals.frames_received;
+  int64_t beg = NowNanoseconds();
+  measuring = true;
+  std::this_thread::sleep_for(std::chrono::milliseconds(
+      static_cast<int64_t>(options.duration*1000)));
+  measuring = false;
+  double elapsed = static_cast<double>(NowNanoseconds()-beg) / kNsPerSecond;
+  uint64_t bytes_sent = totals.bytes_sent - sent_beg;
+  uint64_t bytes_received = totals.bytes_received - received_beg;
+  uint64_t frames_sent = totals.frames_sent - frames_sent_beg;
+  uint64_t frames_received = totals.frames_received - frames_received_beg;
+  // Let frames in flight arrive before the loss accounting.
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  phase = kPhaseStop;
+  for (auto& worker : workers) worker->Join();
+
+  LatencyHistogram connect_latency;
+  LatencyHistogram delivery_latency;
+  std::vector<double> loss_ratios;
+  uint64_t total_lost = 0;
+  int silent_rovers = 0;
+  FILE* per_client = nullptr;
+  if (!options.per_client_output.empty()) {
+    per_client = fopen(options.per_client_output.c_str(), "w");
+    if (per_client != nullptr) {
+      fprintf(per_client, "rover,mountpoint,received,lost,loss_ratio\n");
+    }
+  }
+  for (auto& worker : workers) {
+    connect_latency.Merge(worker->connect_latency());
+    delivery_latency.Merge(worker->delivery_latency());
+    for (auto const& connection : worker->connections()) {
+      if (connection.role != Role::kRover) continue;
+      uint64_t expected = connection.received + connection.lost;
+      double ratio = expected > 0 ?
+          static_cast<double>(connection.lost) / expected : 0.0;
+      if (connection.received == 0) ++silent_rovers;
+      total_lost += connection.lost;
+      loss_ratios.push_back(ratio);
+      if (per_client != nullptr) {
+        fprintf(per_client, "%d,%s,%llu,%llu,%.6f\n", connection.index,
+            MountPointName(options, connection.mountpoint).c_str(),
+            static_cast<unsigned long long>(connection.received),
+            static_cast<unsigned long long>(connection.lost), ratio);
+      }
+    }
+  }
+  if (per_client != nullptr) fclose(per_client);
+  std::sort(loss_ratios.begin(), loss_ratios.end());
+  auto loss_at = [&] (double p) {
+    if (loss_ratios.empty()) return 0.0;
+    return loss_ratios[static_cast<size_t>(p/100.0*(loss_ratios.size()-1))];
+  };
+  int lossy_rovers = static_cast<int>(loss_ratios.end() -
+      std::upper_bound(loss_ratios.begin(), loss_ratios.end(), 0.0));
+
+  printf("{\"servers\":%d,\"rovers\":%d,\"threads\":%d,\"rate_hz\":%.2f,"
+      "\"payload\":%d,\"duration_s\":%.2f,\n"
+      " \"connect_ok\":%llu,\"connect_failed\":%llu,"
+      "\"handshake_failed\":%llu,\"disconnected\":%llu,\n"
+      " \"connect_ms\":{\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,"
+      "\"max\":%.3f},\n"
+      " \"send_frames_per_s\":%.1f,\"send_mbit_per_s\":%.3f,"
+      "\"frames_skipped\":%llu,\n"
+      " \"recv_frames_per_s\":%.1f,\"recv_mbit_per_s\":%.3f,"
+      "\"gga_sent\":%llu,\n"
+      " \"delivery_ms\":{\"count\":%llu,\"mean\":%.3f,\"p50\":%.3f,"
+      "\"p90\":%.3f,\"p99\":%.3f,\"p999\":%.3f,\"max\":%.3f},\n"
+      " \"loss\":{\"frames\":%llu,\"lossy_rovers\":%d,\"silent_rovers\":%d,"
+      "\"p50\":%.6f,\"p99\":%.6f,\"max\":%.6f}}\n",
+      options.servers, options.rovers, options.threads, options.rate,
+      options.payload, elapsed,
+      static_cast<unsigned long long>(totals.connect_ok.load()),
+      static_cast<unsigned long long>(totals.connect_failed.load()),
+      static_cast<unsigned long long>(totals.handshake_failed.load()),
+      static_cast<unsigned long long>(totals.disconnected.load()),
+      connect_latency.Percentile(50)/1e6, connect_latency.Percentile(90)/1e6,
+      connect_latency.Percentile(99)/1e6, connect_latency.max()/1e6,
+      frames_sent/elapsed, bytes_sent*8/elapsed/1e6,
+      static_cast<unsigned long long>(totals.frames_skipped.load()),
+      frames_received/elapsed, bytes_received*8/elapsed/1e6,
+      static_cast<unsigned long long>(totals.gga_sent.load()),
+      static_cast<unsigned long long>(delivery_latency.count()),
+      delivery_latency.mean()/1e6, delivery_latency.Percentile(50)/1e6,
+      delivery_latency.Percentile(90)/1e6,
+      delivery_latency.Percentile(99)/1e6,
+      delivery_latency.Percentile(99.9)/1e6, delivery_latency.max()/1e6,
+      static_cast<unsigned long long>(total_lost), lossy_rovers,
+      silent_rovers, loss_at(50), loss_at(99),
+      loss_ratios.empty() ? 0.0 : loss_ratios.back());
+  return 0;
+}
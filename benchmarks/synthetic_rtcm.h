@@ -0,0 +1,108 @@
+// MIT License
+//
+// Copyright (c) 2021 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef NTRIPLIB_BENCHMARKS_SYNTHETIC_RTCM_H_
+#define NTRIPLIB_BENCHMARKS_SYNTHETIC_RTCM_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "ntrip/rtcm3_frame.h"
+
+
+namespace libntrip {
+namespace bench {
+
+// Synthetic RTCM3 frames carry the sending source, a sequence number and
+// the send time so receivers can measure loss and delivery latency.
+// Payload: message type(12) + reserved(4) + source id(32) + sequence(32) +
+// send time ns(64) + filler.
+constexpr int kSyntheticMessageType = 4094;  // Proprietary message range.
+constexpr int kSyntheticHeaderLength = 18;
+
+struct SyntheticFrame {
+  uint32_t source_id;
+  uint32_t sequence;
+  int64_t send_ns;
+};
+
+inline
+void PutUint(uint64_t value, int bytes, uint8_t* out) {
+  for (int i = bytes-1; i >= 0; --i) {
+    out[i] = static_cast<uint8_t>(value);
+    value >>= 8;
+  }
+}
+
+inline
+uint64_t GetUint(uint8_t const* in, int bytes) {
+  uint64_t value = 0;
+  for (int i = 0; i < bytes; ++i) value = (value << 8) | in[i];
+  return value;
+}
+
+// Build a CRC-checked frame of `payload_size` payload bytes into `out`.
+inline
+void MakeSyntheticFrame(SyntheticFrame const& info, int payload_size,
+    std::vector<char>* out) {
+  if (payload_size < kSyntheticHeaderLength) {
+    payload_size = kSyntheticHeaderLength;
+  }
+  if (payload_size > 1023) payload_size = 1023;
+  out->resize(kRtcm3HeaderLength + payload_size + kRtcm3CrcLength);
+  auto* ptr = reinterpret_cast<uint8_t*>(out->data());
+  ptr[0] = kRtcm3Preamble;
+  ptr[1] = static_cast<uint8_t>(payload_size >> 8);
+  ptr[2] = static_cast<uint8_t>(payload_size);
+  uint8_t* payload = ptr + kRtcm3HeaderLength;
+  PutUint(kSyntheticMessageType << 4, 2, payload);
+  PutUint(info.source_id, 4, payload+2);
+  PutUint(info.sequence, 4, payload+6);
+  PutUint(static_cast<uint64_t>(info.send_ns), 8, payload+10);
+  for (int i = kSyntheticHeaderLength; i < payload_size; ++i) {
+    payload[i] = static_cast<uint8_t>(i + info.sequence);
+  }
+  int crc_pos = kRtcm3HeaderLength + payload_size;
+  PutUint(Crc24Q(ptr, crc_pos), 3, ptr+crc_pos);
+}
+
+// `frame` is a complete frame as delivered by Rtcm3Framer.
+// Return 0 and fill `info` if it is a synthetic frame, otherwise -1.
+inline
+int ParseSyntheticFrame(char const* frame, int size, SyntheticFrame* info) {
+  if (size < kRtcm3HeaderLength + kSyntheticHeaderLength + kRtcm3CrcLength ||
+      Rtcm3MessageType(frame) != kSyntheticMessageType) {
+    return -1;
+  }
+  auto const* payload =
+      reinterpret_cast<uint8_t const*>(frame) + kRtcm3HeaderLength;
+  info->source_id = static_cast<uint32_t>(GetUint(payload+2, 4));
+  info->sequence = static_cast<uint32_t>(GetUint(payload+6, 4));
+  info->send_ns = static_cast<int64_t>(GetUint(payload+10, 8));
+  return 0;
+}
+
+}  // namespace bench
+}  // namespace libntrip
+
+#endif  // NTRIPLIB_BENCHMARKS_SYNTHETIC_RTCM_H_
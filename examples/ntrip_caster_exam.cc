@@ -20,20 +20,51 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 
+#include <stdio.h>
+
 #include "ntrip/ntrip_caster.h"
 
 
 using libntrip::NtripCaster;
+using libntrip::AdmissionOptions;
+using libntrip::AdmissionStatistics;
+using libntrip::RecorderOptions;
 
 int main(int argc, char *argv[]) {
   NtripCaster ntrip_caster;
   ntrip_caster.Init(2101, 30, 2000);
   // ntrip_caster.Init("127.0.0.1", 8090, 10, 2000);
+  // Shed clients that reconnect in a tight loop.
+  AdmissionOptions admission;
+  admission.ip_rate = 5.0;
+  admission.ip_burst = 20;
+  admission.credential_rate = 2.0;
+  admission.credential_burst = 10;
+  admission.max_handshakes = 16;
+  admission.handshake_timeout_ms = 5000;
+  ntrip_caster.set_admission_options(admission);
+  // ntrip_caster_exam [record_directory]: keep every mountpoint stream.
+  if (argc > 1) {
+    RecorderOptions recording;
+    recording.directory = argv[1];
+    ntrip_caster.set_recording_options(recording);
+  }
   ntrip_caster.Run();
   std::this_thread::sleep_for(std::chrono::seconds(1));  // Maybe take longer?
+  int count = 0;
   while (ntrip_caster.service_is_running()) {
     // TODO(mengyuming@hotmail.com) : Add your code in here.
     std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    if (++count % 600 == 0) {
+      AdmissionStatistics stat = ntrip_caster.admission_statistics();
+      printf("Accepted %llu, shed ip %llu, credential %llu, handshake %llu, "
+          "timeout %llu\n",
+          static_cast<unsigned long long>(stat.accepted),
+          static_cast<unsigned long long>(stat.shed_ip_rate),
+          static_cast<unsigned long long>(stat.shed_credential_rate),
+          static_cast<unsigned long long>(stat.shed_handshake_limit),
+          static_cast<unsigned long long>(stat.handshake_timeout));
+    }
   }
   ntrip_caster.Stop();
   return 0;
@@ -0,0 +1,71 @@
+// MIT License
+//
+// Copyright (c) 2021 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>  // NOLINT.
+#include <string>
+#include <thread>  // NOLINT.
+
+#include "ntrip/ntrip_client_pool.h"
+
+
+using libntrip::ClientSessionOptions;
+using libntrip::NtripClientPool;
+
+// Usage: ntrip_client_pool_exam [sessions] [threads]
+int main(int argc, char* argv[]) {
+  int sessions = (argc > 1) ? atoi(argv[1]) : 100;
+  int threads = (argc > 2) ? atoi(argv[2]) : 2;
+  ClientSessionOptions options;
+  options.ip = "127.0.0.1";
+  options.port = 2101;
+  options.user = "test01";
+  options.passwd = "123456";
+  options.mountpoint = "RTCM32";
+  options.report_interval = 1;
+
+  std::atomic<int64_t> received = {0};
+  NtripClientPool pool;
+  pool.Init(threads);
+  pool.OnSessionClosed([] (int session_id) {
+    printf("Session %d closed\n", session_id);
+  });
+  if (!pool.Run()) return -1;
+  for (int i = 0; i < sessions; ++i) {
+    // Spread the rovers around the base station.
+    options.latitude = 22.57311 + (i % 100) * 0.001;
+    options.longitude = 113.94905 + (i / 100) * 0.001;
+    pool.AddSession(options, [&received] (char const*, int size) {
+      received += size;
+    });
+  }
+  while (pool.session_count() > 0) {
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    printf("Sessions: %d, received: %lld bytes\n", pool.session_count(),
+        static_cast<long long>(received.load()));
+  }
+  pool.Stop();
+  return 0;
+}
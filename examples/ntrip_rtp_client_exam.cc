@@ -0,0 +1,181 @@
+// MIT License
+//
+// Copyright (c) 2021 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>  // NOLINT.
+#include <random>
+#include <string>
+
+#include "ntrip/ntrip_util.h"
+#include "ntrip/rtcm3_frame.h"
+
+
+namespace {
+
+constexpr int kRtpHeaderLength = 12;
+
+int RtspTransaction(int fd, std::string const& request, std::string* reply) {
+  if (send(fd, request.data(), request.size(), 0) !=
+      static_cast<ssize_t>(request.size())) {
+    return -1;
+  }
+  char buffer[1024];
+  int ret = recv(fd, buffer, sizeof(buffer)-1, 0);
+  if (ret <= 0) return -1;
+  reply->assign(buffer, ret);
+  return (reply->find("RTSP/1.0 200 OK") == 0) ? 0 : -1;
+}
+
+}  // namespace
+
+// Usage: ntrip_rtp_client_exam [loss_rate] [seconds]
+//   loss_rate: fraction of datagrams dropped on purpose, e.g. 0.1.
+int main(int argc, char *argv[]) {
+  std::string ip = "127.0.0.1";
+  int port = 2101;
+  std::string user = "test01";
+  std::string passwd = "123456";
+  std::string mountpoint = "RTCM32";
+  double loss_rate = (argc > 1) ? atof(argv[1]) : 0.0;
+  int seconds = (argc > 2) ? atoi(argv[2]) : 10;
+
+  struct sockaddr_in caster_addr;
+  memset(&caster_addr, 0, sizeof(caster_addr));
+  caster_addr.sin_family = AF_INET;
+  caster_addr.sin_port = htons(port);
+  caster_addr.sin_addr.s_addr = inet_addr(ip.c_str());
+  // UDP socket for RTP data, bound to an ephemeral port.
+  int udp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+  struct sockaddr_in local_addr;
+  memset(&local_addr, 0, sizeof(local_addr));
+  local_addr.sin_family = AF_INET;
+  local_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  socklen_t addr_len = sizeof(local_addr);
+  if (bind(udp_fd, reinterpret_cast<struct sockaddr*>(&local_addr),
+      sizeof(local_addr)) != 0 ||
+      getsockname(udp_fd, reinterpret_cast<struct sockaddr*>(&local_addr),
+      &addr_len) != 0) {
+    printf("Bind udp socket failed\n");
+    return 1;
+  }
+  // RTSP control connection.
+  int tcp_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (connect(tcp_fd, reinterpret_cast<struct sockaddr*>(&caster_addr),
+      sizeof(caster_addr)) != 0) {
+    printf("Connect to NtripCaster[%s:%d] failed\n", ip.c_str(), port);
+    return 1;
+  }
+  std::string user_passwd_base64;
+  libntrip::Base64Encode(user + ":" + passwd, &user_passwd_base64);
+  std::string url = "rtsp://" + ip + ":" + std::to_string(port) +
+      "/" + mountpoint;
+  std::string reply;
+  if (RtspTransaction(tcp_fd,
+      "SETUP " + url + " RTSP/1.0\r\n"
+      "CSeq: 1\r\n"
+      "Ntrip-Version: Ntrip/2.0\r\n"
+      "Transport: RTP/GNSS;unicast;client_port=" +
+          std::to_string(ntohs(local_addr.sin_port)) + "\r\n"
+      "Authorization: Basic " + user_passwd_base64 + "\r\n"
+      "\r\n", &reply) != 0) {
+    printf("SETUP failed: %s\n", reply.c_str());
+    return 1;
+  }
+  auto pos = reply.find("Session: ");
+  if (pos == std::string::npos) return 1;
+  std::string session = reply.substr(pos+9, 8);
+  uint32_t ssrc = static_cast<uint32_t>(strtoul(session.c_str(), nullptr, 16));
+  if (RtspTransaction(tcp_fd,
+      "PLAY " + url + " RTSP/1.0\r\n"
+      "CSeq: 2\r\n"
+      "Session: " + session + "\r\n"
+      "\r\n", &reply) != 0) {
+    printf("PLAY failed: %s\n", reply.c_str());
+    return 1;
+  }
+  printf("RTP session %s playing, injected loss rate %.2f\n",
+      session.c_str(), loss_rate);
+
+  std::mt19937 engine(12345);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  uint8_t keepalive[kRtpHeaderLength] = {0x80, 96};
+  for (int i = 0; i < 4; ++i) keepalive[8+i] = ssrc >> (24-8*i);
+  uint8_t buffer[2048];
+  int received = 0, dropped = 0, lost = 0, bad_frames = 0;
+  bool has_sequence = false;
+  uint16_t next_sequence = 0;
+  auto tp_end = std::chrono::steady_clock::now() +
+      std::chrono::seconds(seconds);
+  auto tp_keepalive = std::chrono::steady_clock::now();
+  while (std::chrono::steady_clock::now() < tp_end) {
+    if (std::chrono::steady_clock::now() >= tp_keepalive) {
+      sendto(udp_fd, keepalive, sizeof(keepalive), 0,
+          reinterpret_cast<struct sockaddr*>(&caster_addr),
+          sizeof(caster_addr));
+      tp_keepalive += std::chrono::seconds(5);
+    }
+    struct pollfd pfd = {udp_fd, POLLIN, 0};
+    if (poll(&pfd, 1, 100) <= 0) continue;
+    int ret = recv(udp_fd, buffer, sizeof(buffer), 0);
+    if (ret < kRtpHeaderLength) continue;
+    if (uniform(engine) < loss_rate) {
+      ++dropped;  // Simulated loss on the radio link.
+      continue;
+    }
+    uint16_t sequence = (buffer[2] << 8) | buffer[3];
+    if (has_sequence && sequence != next_sequence) {
+      // Skip the lost frames instead of waiting for them.
+      lost += static_cast<uint16_t>(sequence-next_sequence);
+    }
+    has_sequence = true;
+    next_sequence = sequence+1;
+    ++received;
+    char const* frame = reinterpret_cast<char const*>(buffer)+kRtpHeaderLength;
+    int frame_len = ret-kRtpHeaderLength;
+    if (libntrip::Rtcm3FrameCheck(frame, frame_len) != frame_len) {
+      ++bad_frames;
+      continue;
+    }
+    printf("Frame seq=%u type=%d len=%d\n", sequence,
+        libntrip::Rtcm3MessageType(frame), frame_len);
+  }
+  RtspTransaction(tcp_fd,
+      "TEARDOWN " + url + " RTSP/1.0\r\n"
+      "CSeq: 3\r\n"
+      "Session: " + session + "\r\n"
+      "\r\n", &reply);
+  printf("Received %d frames, dropped %d, detected lost %d, bad %d\n",
+      received, dropped, lost, bad_frames);
+  close(tcp_fd);
+  close(udp_fd);
+  return (bad_frames == 0 && lost == dropped) ? 0 : 1;
+}
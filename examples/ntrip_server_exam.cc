@@ -44,6 +44,7 @@ constexpr uint8_t kExmapleData[] = {
 constexpr int kExmapleDataLength = sizeof(kExmapleData);
 
 using libntrip::NtripServer;
+using libntrip::kSendWouldBlock;
 
 } // namespace
 
@@ -63,9 +64,13 @@ int main(void) {
   ntrip_server.Run();
   std::this_thread::sleep_for(std::chrono::seconds(1));  // Maybe take longer?
   while (ntrip_server.service_is_running()) {
-    if (ntrip_server.SendData((char*)kExmapleData, kExmapleDataLength) != 0) {
-      break;
+    int ret = ntrip_server.SendData((char*)kExmapleData, kExmapleDataLength);
+    if (ret == kSendWouldBlock) {
+      // The caster is behind, try again once it caught up.
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      continue;
     }
+    if (ret != 0) break;
     printf("Send example data success!!!\n");
     std::this_thread::sleep_for(std::chrono::milliseconds(1000));
   }
@@ -0,0 +1,109 @@
+// MIT License
+//
+// Copyright (c) 2021 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef NTRIPLIB_ADMISSION_CONTROL_H_
+#define NTRIPLIB_ADMISSION_CONTROL_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+#include <unordered_map>
+
+
+namespace libntrip {
+
+// Rate and burst of 0 disable the corresponding limit.
+struct AdmissionOptions {
+  double ip_rate = 0.0;          // New connections per second per source IP.
+  int ip_burst = 0;
+  double credential_rate = 0.0;  // Requests per second per credential.
+  int credential_burst = 0;
+  int max_handshakes = 0;        // Connections accepted but not yet served.
+  int handshake_timeout_ms = 0;  // Close connections that never finish.
+};
+
+struct AdmissionStatistics {
+  uint64_t accepted = 0;
+  uint64_t shed_ip_rate = 0;
+  uint64_t shed_credential_rate = 0;
+  uint64_t shed_handshake_limit = 0;
+  uint64_t handshake_timeout = 0;
+};
+
+struct TokenBucket {
+  double tokens = 0.0;
+  int64_t last_ms = 0;
+
+  // Refill at `rate` tokens per second up to `burst`, then take one token.
+  bool Consume(double rate, int burst, int64_t now_ms) {
+    if (last_ms == 0) {
+      tokens = burst;
+    } else {
+      tokens += (now_ms - last_ms) * rate / 1000.0;
+      if (tokens > burst) tokens = burst;
+    }
+    last_ms = now_ms;
+    if (tokens < 1.0) return false;
+    tokens -= 1.0;
+    return true;
+  }
+  bool IsFull(double rate, int burst, int64_t now_ms) const {
+    return tokens + (now_ms - last_ms) * rate / 1000.0 >= burst;
+  }
+};
+
+// Connection admission for the caster event loop, all methods except
+// statistics() must be called from the loop thread.
+class AdmissionControl {
+ public:
+  AdmissionControl() = default;
+  AdmissionControl(AdmissionControl const&) = delete;
+  AdmissionControl& operator=(AdmissionControl const&) = delete;
+
+  void set_options(AdmissionOptions const& options) { options_ = options; }
+  AdmissionOptions const& options(void) const { return options_; }
+
+  // Called right after accept(), return false if the connection is shed.
+  bool AdmitConnection(uint32_t ip, int handshake_count, int64_t now_ms);
+  // Called before parsing a request, `credential` is the raw Basic token.
+  bool AdmitCredential(std::string const& credential, int64_t now_ms);
+  void OnHandshakeTimeout(void) { ++handshake_timeout_; }
+  // Drop idle buckets, buckets that are full again carry no state.
+  void Prune(int64_t now_ms);
+
+  AdmissionStatistics statistics(void) const;
+
+ private:
+  AdmissionOptions options_;
+  std::unordered_map<uint32_t, TokenBucket> ip_buckets_;
+  std::unordered_map<std::string, TokenBucket> credential_buckets_;
+  std::atomic<uint64_t> accepted_ = {0};
+  std::atomic<uint64_t> shed_ip_rate_ = {0};
+  std::atomic<uint64_t> shed_credential_rate_ = {0};
+  std::atomic<uint64_t> shed_handshake_limit_ = {0};
+  std::atomic<uint64_t> handshake_timeout_ = {0};
+};
+
+}  // namespace libntrip
+
+#endif  // NTRIPLIB_ADMISSION_CONTROL_H_
@@ -0,0 +1,104 @@
+// MIT License
+//
+// Copyright (c) 2021 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef NTRIPLIB_DATA_TAP_H_
+#define NTRIPLIB_DATA_TAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "lock_free_queue.h"
+#include "memory_pool.h"
+
+
+namespace libntrip {
+
+// An RTCM3 frame seen on a mountpoint. The payload is a frame-sized pooled
+// copy shared by the taps, holding the frame keeps it out of the pool.
+struct TappedFrame {
+  int mountpoint_id = -1;  // NtripCaster::mountpoint_name() resolves it.
+  int64_t receive_ns = 0;  // Steady clock, when the frame was read.
+  int64_t utc_ns = 0;      // System clock, same instant.
+  PooledBuffer buffer;
+  int offset = 0;
+  int size = 0;
+
+  char const* data(void) const { return buffer.data() + offset; }
+};
+
+struct DataTapOptions {
+  std::vector<std::string> mountpoints;  // Empty taps every mountpoint.
+  size_t capacity = 1024;  // Frames waiting for the consumer.
+};
+
+// Frames of the tapped mountpoints, handed from the caster loop to one
+// consumer thread through a lock-free ring. The caster never waits on the
+// consumer, frames that find the ring full are dropped and counted.
+class DataTap {
+ public:
+  explicit DataTap(DataTapOptions const& options)
+      : options_(options), ring_(options.capacity) {}
+  DataTap(DataTap const&) = delete;
+  DataTap& operator=(DataTap const&) = delete;
+
+  // Consumer thread only, return false if no frame is waiting.
+  bool Pop(TappedFrame* frame) { return ring_.TryPop(frame); }
+  uint64_t delivered(void) const {
+    return delivered_.load(std::memory_order_relaxed);
+  }
+  uint64_t dropped(void) const {
+    return dropped_.load(std::memory_order_relaxed);
+  }
+  DataTapOptions const& options(void) const { return options_; }
+
+ private:
+  friend class NtripCaster;
+
+  bool Accepts(std::string const& mountpoint) const {
+    return options_.mountpoints.empty() ||
+        std::find(options_.mountpoints.begin(), options_.mountpoints.end(),
+            mountpoint) != options_.mountpoints.end();
+  }
+  // Caster loop thread only.
+  void Push(TappedFrame&& frame) {
+    if (ring_.TryPush(std::move(frame))) {
+      delivered_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  DataTapOptions const options_;
+  SpscRing<TappedFrame> ring_;
+  std::atomic<uint64_t> delivered_ = {0};
+  std::atomic<uint64_t> dropped_ = {0};
+};
+
+}  // namespace libntrip
+
+#endif  // NTRIPLIB_DATA_TAP_H_
@@ -0,0 +1,192 @@
+// MIT License
+//
+// Copyright (c) 2021 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef NTRIPLIB_LOCK_FREE_QUEUE_H_
+#define NTRIPLIB_LOCK_FREE_QUEUE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <vector>
+
+
+namespace libntrip {
+
+constexpr size_t kCacheLineSize = 64;
+
+// Bounded single-producer single-consumer ring. TryPush() must only be
+// called by one thread and TryPop() by one other thread.
+template <typename T>
+class SpscRing {
+ public:
+  // `capacity` is rounded up to a power of two.
+  explicit SpscRing(size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) size <<= 1;
+    slots_.resize(size);
+    mask_ = size-1;
+  }
+  SpscRing(SpscRing const&) = delete;
+  SpscRing& operator=(SpscRing const&) = delete;
+
+  // Return false if the ring is full, `value` is left untouched then.
+  bool TryPush(T&& value) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - cached_head_ > mask_) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+      if (tail - cached_head_ > mask_) return false;
+    }
+    slots_[tail & mask_] = std::move(value);
+    tail_.store(tail+1, std::memory_order_release);
+    return true;
+  }
+  // Return false if the ring is empty.
+  bool TryPop(T* value) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head == cached_tail_) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      if (head == cached_tail_) return false;
+    }
+    *value = std::move(slots_[head & mask_]);
+    // Release what the slot still holds before handing it back.
+    slots_[head & mask_] = T();
+    head_.store(head+1, std::memory_order_release);
+    return true;
+  }
+  size_t capacity(void) const { return mask_+1; }
+  // Approximate when called concurrently.
+  size_t size(void) const {
+    return tail_.load(std::memory_order_acquire) -
+        head_.load(std::memory_order_acquire);
+  }
+
+ private:
+  std::vector<T> slots_;
+  size_t mask_ = 0;
+  // Consumer side.
+  char pad0_[kCacheLineSize];
+  std::atomic<size_t> head_ = {0};
+  size_t cached_tail_ = 0;
+  // Producer side.
+  char pad1_[kCacheLineSize];
+  std::atomic<size_t> tail_ = {0};
+  size_t cached_head_ = 0;
+  char pad2_[kCacheLineSize];
+};
+
+// Bounded multi-producer multi-consumer ring, every slot carries a
+// sequence number that tells whose turn it is (D. Vyukov's scheme).
+// Any thread may call TryPush() and TryPop().
+template <typename T>
+class MpmcRing {
+ public:
+  // `capacity` is rounded up to a power of two.
+  explicit MpmcRing(size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) size <<= 1;
+    cells_.reset(new Cell[size]);
+    for (size_t i = 0; i < size; ++i) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    mask_ = size-1;
+  }
+  MpmcRing(MpmcRing const&) = delete;
+  MpmcRing& operator=(MpmcRing const&) = delete;
+
+  // Return false if the ring is full, `value` is left untouched then.
+  bool TryPush(T&& value) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+      cell = &cells_[tail & mask_];
+      size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      intptr_t diff = static_cast<intptr_t>(sequence) -
+          static_cast<intptr_t>(tail);
+      if (diff == 0) {
+        if (tail_.compare_exchange_weak(tail, tail+1,
+                std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        tail = tail_.load(std::memory_order_relaxed);
+      }
+    }
+    cell->value = std::move(value);
+    cell->sequence.store(tail+1, std::memory_order_release);
+    return true;
+  }
+  // Return false if the ring is empty.
+  bool TryPop(T* value) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+      cell = &cells_[head & mask_];
+      size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      intptr_t diff = static_cast<intptr_t>(sequence) -
+          static_cast<intptr_t>(head+1);
+      if (diff == 0) {
+        if (head_.compare_exchange_weak(head, head+1,
+                std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        head = head_.load(std::memory_order_relaxed);
+      }
+    }
+    *value = std::move(cell->value);
+    cell->value = T();
+    cell->sequence.store(head+mask_+1, std::memory_order_release);
+    return true;
+  }
+  size_t capacity(void) const { return mask_+1; }
+  // Approximate when called concurrently.
+  size_t size(void) const {
+    size_t tail = tail_.load(std::memory_order_acquire);
+    size_t head = head_.load(std::memory_order_acquire);
+    return (tail > head) ? tail-head : 0;
+  }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  std::unique_ptr<Cell[]> cells_;
+  size_t mask_ = 0;
+  char pad0_[kCacheLineSize];
+  std::atomic<size_t> head_ = {0};
+  char pad1_[kCacheLineSize];
+  std::atomic<size_t> tail_ = {0};
+  char pad2_[kCacheLineSize];
+};
+
+}  // namespace libntrip
+
+#endif  // NTRIPLIB_LOCK_FREE_QUEUE_H_
@@ -0,0 +1,221 @@
+// MIT License
+//
+// Copyright (c) 2021 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef NTRIPLIB_MEMORY_POOL_H_
+#define NTRIPLIB_MEMORY_POOL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>  // NOLINT.
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+namespace libntrip {
+
+struct MemoryPoolStatistics {
+  uint64_t object_size = 0;
+  uint64_t capacity = 0;     // Objects carved out of the system allocator.
+  uint64_t in_use = 0;
+  uint64_t peak_in_use = 0;
+  uint64_t allocations = 0;  // Total allocations served.
+};
+
+// Fixed-size object allocator backed by slabs of `objects_per_slab` objects.
+// Not thread safe, meant for state owned by one event loop.
+template <typename T>
+class SlabAllocator {
+ public:
+  explicit SlabAllocator(size_t objects_per_slab = 256)
+      : objects_per_slab_(objects_per_slab > 0 ? objects_per_slab : 1) {}
+  SlabAllocator(SlabAllocator const&) = delete;
+  SlabAllocator& operator=(SlabAllocator const&) = delete;
+  ~SlabAllocator() = default;
+
+  template <typename... Args>
+  T* New(Args&&... args) {
+    if (free_list_ == nullptr) Grow();
+    Slot* slot = free_list_;
+    free_list_ = slot->next;
+    T* object = new (&slot->storage) T(std::forward<Args>(args)...);
+    // Single writer, the atomics only make statistics() safe elsewhere.
+    allocations_.store(allocations_.load(std::memory_order_relaxed)+1,
+        std::memory_order_relaxed);
+    uint64_t in_use = in_use_.load(std::memory_order_relaxed)+1;
+    in_use_.store(in_use, std::memory_order_relaxed);
+    if (in_use > peak_in_use_.load(std::memory_order_relaxed)) {
+      peak_in_use_.store(in_use, std::memory_order_relaxed);
+    }
+    return object;
+  }
+  void Delete(T* object) {
+    if (object == nullptr) return;
+    object->~T();
+    Slot* slot = reinterpret_cast<Slot*>(object);
+    slot->next = free_list_;
+    free_list_ = slot;
+    in_use_.store(in_use_.load(std::memory_order_relaxed)-1,
+        std::memory_order_relaxed);
+  }
+  // May be called from any thread.
+  MemoryPoolStatistics statistics(void) const {
+    MemoryPoolStatistics stat;
+    stat.object_size = sizeof(T);
+    stat.capacity = capacity_.load(std::memory_order_relaxed);
+    stat.in_use = in_use_.load(std::memory_order_relaxed);
+    stat.peak_in_use = peak_in_use_.load(std::memory_order_relaxed);
+    stat.allocations = allocations_.load(std::memory_order_relaxed);
+    return stat;
+  }
+
+ private:
+  union Slot {
+    Slot* next;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+  };
+
+  void Grow(void) {
+    slabs_.emplace_back(new Slot[objects_per_slab_]);
+    Slot* slab = slabs_.back().get();
+    for (size_t i = 0; i < objects_per_slab_; ++i) {
+      slab[i].next = free_list_;
+      free_list_ = &slab[i];
+    }
+    capacity_.store(capacity_.load(std::memory_order_relaxed) +
+        objects_per_slab_, std::memory_order_relaxed);
+  }
+
+  size_t objects_per_slab_;
+  std::vector<std::unique_ptr<Slot[]>> slabs_;
+  Slot* free_list_ = nullptr;
+  std::atomic<uint64_t> capacity_ = {0};
+  std::atomic<uint64_t> in_use_ = {0};
+  std::atomic<uint64_t> peak_in_use_ = {0};
+  std::atomic<uint64_t> allocations_ = {0};
+};
+
+class BufferPool;
+
+// Reference counted handle to a pooled buffer, the buffer goes back to its
+// pool when the last handle is released. Handles may cross threads.
+class PooledBuffer {
+ public:
+  PooledBuffer() = default;
+  PooledBuffer(PooledBuffer const& other) : block_(other.block_) {
+    if (block_ != nullptr) block_->refs.fetch_add(1, std::memory_order_relaxed);
+  }
+  PooledBuffer(PooledBuffer&& other) : block_(other.block_) {
+    other.block_ = nullptr;
+  }
+  PooledBuffer& operator=(PooledBuffer other) {
+    std::swap(block_, other.block_);
+    return *this;
+  }
+  ~PooledBuffer() { reset(); }
+
+  char* data(void) const {
+    return reinterpret_cast<char*>(block_) + kHeaderSize;
+  }
+  int capacity(void) const;
+  // Number of valid bytes, set by the producer.
+  int size(void) const { return block_->size; }
+  void set_size(int size) { block_->size = size; }
+  int use_count(void) const {
+    return (block_ == nullptr) ? 0 : block_->refs.load();
+  }
+  explicit operator bool(void) const { return block_ != nullptr; }
+  void reset(void);
+
+ private:
+  friend class BufferPool;
+  struct Block {
+    std::atomic<int> refs;
+    int size;
+    BufferPool* pool;
+  };
+  // Keep the payload cache line aligned, chunks are allocated on this
+  // boundary too.
+  static constexpr size_t kHeaderSize = 64;
+  static_assert(sizeof(Block) <= kHeaderSize, "Buffer header too large");
+
+  explicit PooledBuffer(Block* block) : block_(block) {}
+
+  Block* block_ = nullptr;
+};
+
+// Pool of fixed-size buffers with a small per-thread cache in front of a
+// shared free list. Pools live as long as the process, so buffers and
+// thread caches can safely outlive whoever allocated them.
+class BufferPool {
+ public:
+  // Return the pool for `buffer_size` bytes, creating it on first use.
+  static BufferPool* Instance(int buffer_size);
+
+  PooledBuffer Allocate(void);
+  int buffer_size(void) const { return buffer_size_; }
+  MemoryPoolStatistics statistics(void) const;
+
+ private:
+  friend class PooledBuffer;
+  struct ThreadCache;
+
+  BufferPool(int buffer_size, int index);
+  BufferPool(BufferPool const&) = delete;
+  static ThreadCache& LocalCache(void);
+  BufferPool& operator=(BufferPool const&) = delete;
+
+  void Deallocate(PooledBuffer::Block* block);
+  void Refill(std::vector<PooledBuffer::Block*>* cache);
+  void Drain(std::vector<PooledBuffer::Block*>* cache, size_t keep);
+
+  int const buffer_size_;
+  int const index_;  // Slot of this pool in the per-thread caches.
+  std::mutex mutex_;
+  std::vector<PooledBuffer::Block*> free_list_;
+  std::atomic<uint64_t> capacity_ = {0};
+  std::atomic<uint64_t> in_use_ = {0};
+  std::atomic<uint64_t> peak_in_use_ = {0};
+  std::atomic<uint64_t> allocations_ = {0};
+};
+
+inline
+int PooledBuffer::capacity(void) const {
+  return block_->pool->buffer_size();
+}
+
+inline
+void PooledBuffer::reset(void) {
+  if ((block_ != nullptr) &&
+      (block_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)) {
+    block_->pool->Deallocate(block_);
+  }
+  block_ = nullptr;
+}
+
+}  // namespace libntrip
+
+#endif  // NTRIPLIB_MEMORY_POOL_H_
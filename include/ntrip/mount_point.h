@@ -23,20 +23,96 @@
 #ifndef NTRIPLIB_MOUNT_POINT_H_
 #define NTRIPLIB_MOUNT_POINT_H_
 
+#include <netinet/in.h>
+
+#include <stdint.h>
+
+#include <deque>
 #include <list>
+#include <string>
+#include <vector>
+
+#include "memory_pool.h"
+#include "rtcm3_frame.h"
 
 namespace libntrip {
 
+class DataTap;
+
+// NTRIP 2.0 RTP session, set up by RTSP SETUP/PLAY on a TCP control
+// connection, data is sent to the rover over UDP, one RTCM frame per datagram.
+struct RtpSessionInformation {
+  uint32_t session_id = 0;
+  int control_fd = -1;
+  struct sockaddr_in client_addr = {};
+  uint16_t sequence = 0;
+  bool playing = false;
+  int64_t last_active_ms = 0;  // Last RTSP request or UDP keep-alive.
+};
+
+// Bytes a subscriber socket did not take yet. Payloads stay shared with
+// the other subscribers, only chunk framing is kept inline.
+struct PendingWrite {
+  PooledBuffer buffer;  // Null if the bytes are inline.
+  bool shared = false;  // Buffer is the receive buffer, not a private copy.
+  int offset = 0;
+  int size = 0;
+  char bytes[16];
+
+  char const* data(void) const {
+    return (buffer ? buffer.data() : bytes) + offset;
+  }
+};
+
+// Per-connection state of the caster, allocated from a slab.
+struct ConnectionInformation {
+  int fd = -1;
+  uint32_t ip = 0;
+  int64_t accept_ms = 0;
+  bool handshaking = true;  // Accepted but not served yet.
+  bool chunked = false;  // NTRIP 2.0 subscriber, data is sent in HTTP chunks.
+  std::deque<PendingWrite> backlog;  // Flushed on EPOLLOUT.
+  int backlog_bytes = 0;
+  bool close_when_flushed = false;  // A reply is queued, nothing follows it.
+};
+
+// A base station connection feeding a mountpoint.
+struct MountPointSource {
+  int fd = -1;
+  int priority = 0;  // 0 is the primary, larger values are standby sources.
+  Rtcm3Framer framer;
+  // Frame cadence, an epoch is a burst of frames sent back to back.
+  int64_t last_frame_ms = 0;
+  int64_t epoch_start_ms = 0;
+  int64_t epoch_interval_ms = 0;  // Smoothed, 0 until two epochs are seen.
+  int healthy_epochs = 0;  // Epochs received on time since the last stall.
+};
+
 struct MountPointInformation {
-  int server_fd;
+  int server_fd = -1;  // Source currently forwarded to subscribers.
+  int id = -1;  // Stable for the mountpoint name.
   std::string mountpoint;
   std::string username;
   std::string password;
+  // Sources that declared a priority form a redundant group, its data is
+  // forwarded frame by frame so a failover lands on a frame boundary.
+  // Otherwise the single source is forwarded as is and its framer is only
+  // fed while RTP sessions exist or the mountpoint is recorded.
+  bool redundant = false;
+  int record_stream = -1;  // StreamRecorder stream id, -1 if not recorded.
+  // Added by NtripCaster::AddMountPoint(), kept when its base disconnects.
+  bool persistent = false;
+  // When the base of a persistent mountpoint was lost, 0 while it is fed or
+  // was never fed. Its subscribers are dropped if it stays away too long.
+  int64_t source_lost_ms = 0;
+  std::list<MountPointSource> source_list;
   std::list<int> client_socket_list;
+  std::list<RtpSessionInformation> rtp_session_list;
+  std::vector<DataTap*> taps;  // Owned by NtripCaster::data_taps_.
   // Base station position for auto-selection
-  double latitude;
-  double longitude;
-  bool has_position;  // Flag to indicate if position is available
+  double latitude = 0.0;
+  double longitude = 0.0;
+  bool has_position = false;  // Flag to indicate if position is available
 };
 
 }  // namespace libntrip
@@ -24,19 +24,49 @@
 #define NTRIPLIB_NTRIP_CASTER_H_
 
 #include <sys/epoll.h>
+#include <sys/uio.h>
 
 #include <atomic>
+#include <functional>
 #include <string>
 #include <list>
+#include <mutex>  // NOLINT.
+#include <utility>
 #include <vector>
+#include <random>
 #include <thread>  // NOLINT.
+#include <memory>
+#include <unordered_map>
 
+#include "admission_control.h"
+#include "data_tap.h"
+#include "memory_pool.h"
 #include "mount_point.h"
+#include "source_table.h"
+#include "stream_recorder.h"
 #include "thread_raii.h"
 
 
 namespace libntrip {
 
+// Opt-in low-latency event loop, trades CPU for caster residence time.
+// Pin the caster thread (ThreadOptions::cpus) on a dedicated core with it.
+struct LowLatencyOptions {
+  // Spin on epoll_wait() with a zero timeout instead of blocking.
+  bool busy_poll = false;
+  // Fall back to blocking after this long without events, 0 always spins.
+  int spin_idle_ms = 0;
+  // SO_BUSY_POLL microseconds on accepted sockets, 0 keeps the default.
+  int socket_busy_poll_us = 0;
+};
+
+// Socket options of subscriber connections of a class of mountpoints.
+struct SocketTuning {
+  bool no_delay = false;   // TCP_NODELAY.
+  int not_sent_lowat = 0;  // TCP_NOTSENT_LOWAT bytes, 0 keeps the default.
+  int send_buffer = 0;     // SO_SNDBUF bytes, 0 keeps the default.
+};
+
 class NtripCaster {
  public:
   NtripCaster() = default;
@@ -46,49 +76,174 @@ class NtripCaster {
   NtripCaster& operator=(NtripCaster&&) = delete;
   ~NtripCaster();
 
+  // `thread_options` name, pin and prioritize the event loop thread.
   void Init(int server_port, int max_connection_count,
-      int epoll_wait_timeout) {
+      int epoll_wait_timeout,
+      ThreadOptions const& thread_options = ThreadOptions()) {
     server_port_ = server_port;
     max_count_ = max_connection_count;
     time_out_ = epoll_wait_timeout;
+    thread_.set_options(thread_options);
   }
   void Init(std::string const& server_ip, int server_port,
-      int max_connection_count, int epoll_wait_timeout) {
+      int max_connection_count, int epoll_wait_timeout,
+      ThreadOptions const& thread_options = ThreadOptions()) {
     server_ip_ = server_ip;
     server_port_ = server_port;
     max_count_ = max_connection_count;
     time_out_ = epoll_wait_timeout;
+    thread_.set_options(thread_options);
+  }
+  // Limits checked right after accept(), must be set before Run().
+  void set_admission_options(AdmissionOptions const& options) {
+    admission_.set_options(options);
+  }
+  AdmissionStatistics admission_statistics(void) const {
+    return admission_.statistics();
+  }
+  // Let a base that reconnects with the same credentials replace its stale
+  // session, subscribers stay connected. Enabled by default.
+  void set_mountpoint_takeover(bool enable) {
+    mountpoint_takeover_ = enable;
+  }
+  // Occupancy of the connection record slab and of the I/O buffer pool.
+  MemoryPoolStatistics connection_pool_statistics(void) const {
+    return connection_allocator_.statistics();
+  }
+  MemoryPoolStatistics buffer_pool_statistics(void) const;
+  // Record the frames of mountpoints to segment files, set before Run().
+  void set_recording_options(RecorderOptions const& options) {
+    recorder_.set_options(options);
+    recording_ = true;
+  }
+  RecorderStatistics recorder_statistics(void) const {
+    return recorder_.statistics();
+  }
+  // Must be set before Run().
+  void set_low_latency_options(LowLatencyOptions const& options) {
+    low_latency_ = options;
+  }
+  // Tune subscribers of mountpoints whose name starts with `prefix`,
+  // the longest matching prefix wins, "" matches every mountpoint.
+  void set_socket_tuning(std::string const& prefix,
+      SocketTuning const& tuning) {
+    socket_tunings_.emplace_back(prefix, tuning);
   }
+  // Deliver the frames of the selected mountpoints to a consumer thread,
+  // see DataTap. May be called before or after Run().
+  std::shared_ptr<DataTap> AddDataTap(DataTapOptions const& options);
+  void RemoveDataTap(std::shared_ptr<DataTap> const& tap);
+  // Name of TappedFrame::mountpoint_id, thread safe.
+  std::string mountpoint_name(int mountpoint_id) const;
   bool Run(void);
+  // Runs on the event loop thread and waits for it to exit.
   void Stop(void);
+  // Admin commands, queued to the event loop thread, return at once.
+  // Disconnect the subscribers of `mountpoint` connected from `client_ip`,
+  // all of them if `client_ip` is empty.
+  void KickClient(std::string const& mountpoint,
+      std::string const& client_ip = "");
+  // Reserve a mountpoint, a base that posts with these credentials feeds
+  // it. `ntrip_str` is its sourcetable record, it stays listed while the
+  // base is away.
+  void AddMountPoint(std::string const& mountpoint,
+      std::string const& username, std::string const& password,
+      std::string const& ntrip_str = "");
   bool service_is_running(void) const {
     return service_is_running_.load();
   }
 
  private:
   void ThreadHandler(void);
+  void PostCommand(std::function<void(void)> command);
+  void RunCommands(void);
   int AcceptNewConnect(void);
+  ConnectionInformation* FindConnection(int socket_fd) const;
+  void FinishHandshake(int socket_fd);
+  void ReleaseConnection(int socket_fd);
   void Disconnect(int socket_fd);
+  void CloseAfterBatch(int socket_fd);
+  bool ClosingAfterBatch(int socket_fd) const;
   int ParseData(int socket_fd, char const* buffer, int buffer_len);
-  void SendSourceTableData(int socket_fd);
+  bool AdmitRequest(int socket_fd, std::string const& request);
+  void SendSourceTableData(int socket_fd, std::string const& query,
+      bool ntrip_version_2, std::string const& if_none_match);
   int TryToForwardServerData(int socket_fd,
       char const* buffer, int buffer_len);
+  void ForwardToSubscribers(MountPointInformation* info,
+      MountPointSource* source, char const* buffer, int buffer_len);
+  void ForwardRedundantData(MountPointInformation* info,
+      MountPointSource* source, char const* buffer, int buffer_len);
+  void DeliverToTaps(MountPointInformation* info,
+      char const* frame, int frame_len);
+  void InitMountPoint(MountPointInformation* info);
+  void SendToSubscribers(MountPointInformation* info,
+      char const* data, int size, PooledBuffer const* owner);
+  void SendToSubscriber(ConnectionInformation* connection,
+      struct iovec const* iov, int iovcnt, PooledBuffer const* owner);
+  void QueueBytes(ConnectionInformation* connection,
+      char const* data, int size, PooledBuffer const* owner);
+  void FlushBacklog(int socket_fd);
+  void SelectActiveSource(MountPointInformation* info,
+      MountPointSource* candidate, int64_t now);
+  void SendRtpFrame(MountPointInformation* info,
+      char const* frame, int frame_len);
   int ServerConnectRequest(
       std::vector<std::string> const& lines, int socket_fd);
   int ClientConnectRequest(
       std::vector<std::string> const& lines, int socket_fd);
+  int AddSubscriber(MountPointInformation* info, int socket_fd,
+      bool ntrip_version_1, bool ntrip_version_2);
+  void TakeOverMountPoint(MountPointInformation* info,
+      MountPointSource* source, int socket_fd, std::string const& ntrip_str);
+  void TuneSubscriberSocket(int socket_fd, std::string const& mountpoint);
+  int RtspRequest(std::vector<std::string> const& lines, int socket_fd);
+  void ReceiveRtpPacket(void);
+  void PeriodicCheck(void);
+  void CheckRtpSessionTimeout(int64_t now);
+  void CheckHandshakeTimeout(int64_t now);
+  void CheckSourceReconnect(int64_t now);
 
   std::atomic_bool service_is_running_ = {false};
   std::string server_ip_;
   int server_port_ = -1;
   int time_out_ = 0;
   int listen_sock_ = -1;
+  int udp_sock_ = -1;
   int epoll_fd_ = -1;
+  int event_fd_ = -1;  // Wakes the event loop for queued commands.
+  bool loop_exit_ = false;  // Only touched by the event loop thread.
+  std::mutex command_mutex_;
+  std::vector<std::function<void(void)>> commands_;
   int max_count_ = 0;
+  bool mountpoint_takeover_ = true;
+  bool recording_ = false;
+  LowLatencyOptions low_latency_;
+  std::vector<std::pair<std::string, SocketTuning>> socket_tunings_;
   struct epoll_event *epoll_events_ = nullptr;
   Thread thread_;
   std::list<MountPointInformation> mount_point_infos_;
-  std::vector<std::string> ntrip_str_list_;
+  SourceTable source_table_;
+  // Loop thread only, MountPointInformation::taps point into it.
+  std::vector<std::shared_ptr<DataTap>> data_taps_;
+  mutable std::mutex mountpoint_id_mutex_;
+  std::unordered_map<std::string, int> mountpoint_ids_;
+  std::vector<std::string> mountpoint_names_;
+  std::vector<char> frame_batch_;  // Whole frames of a redundant mountpoint.
+  // Socket reads land here, subscriber backlogs may hold references to it.
+  PooledBuffer receive_buffer_;
+  std::mt19937 session_id_engine_{std::random_device{}()};
+  int64_t last_check_ms_ = 0;
+  int64_t last_prune_ms_ = 0;
+  AdmissionControl admission_;
+  // Connection records indexed by fd.
+  SlabAllocator<ConnectionInformation> connection_allocator_;
+  std::vector<ConnectionInformation*> connections_;
+  // Closed once the current epoll batch is handled, so the fd number is not
+  // reused while events for it are still pending in the batch.
+  std::vector<int> closing_fds_;
+  int handshake_count_ = 0;
+  StreamRecorder recorder_;
 };
 
 }  // namespace libntrip
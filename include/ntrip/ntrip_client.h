@@ -25,13 +25,27 @@
 
 #if defined(WIN32) || defined(_WIN32)
 #include <winsock2.h>
+#else
+#include <sys/socket.h>
 #endif  // defined(WIN32) || defined(_WIN32)
 
+#include <stdint.h>
+
 #include <atomic>
+#include <condition_variable>  // NOLINT.
+#include <deque>
 #include <string>
 #include <thread>  // NOLINT.
 #include <functional>
+#include <memory>
+#include <mutex>  // NOLINT.
+#include <vector>
 
+#include "./lock_free_queue.h"
+#include "./memory_pool.h"
+#include "./ntrip_util.h"
+#include "./rtcm3_frame.h"
+#include "./source_table.h"
 #include "./thread_raii.h"
 
 
@@ -39,6 +53,47 @@ namespace libntrip {
 
 using ClientCallback = std::function<void (char const* _buffer, int _size)>;
 
+// A CRC-checked RTCM3 frame. It points into the client's receive buffer
+// and is only valid during the callback.
+struct Rtcm3FrameView {
+  char const* data;
+  int size;
+  int message_type;
+  int64_t receive_ns;  // Steady clock, when the frame was read.
+};
+using ClientFrameCallback = std::function<void (Rtcm3FrameView const& _frame)>;
+
+// What the network thread does when the delivery queue is full.
+enum class DeliveryPolicy {
+  kDropNewest,  // Drop the new data and count it, the socket keeps draining.
+  kBlock,  // Wait for the consumer, TCP then slows the caster down.
+};
+
+struct DeliveryOptions {
+  size_t capacity = 256;  // Receives or frames waiting for the consumer.
+  DeliveryPolicy policy = DeliveryPolicy::kDropNewest;
+  // Run the callbacks on a thread of the client, otherwise the
+  // application calls NtripClient::Dispatch().
+  bool dispatch_thread = true;
+};
+
+struct DeliveryStatistics {
+  size_t depth = 0;  // Items waiting now.
+  size_t peak_depth = 0;
+  uint64_t delivered = 0;
+  uint64_t dropped = 0;
+  int64_t blocked_ns = 0;  // Time the network thread waited, kBlock only.
+};
+
+// A caster and mountpoint the client can take the stream from.
+struct CasterEndpoint {
+  std::string ip;
+  int port = 8090;
+  std::string user;
+  std::string passwd;
+  std::string mountpoint;
+};
+
 class NtripClient {
  public:
   NtripClient() = default;
@@ -54,14 +109,17 @@ class NtripClient {
         mountpoint_(mountpoint) { }
   ~NtripClient() { Stop(); }
 
+  // `thread_options` name, pin and prioritize the receive thread.
   void Init(std::string const& ip, int port,
       std::string const& user, std::string const& passwd,
-      std::string const& mountpoint) {
+      std::string const& mountpoint,
+      ThreadOptions const& thread_options = ThreadOptions()) {
     server_ip_ = ip;
     server_port_ = port;
     user_ = user;
     passwd_ = passwd;
     mountpoint_ = mountpoint;
+    thread_.set_options(thread_options);
   }
   // 更新发送的GGA语句.
   // 根据ntrip账号的要求, 如果距离服务器位置过远, 服务器不会返回差分数据.
@@ -78,9 +136,76 @@ class NtripClient {
   void set_report_interval(int intv) {
     report_interval_ = intv;
   }
+  // Time allowed for connect and the caster reply, in milliseconds.
+  void set_connect_timeout(int timeout_ms) {
+    connect_timeout_ms_ = timeout_ms;
+  }
+  // Reconnect when the stream drops instead of ending the service. The
+  // first attempt is immediate, then the delay doubles from
+  // `initial_delay_ms` up to `max_delay_ms`, with random jitter. Off by
+  // default, must be set before Run().
+  void set_auto_reconnect(bool enable, int initial_delay_ms = 100,
+      int max_delay_ms = 30000) {
+    auto_reconnect_ = enable;
+    reconnect_initial_ms_ = initial_delay_ms;
+    reconnect_max_ms_ = max_delay_ms;
+  }
+  int reconnect_count(void) const { return reconnect_count_.load(); }
+  // Standby casters, in order of preference. While the stream runs, the
+  // client keeps a logged-in connection to the first reachable standby
+  // and switches to it when the active stream stalls. The stall timeout
+  // is learned from the frame cadence unless `stall_timeout_ms` is set.
+  // Must be set before Run(), Linux only.
+  void set_standby(std::vector<CasterEndpoint> const& endpoints,
+      int stall_timeout_ms = 0) {
+    standby_endpoints_ = endpoints;
+    stall_timeout_ms_ = stall_timeout_ms;
+  }
+  // Download the sourcetable of the caster given to the constructor or
+  // Init(). With `cache_path` the cached table is loaded first, the
+  // download is conditional on its validators and a new table replaces
+  // the cache. Return 0 if `table` holds the current table, -1 if the
+  // download failed, `table` then holds the cached one if there was one.
+  int FetchSourceTable(SourceTableSnapshot* table,
+      std::string const& cache_path = "");
+  // Choose the mountpoint from `table`: Run() connects to the station
+  // nearest to the rover position that passes `filter`, and the client
+  // moves to another station once it is `switch_margin_km` nearer than
+  // the current one. Must be set before Run().
+  void set_auto_mountpoint(SourceTableSnapshot const& table,
+      StationFilter const& filter, double switch_margin_km = 5.0) {
+    station_table_ = std::make_shared<SourceTableSnapshot const>(table);
+    station_filter_ = filter;
+    switch_margin_m_ = switch_margin_km * 1000.0;
+  }
+  int failover_count(void) const { return failover_count_.load(); }
+  // 0 for the caster given to the constructor or Init(), n for the n-th
+  // standby.
+  int active_endpoint(void) const { return active_endpoint_.load(); }
 
   // 设置接收到数据时的回调函数.
   void OnReceived(const ClientCallback &callback) { callback_ = callback; }
+  // Deliver whole RTCM3 frames instead of raw bytes, OnReceived is no
+  // longer called. Bytes outside valid frames are skipped and counted.
+  // Must be set before Run().
+  void OnFrame(const ClientFrameCallback &callback) {
+    frame_callback_ = callback;
+  }
+  uint64_t discarded_bytes(void) const { return discarded_bytes_.load(); }
+  // Pass received data to the callbacks through a bounded lock-free queue
+  // instead of calling them on the network thread, so a slow consumer
+  // does not stop the socket from being read. Must be set once, before
+  // Run() and before any thread dispatches. The queue is kept across
+  // restarts, data left from the last session is still delivered.
+  void set_delivery_queue(DeliveryOptions const& options) {
+    delivery_options_ = options;
+    delivery_queue_.reset(new SpscRing<QueuedData>(options.capacity));
+  }
+  // Run the callbacks of up to `max_items` queued items on the calling
+  // thread, waiting up to `timeout_ms` for the first one. Return the
+  // number of items delivered. Only one thread may dispatch.
+  int Dispatch(int max_items = 64, int timeout_ms = 0);
+  DeliveryStatistics delivery_statistics(void) const;
   bool Run(void);
   void Stop(void);
   bool service_is_running(void) const {
@@ -88,8 +213,108 @@ class NtripClient {
   }
 
  private:
+#if defined(WIN32) || defined(_WIN32)
+  using Socket = SOCKET;
+#else
+  using Socket = int;
+#endif  // defined(WIN32) || defined(_WIN32)
+  // An endpoint with its resolved address, which is refreshed after a
+  // TTL or a failed connect.
+  struct EndpointState {
+    CasterEndpoint config;
+    struct sockaddr_storage addr = {};
+    int addr_len = 0;
+    int64_t resolved_ms = 0;
+  };
+  // Data on its way to the consumer, a whole receive or one frame.
+  struct QueuedData {
+    PooledBuffer buffer;
+    int offset = 0;
+    int size = 0;
+    int message_type = 0;  // Frame mode only.
+    int64_t receive_ns = 0;
+  };
+  // A frame a standby connection holds for the failover.
+  struct HeldFrame {
+    int offset;
+    int size;
+    int64_t receive_ns;
+  };
+  // A caster connection, the active stream or the standby.
+  struct Link {
+    int endpoint = -1;  // Index into endpoints_.
+#if defined(WIN32) || defined(_WIN32)
+    Socket fd = INVALID_SOCKET;
+#else
+    Socket fd = -1;
+#endif  // defined(WIN32) || defined(_WIN32)
+    int state = 0;
+    int64_t deadline_ms = 0;  // Connect and login deadline.
+    std::string reply;  // Caster reply, then the stream data that came with it.
+    bool chunked = false;  // The caster sends the stream in HTTP chunks.
+    HttpChunkDecoder chunks;
+    int received = 0;  // Result of the last recv(), chunk framing included.
+    // Receive buffer, unconsumed bytes are [begin, end).
+    PooledBuffer buffer;
+    int buffer_size = 0;
+    int begin = 0;
+    int end = 0;
+    int scanned = 0;  // Standby only, frames before it are held.
+    std::deque<HeldFrame> held;
+    Rtcm3Framer framer;
+    int64_t last_data_ms = 0;
+  };
+
   // Thread handler.
   void ThreadHandler(void);
+  // Receive until the stream ends, return false if Stop() was called.
+  bool ReceiveLoop(void);
+  // Connect and log in to endpoint `endpoint`, 0 if success.
+  int Connect(Link* link, int endpoint);
+  // Start a non-blocking connect, 0 if it is under way.
+  int StartConnect(Link* link, int endpoint);
+  // Continue a login when its socket is ready, 1 once the stream runs,
+  // 0 if it is still under way, -1 if it failed and `link` was closed.
+  int AdvanceLogin(Link* link);
+  int SendRequest(Link* link);
+  // Receive once on a streaming `link`, like recv() but the result counts
+  // payload bytes only. Chunk framing alone reads as would-block. Stream
+  // data left in `reply` is read before the socket.
+  int Receive(Link* link);
+  void CloseLink(Link* link);
+  int ResolveServer(EndpointState* endpoint);
+  // Wait for `events` on `fd` until `deadline_ms`, 1 if ready,
+  // 0 on timeout, -1 on error or if Stop() was called.
+  int WaitSocket(Socket fd, int16_t events, int64_t deadline_ms,
+      bool interruptible = true);
+  // 0 if `table` got a new table, 1 if `cached` is still current.
+  int DownloadSourceTable(EndpointState* server,
+      SourceTableSnapshot const* cached, SourceTableSnapshot* table);
+  // Point the primary caster at the station nearest to the rover,
+  // return true if the mountpoint changed.
+  bool SelectStation(void);
+  void RoverPosition(double* latitude, double* longitude);
+  // Return false if Stop() was called while waiting.
+  bool WaitForStop(int timeout_ms);
+  // Pass `size` new bytes at the end of the active buffer to the consumer.
+  void Deliver(int size);
+  void DeliverFrame(char const* data, int size, int64_t receive_ns,
+      bool dedup);
+  // Keep the frames of `size` new bytes of the standby.
+  void HoldStandbyData(int size);
+  // Copy the stream data that came with the login into the link buffer,
+  // as much as fits. The rest is left in `reply` for the next Receive().
+  int TakeReplyData(Link* link);
+  void MaintainStandby(int64_t now_ms);
+  // Close the standby and try the next endpoint later.
+  void DropStandby(int64_t now_ms);
+  // Make the standby the active stream.
+  void Failover(void);
+  int64_t StallTimeoutMs(void) const;
+  // Queue data for the consumer, false if it was dropped.
+  bool Enqueue(QueuedData&& data);
+  void DispatchHandler(void);
+  int SendGga(Socket fd);
 
   std::atomic_bool service_is_running_ = {false};
   std::atomic_bool gga_is_update_ = {false};  // 外部更新GGA数据标志.
@@ -102,13 +327,55 @@ class NtripClient {
   std::string passwd_;
   std::string mountpoint_;
   std::string gga_buffer_;
+  int connect_timeout_ms_ = 3000;
+  bool auto_reconnect_ = false;
+  int reconnect_initial_ms_ = 100;
+  int reconnect_max_ms_ = 30000;
+  std::atomic<int> reconnect_count_ = {0};
+  std::atomic<uint64_t> discarded_bytes_ = {0};
+  std::vector<CasterEndpoint> standby_endpoints_;
+  int stall_timeout_ms_ = 0;
+  std::atomic<int> failover_count_ = {0};
+  std::atomic<int> active_endpoint_ = {0};
+  // The primary caster, then the standbys.
+  std::vector<EndpointState> endpoints_;
+  Link active_;
+  Link standby_;
+  int standby_next_ = 1;  // Next endpoint to try as standby.
+  int64_t standby_retry_ms_ = 0;  // When to try again.
+  int standby_delay_ms_ = 0;
+  int64_t epoch_interval_ms_ = 0;  // Learned gap between data bursts.
+  // Frames delivered lately, to drop the overlap after a failover.
+  std::vector<uint64_t> recent_frames_;
+  size_t recent_next_ = 0;
+  int64_t dedup_until_ms_ = 0;
+  std::shared_ptr<SourceTableSnapshot const> station_table_;
+  StationFilter station_filter_;
+  double switch_margin_m_ = 5000.0;
+  int station_ = -1;  // Index into station_table_->stations().
+  bool station_changed_ = false;
 #if defined(WIN32) || defined(_WIN32)
-  SOCKET socket_fd_ = INVALID_SOCKET;
-#else
-  int socket_fd_ = -1;
+  bool winsock_started_ = false;
 #endif  // defined(WIN32) || defined(_WIN32)
+#if defined(__linux__)
+  int wake_fd_ = -1;  // eventfd, wakes the receive thread for Stop().
+#endif  // defined(__linux__)
+  DeliveryOptions delivery_options_;
+  std::unique_ptr<SpscRing<QueuedData>> delivery_queue_;
+  std::atomic_bool dispatching_ = {false};
+  // Set while a side sleeps on delivery_cv_.
+  std::atomic_bool consumer_waiting_ = {false};
+  std::atomic_bool producer_waiting_ = {false};
+  std::mutex delivery_mutex_;
+  std::condition_variable delivery_cv_;
+  std::atomic<size_t> delivery_peak_ = {0};
+  std::atomic<uint64_t> delivery_delivered_ = {0};
+  std::atomic<uint64_t> delivery_dropped_ = {0};
+  std::atomic<int64_t> delivery_blocked_ns_ = {0};
+  Thread dispatch_thread_;
   Thread thread_;
   ClientCallback callback_ = [] (char const*, int) -> void {};
+  ClientFrameCallback frame_callback_;
 };
 
 }  // namespace libntrip
@@ -0,0 +1,112 @@
+// MIT License
+//
+// Copyright (c) 2021 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef NTRIPLIB_NTRIP_CLIENT_POOL_H_
+#define NTRIPLIB_NTRIP_CLIENT_POOL_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>  // NOLINT.
+#include <string>
+#include <vector>
+
+#include "./ntrip_client.h"
+#include "./thread_raii.h"
+
+
+namespace libntrip {
+
+// Caster account and rover position of one pooled session, the same
+// settings an NtripClient takes.
+struct ClientSessionOptions {
+  std::string ip;
+  int port = 2101;
+  std::string user;
+  std::string passwd;
+  std::string mountpoint;
+  double latitude = 22.570535;  // Used to generate GGA if `gga` is empty.
+  double longitude = 113.937739;
+  std::string gga;
+  int report_interval = 1;  // GGA report interval, seconds.
+};
+
+// Called on a pool thread when a session ends on its own: it could not
+// connect, was refused, timed out or was closed by the caster.
+using SessionClosedCallback = std::function<void (int _session_id)>;
+
+// Many NtripClient sessions multiplexed on a few epoll threads. A session
+// costs a socket and a few hundred bytes, receive buffers belong to the
+// threads. Callbacks run on the thread that owns the session, so they must
+// not block. Linux only.
+class NtripClientPool {
+ public:
+  NtripClientPool();
+  NtripClientPool(NtripClientPool const&) = delete;
+  NtripClientPool(NtripClientPool&&) = delete;
+  NtripClientPool& operator=(NtripClientPool const&) = delete;
+  NtripClientPool& operator=(NtripClientPool&&) = delete;
+  ~NtripClientPool();
+
+  // `thread_options` apply to every pool thread, must be set before Run().
+  void Init(int thread_count,
+      ThreadOptions const& thread_options = ThreadOptions()) {
+    thread_count_ = (thread_count > 0) ? thread_count : 1;
+    thread_options_ = thread_options;
+  }
+  void OnSessionClosed(SessionClosedCallback const& callback) {
+    closed_callback_ = callback;
+  }
+  bool Run(void);
+  void Stop(void);
+  bool service_is_running(void) const {
+    return service_is_running_.load();
+  }
+
+  // Connect a session, return its id, or -1 if the pool is not running.
+  // `callback` gets the data of the mountpoint like NtripClient::OnReceived.
+  int AddSession(ClientSessionOptions const& options,
+      ClientCallback const& callback);
+  void RemoveSession(int session_id);
+  void set_gga_buffer(int session_id, std::string const& gga_buffer);
+  void set_location(int session_id, double latitude, double longitude);
+  int session_count(void) const { return session_count_.load(); }
+
+ private:
+  class Worker;
+
+  Worker* WorkerOf(int session_id) const;
+
+  std::atomic_bool service_is_running_ = {false};
+  int thread_count_ = 1;
+  ThreadOptions thread_options_;
+  SessionClosedCallback closed_callback_ = [] (int) -> void {};
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::atomic<int> next_session_id_ = {0};
+  std::atomic<int> session_count_ = {0};
+};
+
+}  // namespace libntrip
+
+#endif  // NTRIPLIB_NTRIP_CLIENT_POOL_H_
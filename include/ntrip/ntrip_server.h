@@ -27,17 +27,63 @@
 #include <winsock2.h>
 #endif  // defined(WIN32) || defined(_WIN32)
 
+#include <stdint.h>
+
+#include <functional>
 #include <string>
 #include <thread>  // NOLINT.
-#include <list>
 #include <vector>
 #include <atomic>
+#include <condition_variable>  // NOLINT.
+#include <memory>
+#include <mutex>  // NOLINT.
 
+#include "./lock_free_queue.h"
+#include "./memory_pool.h"
 #include "./thread_raii.h"
 
 
 namespace libntrip {
 
+// SendData() result when the send backlog is full, nothing was taken.
+constexpr int kSendWouldBlock = 1;
+
+// How SendData() disposed of the data.
+struct SendResult {
+  int accepted = 0;  // Bytes the socket took now.
+  int queued = 0;  // Bytes kept in the backlog, they follow in order.
+};
+using WritableCallback = std::function<void ()>;
+
+// What PushData() does when the send queue is full.
+enum class PushOverflow {
+  kDropOldest,  // Drop the oldest queued pushes, PushData() never waits.
+  kBlock,  // Wait until the I/O thread has made room.
+};
+
+struct PushOptions {
+  size_t capacity = 1024;  // Queued pushes.
+  PushOverflow overflow = PushOverflow::kDropOldest;
+  // Queued data is written as soon as there are `flush_bytes` of it, or
+  // once its oldest byte waited `latency_budget_us`.
+  int flush_bytes = 1400;
+  int latency_budget_us = 2000;
+};
+
+struct PushStatistics {
+  uint64_t queued_bytes = 0;  // Pushed, not written yet.
+  uint64_t peak_queued_bytes = 0;
+  uint64_t pushed = 0;  // Pushes queued.
+  uint64_t dropped = 0;
+  uint64_t dropped_bytes = 0;
+  uint64_t sent_bytes = 0;
+  uint64_t flushes = 0;  // Batched writes.
+  // From PushData() until the data is written to the socket.
+  int64_t mean_flush_latency_ns = 0;
+  int64_t max_flush_latency_ns = 0;
+  int64_t blocked_ns = 0;  // Time PushData() waited, kBlock only.
+};
+
 class NtripServer {
  public:
   NtripServer() = default;
@@ -53,19 +99,34 @@ class NtripServer {
           mountpoint_(mountpoint), ntrip_str_(ntrip_str) { }
   ~NtripServer();
 
+  // `thread_options` name, pin and prioritize the service thread.
   void Init(std::string const& ip, int port,
       std::string const& user, std::string const& passwd,
-      std::string const& mountpoint, std::string const& ntrip_str) {
+      std::string const& mountpoint, std::string const& ntrip_str,
+      ThreadOptions const& thread_options = ThreadOptions()) {
     server_ip_ = ip;
     server_port_ = port;
     user_ = user;
     passwd_ = passwd;
     mountpoint_ = mountpoint;
     ntrip_str_ = ntrip_str;
+    thread_.set_options(thread_options);
+  }
+  // Join a redundant mountpoint: 0 is the primary, 1, 2... are standby.
+  // The caster switches subscribers over when the active source stalls.
+  void set_source_priority(int priority) {
+    source_priority_ = priority;
   }
 
-  // Return 0 if success.
-  int SendData(const char *data, int size);
+  // Send on the calling thread without waiting. What the socket does not
+  // take goes to a backlog that is written from the exact offset once the
+  // socket is writable, so a frame is never cut. Return 0 if all of
+  // `data` was sent or queued, kSendWouldBlock if the backlog is full and
+  // none of it was taken (retry after OnWritable), -1 on error.
+  int SendData(char const* data, int size, SendResult* result);
+  int SendData(const char *data, int size) {
+    return SendData(data, size, nullptr);
+  }
   int SendData(std::vector<char> const& data) {
     return SendData(data.data(), data.size());
   }
@@ -73,10 +134,37 @@ class NtripServer {
     return SendData(data.data(), data.size());
   }
 
-  // TODO(mengyuming@hotmail.com) : Not implemented.
-  void PushData(char const* data, int size);
-  void PushData(std::vector<char> const& data);
-  void PushData(std::string const& data);
+  // Queue data for the I/O thread and return at once, for producers that
+  // must not wait on the network, from any number of threads. Small
+  // pushes are batched into one write. Each push is queued, dropped and
+  // written whole, and pushes of concurrent producers interleave only at
+  // push boundaries, so each must carry whole frames. Return 0 if it was
+  // queued, data pushed while the server stops is dropped. Do not mix with
+  // SendData() while data is queued. Linux only, other platforms send on
+  // the calling thread.
+  int PushData(char const* data, int size);
+  int PushData(std::vector<char> const& data) {
+    return PushData(data.data(), data.size());
+  }
+  int PushData(std::string const& data) {
+    return PushData(data.data(), data.size());
+  }
+  // Must be set before Run().
+  void set_push_options(PushOptions const& options) {
+    push_options_ = options;
+  }
+  // Backlog size above which SendData() would block, 64 KiB by default.
+  // A send is always taken while the backlog is empty.
+  void set_send_backlog_limit(int bytes) {
+    send_backlog_limit_ = bytes;
+  }
+  // Called on the server thread once a backlog that made SendData()
+  // return kSendWouldBlock has been written. Must be set before Run().
+  void OnWritable(WritableCallback callback) {
+    writable_callback_ = callback;
+  }
+  int send_backlog_bytes(void) const { return send_backlog_bytes_.load(); }
+  PushStatistics push_statistics(void) const;
 
   bool Run(void);
   void Stop(void);
@@ -85,8 +173,25 @@ class NtripServer {
   }
 
  private:
+  // Data waiting for the I/O thread.
+  struct PushItem {
+    PooledBuffer buffer;  // One whole push, buffer.size() bytes.
+    int64_t push_ns = 0;
+  };
+
   // Thread handler.
   void ThreadHandler(void);
+  // Queue `item`, false if it was dropped.
+  bool Enqueue(PushItem&& item);
+  // Write as much of `batch` as the socket takes, `sent` bytes of its
+  // first item are out already. Return -1 on a socket error.
+  int Flush(std::vector<PushItem>* batch, int* sent, bool* blocked);
+  // Write what the socket takes of the SendData() backlog, with
+  // send_mutex_ held. Return -1 on a socket error.
+  int FlushBacklog(void);
+  // Flush the backlog from the server thread and report the socket
+  // writable if a sender waits for that. Return -1 on a socket error.
+  int ServiceBacklog(void);
 
   std::atomic_bool service_is_running_ = {false};
   std::string server_ip_;
@@ -95,13 +200,42 @@ class NtripServer {
   std::string passwd_;
   std::string mountpoint_;
   std::string ntrip_str_;
+  int source_priority_ = -1;  // Not part of a redundant mountpoint.
 #if defined(WIN32) || defined(_WIN32)
   SOCKET socket_fd_ = INVALID_SOCKET;
 #else
   int socket_fd_ = -1;
 #endif  // defined(WIN32) || defined(_WIN32)
+  // SendData() backlog, unsent bytes are [send_backlog_offset_, end).
+  std::mutex send_mutex_;
+  std::vector<char> send_backlog_;
+  size_t send_backlog_offset_ = 0;
+  int send_backlog_limit_ = 64 * 1024;
+  std::atomic<int> send_backlog_bytes_ = {0};
+  bool writable_wanted_ = false;  // A send was refused, with send_mutex_.
+  WritableCallback writable_callback_;
+  PushOptions push_options_;
+  std::unique_ptr<MpmcRing<PushItem>> push_queue_;
+#if defined(__linux__)
+  int wake_fd_ = -1;  // eventfd, wakes the I/O thread.
+#endif  // defined(__linux__)
+  // Set while the I/O thread or a blocked producer sleeps.
+  std::atomic_bool io_waiting_ = {false};
+  std::atomic_bool producer_waiting_ = {false};
+  std::mutex push_mutex_;
+  std::condition_variable push_cv_;
+  std::atomic<uint64_t> push_queued_bytes_ = {0};
+  std::atomic<uint64_t> push_peak_bytes_ = {0};
+  std::atomic<uint64_t> push_count_ = {0};
+  std::atomic<uint64_t> push_dropped_ = {0};
+  std::atomic<uint64_t> push_dropped_bytes_ = {0};
+  std::atomic<uint64_t> push_sent_bytes_ = {0};
+  std::atomic<uint64_t> push_flushes_ = {0};
+  std::atomic<uint64_t> push_flushed_ = {0};  // Items written.
+  std::atomic<int64_t> push_latency_total_ns_ = {0};
+  std::atomic<int64_t> push_latency_max_ns_ = {0};
+  std::atomic<int64_t> push_blocked_ns_ = {0};
   Thread thread_;
-  std::list<std::vector<char>> data_list_;
 };
 
 }  // namespace libntrip
@@ -23,7 +23,10 @@
 #ifndef NTRIPLIB_NTRIP_UTIL_H_
 #define NTRIPLIB_NTRIP_UTIL_H_
 
+#include <stdint.h>
+
 #include <string>
+#include <vector>
 
 
 namespace libntrip {
@@ -33,12 +36,56 @@ int Base64Encode(std::string const& raw, std::string* out);
 int Base64Decode(std::string const& raw, std::string* out);
 int GGAFrameGenerate(double latitude, double longitude,
     double altitude, std::string* gga_out);
+// Split `src` by `div_str`, empty items are skipped.
+int StringSplit(std::string const& src, std::string const& div_str,
+    std::vector<std::string>* out, bool append_div_str = false);
 
 // New functions for auto-selection feature
 double CalculateDistance(double lat1, double lon1, double lat2, double lon2);
 int ParsePositionFromGGA(std::string const& gga_string, double* latitude, double* longitude);
 int ParsePositionFromHeader(std::string const& header_value, double* latitude, double* longitude);
 
+// Return the offset of the stream data in a successful caster reply,
+// npos while its header is incomplete.
+size_t ReplyBodyOffset(std::string const& reply);
+// Value of HTTP header `name` (with its ':'), empty if it is missing.
+std::string HeaderValue(std::string const& header, char const* name);
+
+// Strip HTTP chunked transfer framing from a byte stream, in place.
+// Chunk headers may be split anywhere between two calls.
+class HttpChunkDecoder {
+ public:
+  HttpChunkDecoder() = default;
+
+  // Decode `size` bytes at `data`, the payload is moved to the front of
+  // `data`. Return the payload size, -1 if the framing is malformed.
+  // Bytes after the last chunk are ignored.
+  int Decode(char* data, int size);
+  void Reset(void) { *this = HttpChunkDecoder(); }
+  // The last (zero size) chunk and its trailer were seen.
+  bool finished(void) const { return state_ == kDone; }
+
+ private:
+  enum State {
+    kSize,
+    kExtension,
+    kSizeLf,
+    kData,
+    kDataCr,
+    kDataLf,
+    kTrailer,
+    kDone,
+    kError,
+  };
+  // Consume one framing byte, -1 if it is not allowed here.
+  int Step(char c);
+
+  State state_ = kSize;
+  uint64_t remaining_ = 0;  // Chunk size, then payload bytes still to come.
+  int digits_ = 0;
+  int line_length_ = 0;  // Length of the current trailer line.
+};
+
 }  // namespace libntrip
 
 #endif  // NTRIPLIB_NTRIP_UTIL_H_
@@ -0,0 +1,125 @@
+// MIT License
+//
+// Copyright (c) 2021 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef NTRIPLIB_RTCM3_FRAME_H_
+#define NTRIPLIB_RTCM3_FRAME_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+
+namespace libntrip {
+
+// RTCM3 transport frame: preamble(8) + reserved(6) + length(10) +
+// payload(0~1023 bytes) + CRC24Q(24).
+constexpr uint8_t kRtcm3Preamble = 0xD3;
+constexpr int kRtcm3HeaderLength = 3;
+constexpr int kRtcm3CrcLength = 3;
+constexpr int kRtcm3MaxFrameLength = kRtcm3HeaderLength + 1023 + kRtcm3CrcLength;
+
+uint32_t Crc24Q(uint8_t const* data, int size);
+// Return the frame length if a CRC-checked frame starts at `data`,
+// 0 if more data is needed, -1 if `data` is not the start of a frame.
+int Rtcm3FrameCheck(char const* data, int size);
+// Return the message type of a complete frame.
+int Rtcm3MessageType(char const* frame);
+
+// Split a byte stream into complete RTCM3 frames.
+// Frames lying entirely in the fed buffer are delivered in place. A frame
+// split across calls is kept aside and completed with only the bytes it
+// lacks, so at most one frame is copied per call.
+class Rtcm3Framer {
+ public:
+  Rtcm3Framer() = default;
+
+  // handler(char const* frame, int size) is called for every complete frame.
+  template <typename Handler>
+  void Feed(char const* data, int size, Handler&& handler) {
+    while (!pending_.empty()) {
+      int need = PendingNeed();
+      int take = (need < size) ? need : size;
+      pending_.insert(pending_.end(), data, data+take);
+      data += take;
+      size -= take;
+      if (take < need) return;
+      int ret = Rtcm3FrameCheck(pending_.data(),
+          static_cast<int>(pending_.size()));
+      if (ret > 0) {
+        handler(pending_.data(), ret);
+        ++frame_count_;
+        pending_.erase(pending_.begin(), pending_.begin()+ret);
+      } else if (ret < 0) {
+        // Resynchronize on the next preamble kept aside.
+        auto next = std::find(pending_.begin()+1, pending_.end(),
+            static_cast<char>(kRtcm3Preamble));
+        discarded_bytes_ += next-pending_.begin();
+        pending_.erase(pending_.begin(), next);
+      }
+    }
+    int used = Scan(data, size, handler);
+    if (used < size) pending_.assign(data+used, data+size);
+  }
+  // Deliver the complete frames of `data` without keeping the rest,
+  // return the number of bytes consumed. For callers that own the
+  // receive buffer and keep the partial frame in place themselves.
+  template <typename Handler>
+  int Scan(char const* data, int size, Handler&& handler) {
+    int pos = 0;
+    while (pos < size) {
+      int ret = Rtcm3FrameCheck(data+pos, size-pos);
+      if (ret > 0) {
+        handler(data+pos, ret);
+        ++frame_count_;
+        pos += ret;
+      } else if (ret == 0) {
+        break;
+      } else {
+        // Resynchronize on the next preamble.
+        void const* next = memchr(data+pos+1, kRtcm3Preamble, size-pos-1);
+        int skip = (next == nullptr) ? size-pos :
+            static_cast<int>(static_cast<char const*>(next)-(data+pos));
+        discarded_bytes_ += skip;
+        pos += skip;
+      }
+    }
+    return pos;
+  }
+  void Reset(void) { pending_.clear(); }
+  bool has_partial_frame(void) const { return !pending_.empty(); }
+  uint64_t frame_count(void) const { return frame_count_; }
+  uint64_t discarded_bytes(void) const { return discarded_bytes_; }
+
+ private:
+  // Bytes the partial frame lacks before it can be checked.
+  int PendingNeed(void) const;
+
+  std::vector<char> pending_;
+  uint64_t frame_count_ = 0;
+  uint64_t discarded_bytes_ = 0;
+};
+
+}  // namespace libntrip
+
+#endif  // NTRIPLIB_RTCM3_FRAME_H_
@@ -0,0 +1,257 @@
+// MIT License
+//
+// Copyright (c) 2021 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef NTRIPLIB_SOURCE_TABLE_H_
+#define NTRIPLIB_SOURCE_TABLE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+namespace libntrip {
+
+// STR record of an NTRIP 2.0 sourcetable, field positions as in the
+// record: STR;mountpoint;identifier;format;format-details;carrier;
+// nav-system;network;country;latitude;longitude;nmea;solution;generator;
+// compr-encryp;authentication;fee;bitrate;misc.
+enum StreamRecordField {
+  kStrMountpoint = 1,
+  kStrIdentifier = 2,
+  kStrFormat = 3,
+  kStrFormatDetails = 4,
+  kStrCarrier = 5,
+  kStrNavSystem = 6,
+  kStrNetwork = 7,
+  kStrCountry = 8,
+  kStrLatitude = 9,
+  kStrLongitude = 10,
+  kStrNmea = 11,
+  kStrSolution = 12,
+  kStrGenerator = 13,
+  kStrCompression = 14,
+  kStrAuthentication = 15,
+  kStrFee = 16,
+  kStrBitrate = 17,
+  kStrMisc = 18,
+  kStrFieldCount = 19,
+};
+
+struct StreamRecord {
+  std::vector<std::string> fields;  // fields[0] is "STR".
+  std::string mountpoint;
+  std::string format;
+  std::vector<std::string> nav_systems;  // "GPS+GLO" is {"GPS", "GLO"}.
+  std::string country;
+  double latitude = 0.0;
+  double longitude = 0.0;
+  bool has_position = false;
+};
+
+// Split a sourcetable line at ';', empty fields are kept.
+void SplitSourceTableLine(std::string const& line,
+    std::vector<std::string>* fields);
+// Return 0 if `line` is an STR record with at least the position fields.
+int ParseStreamRecord(std::string const& line, StreamRecord* record);
+
+// STR records of the registered mountpoints.
+// Records are parsed once when they are set, format, navigation system,
+// country and position are indexed so filter queries only look at
+// candidate records.
+class SourceTable {
+ public:
+  SourceTable() = default;
+
+  // Add or replace the record of a mountpoint, `line` is the STR line as
+  // the source sent it. Lines that do not parse are still listed in the
+  // full table but never match a filter.
+  void Set(std::string const& mountpoint, std::string const& line);
+  void Remove(std::string const& mountpoint);
+  void Clear(void);
+  size_t size(void) const { return by_mountpoint_.size(); }
+  // Changes with every Set(), Remove() and Clear(), and across restarts.
+  uint64_t version(void) const { return version_; }
+  // Every STR line, each ending with "\r\n".
+  std::string Render(void) const;
+  // STR lines matching an NTRIP 2.0 filter such as
+  // "STR;;;RTCM 3.2;;;GPS;;DEU;>47&<55". Empty fields match anything,
+  // a field may hold '*' wildcards, '!' negation, '<' '>' '<=' '>='
+  // comparisons, and terms joined by '&' (all) or '|' (any). A navigation
+  // system filter matches a record that supports that system.
+  // Return -1 if the filter is not an STR filter.
+  int Query(std::string const& filter, std::string* out) const;
+  // Filter in a canonical form, percent decoded and without trailing empty
+  // fields, so equivalent query strings compare equal. Empty if `filter` is
+  // not an STR filter.
+  static std::string NormalizeQuery(std::string const& filter);
+
+ private:
+  struct Entry {
+    bool live = false;
+    bool parsed = false;
+    std::string line;
+    StreamRecord record;
+  };
+  using PostingList = std::vector<int>;
+
+  void Index(int id);
+  void Unindex(int id);
+  static int PositionCell(double latitude, double longitude);
+
+  std::vector<Entry> entries_;
+  std::vector<int> free_ids_;
+  std::unordered_map<std::string, int> by_mountpoint_;
+  // Keys are upper case.
+  std::unordered_map<std::string, PostingList> by_format_;
+  std::unordered_map<std::string, PostingList> by_nav_system_;
+  std::unordered_map<std::string, PostingList> by_country_;
+  // 1 x 1 degree cells.
+  std::map<int, PostingList> by_position_;
+  uint64_t version_ = InitialVersion();
+
+  static uint64_t InitialVersion(void);
+};
+
+// CAS record: CAS;host;port;identifier;operator;nmea;country;latitude;
+// longitude;fallback-host;fallback-port;misc.
+struct CasterRecord {
+  std::string host;
+  int port = 0;
+  std::string identifier;
+  std::string operator_name;
+  bool nmea = false;
+  std::string country;
+  double latitude = 0.0;
+  double longitude = 0.0;
+  std::string fallback_host;
+  int fallback_port = 0;
+};
+
+// NET record: NET;identifier;operator;authentication;fee;web-net;
+// web-str;web-reg;misc.
+struct NetworkRecord {
+  std::string identifier;
+  std::string operator_name;
+  char authentication = 'N';
+  bool fee = false;
+  std::string web_net;
+  std::string web_str;
+  std::string web_reg;
+};
+
+// STR record of a downloaded sourcetable. The text fields stay in the
+// table, SourceTableSnapshot::Field() returns them.
+struct StationRecord {
+  double latitude = 0.0;
+  double longitude = 0.0;
+  bool has_position = false;
+  bool nmea = false;  // The caster wants GGA from the rover.
+  bool network = false;  // Network (e.g. VRS) solution, not a single base.
+  bool fee = false;
+  char authentication = 'N';  // 'N' none, 'B' basic, 'D' digest.
+  int carrier = 0;  // 0 none, 1 L1, 2 L1+L2.
+  int bitrate = 0;
+
+ private:
+  friend class SourceTableSnapshot;
+  uint32_t line = 0;  // Offset of the line in the table text.
+  uint16_t field[kStrFieldCount+1] = {};  // Field i is [field[i], field[i+1]-1).
+};
+
+// Which stations are suitable for the rover.
+struct StationFilter {
+  std::string format;  // Prefix of the format, e.g. "RTCM 3", any if empty.
+  std::vector<std::string> nav_systems;  // Each must be listed.
+  int min_carrier = 0;
+  bool allow_network = true;
+  bool allow_fee = true;
+  double max_distance_km = 0.0;  // 0 is unlimited.
+};
+
+// Sourcetable as a client downloads it. Lines are parsed as they arrive,
+// STR records keep their text in one buffer and only the typed fields
+// and field offsets besides, so large tables stay small in memory.
+class SourceTableSnapshot {
+ public:
+  SourceTableSnapshot() = default;
+
+  // Parse the next piece of the table, lines may span calls.
+  void Feed(char const* data, size_t size);
+  // Parse a last line that had no line end.
+  void Finish(void);
+  void Clear(void);
+  // ENDSOURCETABLE was seen.
+  bool complete(void) const { return complete_; }
+
+  std::vector<StationRecord> const& stations(void) const { return stations_; }
+  std::vector<CasterRecord> const& casters(void) const { return casters_; }
+  std::vector<NetworkRecord> const& networks(void) const { return networks_; }
+  std::string Field(StationRecord const& station,
+      StreamRecordField field) const;
+  std::string Mountpoint(StationRecord const& station) const {
+    return Field(station, kStrMountpoint);
+  }
+  bool Matches(StationRecord const& station,
+      StationFilter const& filter) const;
+  // Return the index of the suitable station nearest to the position,
+  // -1 if there is none. `distance_m` receives its distance in meters.
+  int Nearest(double latitude, double longitude, StationFilter const& filter,
+      double* distance_m = nullptr) const;
+
+  // HTTP validators of the download, for conditional requests.
+  std::string const& etag(void) const { return etag_; }
+  std::string const& last_modified(void) const { return last_modified_; }
+  void set_validators(std::string const& etag,
+      std::string const& last_modified) {
+    etag_ = etag;
+    last_modified_ = last_modified;
+  }
+  // Disk cache with the validators, replaced atomically. 0 if success.
+  int Save(std::string const& path) const;
+  int Load(std::string const& path);
+
+ private:
+  void ParseLine(char const* line, size_t size);
+  void ParseStation(size_t offset);
+  static int StationCell(int row, int column);
+  char const* FieldData(StationRecord const& station, int field,
+      size_t* size) const;
+
+  std::string text_;  // Kept CAS, NET and STR lines, each ending "\r\n".
+  std::string partial_;  // Line cut by the end of the last Feed().
+  std::vector<StationRecord> stations_;
+  std::vector<CasterRecord> casters_;
+  std::vector<NetworkRecord> networks_;
+  // Stations with a position by 1 x 1 degree cell.
+  std::unordered_map<int, std::vector<uint32_t>> cells_;
+  std::string etag_;
+  std::string last_modified_;
+  bool complete_ = false;
+};
+
+}  // namespace libntrip
+
+#endif  // NTRIPLIB_SOURCE_TABLE_H_
@@ -0,0 +1,181 @@
+// MIT License
+//
+// Copyright (c) 2021 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef NTRIPLIB_STREAM_RECORDER_H_
+#define NTRIPLIB_STREAM_RECORDER_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>  // NOLINT.
+#include <memory>
+#include <mutex>  // NOLINT.
+#include <string>
+#include <vector>
+
+#include "thread_raii.h"
+
+
+namespace libntrip {
+
+// Recording file layout, all integers little-endian.
+// Segment file "<mountpoint>_<YYYYmmddTHHMMSS>_<n>.rec":
+//   RecordFileHeader, then records of RecordHeader + one RTCM3 frame.
+// Index file "<same name>.idx": IndexEntry for the first record of every
+//   index interval, so a reader can seek by arrival time.
+constexpr char kRecordFileMagic[8] = {'N', 'T', 'R', 'P', 'R', 'E', 'C', '1'};
+
+struct RecordFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  int64_t start_ns;  // Unix time of the first record.
+  char mountpoint[64];
+  uint8_t reserved[8];
+};
+
+struct RecordHeader {
+  int64_t arrival_ns;  // Unix time the frame reached the caster.
+  uint32_t size;
+  uint16_t message_type;
+  uint16_t reserved;
+};
+
+struct IndexEntry {
+  int64_t arrival_ns;
+  uint64_t offset;  // Offset of the record in the segment file.
+  uint64_t record_index;
+};
+
+struct RecorderOptions {
+  std::string directory = ".";
+  // Mountpoints to record, empty records all of them.
+  std::vector<std::string> mountpoints;
+  int64_t segment_bytes = 64*1024*1024;
+  int segment_seconds = 3600;
+  int index_interval_ms = 1000;
+  // Frames are dropped instead of queued beyond this.
+  int64_t max_pending_bytes = 32*1024*1024;
+  int flush_interval_ms = 100;
+};
+
+struct RecorderStatistics {
+  uint64_t frames = 0;
+  uint64_t bytes = 0;
+  uint64_t dropped_frames = 0;
+  uint64_t segments = 0;
+  uint64_t write_errors = 0;
+};
+
+// Append-only recording of mountpoint streams.
+// Append() only copies into memory, a background thread writes segments
+// and their index, so the caller never waits on the disk.
+class StreamRecorder {
+ public:
+  StreamRecorder() = default;
+  StreamRecorder(StreamRecorder const&) = delete;
+  StreamRecorder& operator=(StreamRecorder const&) = delete;
+  ~StreamRecorder() { Stop(); }
+
+  void set_options(RecorderOptions const& options) { options_ = options; }
+  RecorderOptions const& options(void) const { return options_; }
+  bool Start(void);
+  // Write out what is pending and close all files.
+  void Stop(void);
+  bool is_running(void) const { return running_.load(); }
+  // Return the stream id of a mountpoint, -1 if it is not recorded or
+  // its name is unsafe as a file name (path separators, "..", control
+  // characters). The same mountpoint always gets the same id.
+  int OpenStream(std::string const& mountpoint);
+  // Queue one complete frame, return -1 if it was dropped.
+  int Append(int stream_id, char const* frame, int size);
+  RecorderStatistics statistics(void) const;
+
+ private:
+  struct Stream {
+    std::string mountpoint;
+    std::vector<char> pending;  // Records not written yet.
+    std::vector<char> writing;  // Swapped with pending by the writer.
+    int fd = -1;
+    int index_fd = -1;
+    int segment_number = 0;
+    int64_t segment_start_ns = 0;
+    uint64_t segment_offset = 0;
+    uint64_t record_index = 0;
+    int64_t last_index_ns = 0;
+  };
+
+  void WriterHandler(void);
+  void WriteRecords(Stream* stream);
+  int OpenSegment(Stream* stream, int64_t start_ns);
+  void CloseSegment(Stream* stream);
+  int WriteAll(int fd, char const* data, size_t size);
+
+  RecorderOptions options_;
+  std::atomic_bool running_ = {false};
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  std::vector<std::unique_ptr<Stream>> streams_;
+  int64_t pending_bytes_ = 0;
+  Thread thread_;
+  std::atomic<uint64_t> frames_{0};
+  std::atomic<uint64_t> bytes_{0};
+  std::atomic<uint64_t> dropped_frames_{0};
+  std::atomic<uint64_t> segments_{0};
+  std::atomic<uint64_t> write_errors_{0};
+};
+
+// Read-only view of one segment file, mapped into memory.
+class RecordReader {
+ public:
+  struct Record {
+    int64_t arrival_ns;
+    int message_type;
+    char const* data;
+    int size;
+  };
+
+  RecordReader() = default;
+  RecordReader(RecordReader const&) = delete;
+  RecordReader& operator=(RecordReader const&) = delete;
+  ~RecordReader() { Close(); }
+
+  int Open(std::string const& path);
+  void Close(void);
+  // Return false at the end of the segment or at a truncated record.
+  bool Next(Record* record);
+  void Rewind(void);
+  // Continue from the first indexed record at or before `arrival_ns`.
+  void Seek(int64_t arrival_ns);
+  std::string mountpoint(void) const;
+  int64_t start_ns(void) const;
+
+ private:
+  char const* data_ = nullptr;
+  size_t size_ = 0;
+  size_t offset_ = 0;
+  std::vector<IndexEntry> index_;
+};
+
+}  // namespace libntrip
+
+#endif  // NTRIPLIB_STREAM_RECORDER_H_
@@ -30,11 +30,88 @@
 #ifndef NTRIPLIB_THREAD_RAII_H_
 #define NTRIPLIB_THREAD_RAII_H_
 
+#if defined(__linux__)
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif  // defined(__linux__)
+
+#include <functional>
+#include <string>
 #include <thread>
+#include <vector>
 
 
 namespace libntrip {
 
+// Scheduling of a Thread, applied by the thread itself before it runs.
+// Only supported on Linux, ignored elsewhere.
+struct ThreadOptions {
+  enum class Policy {
+    kDefault,     // SCHED_OTHER, adjusted by `nice`.
+    kFifo,        // SCHED_FIFO at `priority`.
+    kRoundRobin,  // SCHED_RR at `priority`.
+  };
+  std::string name;       // Up to 15 characters are kept.
+  std::vector<int> cpus;  // CPU affinity, empty keeps the inherited set.
+  Policy policy = Policy::kDefault;
+  int priority = 0;  // Real-time priority 1~99.
+  int nice = 0;      // -20~19, 0 keeps the inherited value.
+};
+
+// Apply `options` to the calling thread, return -1 if any part failed.
+// Real-time policies and negative nice values need CAP_SYS_NICE.
+inline
+int ApplyThreadOptions(ThreadOptions const& options) {
+  int ret = 0;
+#if defined(__linux__)
+  if (!options.name.empty()) {
+    pthread_setname_np(pthread_self(), options.name.substr(0, 15).c_str());
+  }
+  if (!options.cpus.empty()) {
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for (int cpu : options.cpus) {
+      if (cpu >= 0 && cpu < CPU_SETSIZE) CPU_SET(cpu, &cpu_set);
+    }
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set),
+        &cpu_set);
+    if (err != 0) {
+      printf("Thread %s set affinity failed: %s\n",
+          options.name.c_str(), strerror(err));
+      ret = -1;
+    }
+  }
+  if (options.policy != ThreadOptions::Policy::kDefault) {
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = options.priority;
+    int err = pthread_setschedparam(pthread_self(),
+        options.policy == ThreadOptions::Policy::kFifo ? SCHED_FIFO : SCHED_RR,
+        &param);
+    if (err != 0) {
+      printf("Thread %s set real-time priority failed: %s\n",
+          options.name.c_str(), strerror(err));
+      ret = -1;
+    }
+  } else if (options.nice != 0) {
+    // Nice value is per thread on Linux.
+    if (setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)),
+        options.nice) != 0) {
+      printf("Thread %s set nice failed: %s\n",
+          options.name.c_str(), strerror(errno));
+      ret = -1;
+    }
+  }
+#endif  // defined(__linux__)
+  return ret;
+}
+
 class Thread {
  public:
   Thread() = default;
@@ -48,11 +125,24 @@ class Thread {
       std::forward<Callable>(callable), std::forward<Args>(args)...)) {}
   ~Thread() { join(); }
 
+  // Used by the next reset() with a callable.
+  void set_options(ThreadOptions const& options) { options_ = options; }
+  ThreadOptions const& options(void) const { return options_; }
+  // Name used when the options do not give one.
+  void set_default_name(std::string const& name) {
+    if (options_.name.empty()) options_.name = name;
+  }
+
   template<typename Callable, typename... Args>
   Thread& reset(Callable&& callable, Args&&... args) {
     join();
-    thread_ = std::move(std::thread(
-        std::forward<Callable>(callable), std::forward<Args>(args)...));
+    auto handler = std::bind(
+        std::forward<Callable>(callable), std::forward<Args>(args)...);
+    ThreadOptions options = options_;
+    thread_ = std::move(std::thread([options, handler] () mutable {
+      ApplyThreadOptions(options);
+      handler();
+    }));
     return *this;
   }
   Thread& reset(std::thread&& t) {
@@ -60,6 +150,7 @@ class Thread {
     thread_ = std::move(t);
     return *this;
   }
+  bool joinable(void) const { return thread_.joinable(); }
   void join(void) {
     if (thread_.joinable()) thread_.join();
   }
@@ -69,6 +160,7 @@ class Thread {
 
  private:
   std::thread thread_;
+  ThreadOptions options_;
 };
 
 }  // namespace libntrip
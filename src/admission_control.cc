@@ -0,0 +1,86 @@
+// MIT License
+//
+// Copyright (c) 2021 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "ntrip/admission_control.h"
+
+
+namespace libntrip {
+
+bool AdmissionControl::AdmitConnection(uint32_t ip, int handshake_count,
+    int64_t now_ms) {
+  if ((options_.max_handshakes > 0) &&
+      (handshake_count >= options_.max_handshakes)) {
+    ++shed_handshake_limit_;
+    return false;
+  }
+  if ((options_.ip_rate > 0.0) && (options_.ip_burst > 0) &&
+      !ip_buckets_[ip].Consume(options_.ip_rate, options_.ip_burst, now_ms)) {
+    ++shed_ip_rate_;
+    return false;
+  }
+  ++accepted_;
+  return true;
+}
+
+bool AdmissionControl::AdmitCredential(std::string const& credential,
+    int64_t now_ms) {
+  if ((options_.credential_rate <= 0.0) || (options_.credential_burst <= 0)) {
+    return true;
+  }
+  if (!credential_buckets_[credential].Consume(options_.credential_rate,
+      options_.credential_burst, now_ms)) {
+    ++shed_credential_rate_;
+    return false;
+  }
+  return true;
+}
+
+void AdmissionControl::Prune(int64_t now_ms) {
+  for (auto it = ip_buckets_.begin(); it != ip_buckets_.end(); ) {
+    if (it->second.IsFull(options_.ip_rate, options_.ip_burst, now_ms)) {
+      it = ip_buckets_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  for (auto it = credential_buckets_.begin();
+       it != credential_buckets_.end(); ) {
+    if (it->second.IsFull(options_.credential_rate,
+        options_.credential_burst, now_ms)) {
+      it = credential_buckets_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+AdmissionStatistics AdmissionControl::statistics(void) const {
+  AdmissionStatistics stat;
+  stat.accepted = accepted_.load();
+  stat.shed_ip_rate = shed_ip_rate_.load();
+  stat.shed_credential_rate = shed_credential_rate_.load();
+  stat.shed_handshake_limit = shed_handshake_limit_.load();
+  stat.handshake_timeout = handshake_timeout_.load();
+  return stat;
+}
+
+}  // namespace libntrip
@@ -0,0 +1,177 @@
+// MIT License
+//
+// Copyright (c) 2021 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "ntrip/memory_pool.h"
+
+#include <stdlib.h>
+#if defined(WIN32) || defined(_WIN32)
+#include <malloc.h>
+#endif  // defined(WIN32) || defined(_WIN32)
+
+#include <algorithm>
+#include <mutex>  // NOLINT.
+#include <new>
+#include <vector>
+
+
+namespace libntrip {
+
+namespace {
+
+constexpr int kMaxBufferPools = 8;
+constexpr size_t kThreadCacheSize = 32;  // Per pool and thread.
+constexpr size_t kRefillCount = 16;
+constexpr int kBuffersPerChunk = 16;
+
+std::mutex g_pools_mutex;
+// Pools are never destroyed, thread caches may flush into them at any time.
+BufferPool* g_pools[kMaxBufferPools] = {};
+int g_pool_count = 0;
+
+// Chunks are never freed, so no matching release is needed.
+void* AllocateAligned(size_t size, size_t alignment) {
+  void* ptr = nullptr;
+#if defined(WIN32) || defined(_WIN32)
+  ptr = _aligned_malloc(size, alignment);
+#else
+  if (posix_memalign(&ptr, alignment, size) != 0) ptr = nullptr;
+#endif  // defined(WIN32) || defined(_WIN32)
+  if (ptr == nullptr) throw std::bad_alloc();
+  return ptr;
+}
+
+}  // namespace
+
+struct BufferPool::ThreadCache {
+  std::vector<PooledBuffer::Block*> blocks[kMaxBufferPools];
+  ~ThreadCache() {
+    for (int i = 0; i < kMaxBufferPools; ++i) {
+      if (!blocks[i].empty()) g_pools[i]->Drain(&blocks[i], 0);
+    }
+  }
+};
+
+BufferPool* BufferPool::Instance(int buffer_size) {
+  std::lock_guard<std::mutex> lock(g_pools_mutex);
+  for (int i = 0; i < g_pool_count; ++i) {
+    if (g_pools[i]->buffer_size() == buffer_size) return g_pools[i];
+  }
+  // Sizes beyond the cache slots still work, through the shared list only.
+  static std::vector<BufferPool*> uncached_pools;
+  for (auto pool : uncached_pools) {
+    if (pool->buffer_size() == buffer_size) return pool;
+  }
+  if (g_pool_count < kMaxBufferPools) {
+    g_pools[g_pool_count] = new BufferPool(buffer_size, g_pool_count);
+    return g_pools[g_pool_count++];
+  }
+  uncached_pools.push_back(new BufferPool(buffer_size, -1));
+  return uncached_pools.back();
+}
+
+BufferPool::BufferPool(int buffer_size, int index)
+    : buffer_size_(buffer_size), index_(index) {
+}
+
+PooledBuffer BufferPool::Allocate(void) {
+  PooledBuffer::Block* block;
+  if (index_ >= 0) {
+    auto& cache = LocalCache().blocks[index_];
+    if (cache.empty()) Refill(&cache);
+    block = cache.back();
+    cache.pop_back();
+  } else {
+    std::vector<PooledBuffer::Block*> batch;
+    Refill(&batch);
+    block = batch.back();
+    batch.pop_back();
+    Drain(&batch, 0);
+  }
+  block->refs.store(1, std::memory_order_relaxed);
+  block->size = 0;
+  ++allocations_;
+  uint64_t in_use = ++in_use_;
+  uint64_t peak = peak_in_use_.load();
+  while ((in_use > peak) && !peak_in_use_.compare_exchange_weak(peak, in_use)) {
+  }
+  return PooledBuffer(block);
+}
+
+MemoryPoolStatistics BufferPool::statistics(void) const {
+  MemoryPoolStatistics stat;
+  stat.object_size = buffer_size_;
+  stat.capacity = capacity_.load();
+  stat.in_use = in_use_.load();
+  stat.peak_in_use = peak_in_use_.load();
+  stat.allocations = allocations_.load();
+  return stat;
+}
+
+void BufferPool::Deallocate(PooledBuffer::Block* block) {
+  --in_use_;
+  if (index_ >= 0) {
+    auto& cache = LocalCache().blocks[index_];
+    cache.push_back(block);
+    if (cache.size() > kThreadCacheSize) Drain(&cache, kThreadCacheSize/2);
+  } else {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_list_.push_back(block);
+  }
+}
+
+void BufferPool::Refill(std::vector<PooledBuffer::Block*>* cache) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (free_list_.size() < kRefillCount) {
+    // Carve a chunk of buffers out of one allocation, it is never freed.
+    // The chunk and the stride are multiples of the header size, so every
+    // payload starts on a cache line.
+    size_t stride = PooledBuffer::kHeaderSize +
+        (buffer_size_ + PooledBuffer::kHeaderSize-1) /
+        PooledBuffer::kHeaderSize * PooledBuffer::kHeaderSize;
+    char* chunk = static_cast<char*>(AllocateAligned(
+        stride*kBuffersPerChunk, PooledBuffer::kHeaderSize));
+    for (int i = 0; i < kBuffersPerChunk; ++i) {
+      auto* block = new (chunk+i*stride) PooledBuffer::Block;
+      block->pool = this;
+      free_list_.push_back(block);
+    }
+    capacity_ += kBuffersPerChunk;
+  }
+  size_t count = std::min(kRefillCount, free_list_.size());
+  cache->insert(cache->end(), free_list_.end()-count, free_list_.end());
+  free_list_.resize(free_list_.size()-count);
+}
+
+void BufferPool::Drain(std::vector<PooledBuffer::Block*>* cache,
+    size_t keep) {
+  if (cache->size() <= keep) return;
+  std::lock_guard<std::mutex> lock(mutex_);
+  free_list_.insert(free_list_.end(), cache->begin()+keep, cache->end());
+  cache->resize(keep);
+}
+
+BufferPool::ThreadCache& BufferPool::LocalCache(void) {
+  static thread_local ThreadCache cache;
+  return cache;
+}
+
+}  // namespace libntrip
@@ -3,6 +3,8 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
 
 #include <netinet/in.h>
 #include <netinet/tcp.h>
@@ -21,6 +23,7 @@
 #include <vector>
 #include <memory>
 #include <limits>
+#include <chrono>  // NOLINT.
 
 #include "ntrip/ntrip_util.h"
 #include "cmake_definition.h.in"
@@ -31,6 +34,47 @@ namespace libntrip {
 namespace {
 
 constexpr int kBufferSize = 65536;
+// Unsent bytes a subscriber may hold before new data is dropped for it.
+constexpr int kMaxBacklogBytes = 4*kBufferSize;
+constexpr int kMaxBacklogEntries = 256;
+// Smaller payloads are copied out of the receive buffer instead of pinning
+// all of it, which bounds the pinned memory to 4 times kMaxBacklogBytes.
+constexpr int kMinSharedPayload = kBufferSize/4;
+constexpr int kCopyBufferSize = 4096;
+constexpr int kMaxFlushIovecs = 64;
+
+// NTRIP 2.0 RTP transport.
+constexpr int kRtpHeaderLength = 12;
+constexpr uint8_t kRtpPayloadTypeGnss = 96;
+constexpr int64_t kRtpSessionTimeoutMs = 60000;
+constexpr int64_t kPeriodicCheckIntervalMs = 1000;
+
+// Redundant mountpoint sources.
+constexpr int64_t kEpochGapMs = 10;  // Frames closer than this share an epoch.
+constexpr int64_t kDefaultEpochIntervalMs = 1000;
+constexpr int64_t kStallMarginMs = 20;
+constexpr int kRecoveryEpochs = 3;  // Before switching back to a primary.
+constexpr int64_t kAdmissionPruneIntervalMs = 60000;
+// Subscribers of a persistent mountpoint wait this long for its base to
+// reconnect.
+constexpr int64_t kSourceReconnectWindowMs = 30000;
+
+// 32-bit FNV-1a.
+inline
+uint32_t HashString(std::string const& str) {
+  uint32_t hash = 2166136261u;
+  for (unsigned char c : str) {
+    hash ^= c;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+inline
+int64_t NowMilliseconds(void) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
 inline
 int EpollRegister(int epoll_fd, int fd) {
@@ -48,6 +92,18 @@ int EpollRegister(int epoll_fd, int fd) {
   return ret;
 }
 
+inline
+int EpollModify(int epoll_fd, int fd, uint32_t events) {
+  struct epoll_event ev;
+  int ret;
+  ev.events = events;
+  ev.data.fd = fd;
+  do {
+    ret = epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+  } while ((ret < 0) && (errno == EINTR));
+  return ret;
+}
+
 inline
 int EpollUnregister(int epoll_fd, int fd) {
   int ret;
@@ -69,46 +125,78 @@ void ClearCilentConnection(int epoll_fd, std::list<int> *list) {
   }
 }
 
+inline
+MountPointSource* FindSource(std::list<MountPointSource>* list, int fd) {
+  for (auto& source : *list) {
+    if (source.fd == fd) return &source;
+  }
+  return nullptr;
+}
+
+// A source is stalled once it misses an epoch by half an interval.
+inline
+bool SourceIsStalled(MountPointSource const& source, int64_t now) {
+  if (source.last_frame_ms == 0) return true;
+  int64_t interval = (source.epoch_interval_ms > 0) ?
+      source.epoch_interval_ms : kDefaultEpochIntervalMs;
+  return now - source.last_frame_ms > interval*3/2 + kStallMarginMs;
+}
+
+// Update the cadence of a source with a new frame, return true if the frame
+// starts a new epoch.
+inline
+bool UpdateSourceCadence(MountPointSource* source, int64_t now) {
+  bool new_epoch = (source->last_frame_ms == 0) ||
+      (now - source->last_frame_ms >= kEpochGapMs);
+  if (new_epoch) {
+    if (source->epoch_start_ms == 0 || SourceIsStalled(*source, now)) {
+      // A stall says nothing about the cadence.
+      source->healthy_epochs = 0;
+    } else {
+      int64_t interval = now - source->epoch_start_ms;
+      source->epoch_interval_ms = (source->epoch_interval_ms == 0) ?
+          interval : (source->epoch_interval_ms*7 + interval)/8;
+      ++source->healthy_epochs;
+    }
+    source->epoch_start_ms = now;
+  }
+  source->last_frame_ms = now;
+  return new_epoch;
+}
+
 inline
 void ClearAllConnection(int epoll_fd, std::list<MountPointInformation> *list) {
   if ((list != nullptr) && (!list->empty())) {
     auto it = list->begin();
     while (it != list->end()) {
       ClearCilentConnection(epoll_fd, &(it->client_socket_list));
-      EpollUnregister(epoll_fd, it->server_fd);
-      close(it->server_fd);
+      for (auto const& source : it->source_list) {
+        EpollUnregister(epoll_fd, source.fd);
+        close(source.fd);
+      }
       it = list->erase(it);
     }
   }
 }
 
 inline
-int StringSplit(std::string const& src, std::string const& div_str,
-    std::vector<std::string>* out, bool append_div_str = false) {
-  if (out == nullptr) return -1;
-  out->clear();
-  std::string::size_type pos_begin = 0;
-  std::string::size_type div_pos_begin = src.find(div_str);
-  std::size_t src_len = src.size();
-  std::size_t div_str_len = div_str.size();
-  std::size_t len;
-  std::string item;
-  while (div_pos_begin != std::string::npos) {
-    len = div_pos_begin-pos_begin;
-    if (len > 0) {
-      item = src.substr(pos_begin, len);
-      if (append_div_str) item += div_str;
-      out->push_back(item);
-    }
-    pos_begin = div_pos_begin + div_str_len;
-    div_pos_begin = src.find(div_str, pos_begin);
-  }
-  if (pos_begin+div_str_len <= src_len) {
-    item = src.substr(pos_begin, src_len-pos_begin);
-      if (append_div_str) item += div_str;
-      out->push_back(item);
-  }
-  return 0;
+std::string RtspHeaderValue(std::string const& line) {
+  auto pos = line.find(':');
+  if (pos == std::string::npos) return "";
+  auto beg = line.find_first_not_of(' ', pos+1);
+  auto end = line.find_first_of("\r\n", beg);
+  if (beg == std::string::npos) return "";
+  return line.substr(beg, end == std::string::npos ? end : end-beg);
+}
+
+// Raw Basic token of a request, the rate limiter does not need to decode it.
+inline
+std::string BasicCredential(std::string const& request) {
+  constexpr char kAuthorization[] = "Authorization: Basic ";
+  auto pos = request.find(kAuthorization);
+  if (pos == std::string::npos) return "";
+  pos += sizeof(kAuthorization)-1;
+  return request.substr(pos, request.find('\r', pos)-pos);
 }
 
 }  // namespace
@@ -150,6 +238,15 @@ bool NtripCaster::Run(void) {
     std::cout << "[ERROR] Listen failed: " << strerror(errno) << std::endl;
     exit(1);
   }
+  // NTRIP 2.0 RTP data goes out on a UDP socket bound to the same port.
+  udp_sock_ = socket(AF_INET, SOCK_DGRAM, 0);
+  if ((udp_sock_ == -1) ||
+      (bind(udp_sock_, reinterpret_cast<struct sockaddr*>(&server_addr),
+          sizeof(struct sockaddr)) == -1)) {
+    printf("RTP/UDP transport disabled: %s\n", strerror(errno));
+    if (udp_sock_ != -1) close(udp_sock_);
+    udp_sock_ = -1;
+  }
   std::cout << "[DEBUG] Creating epoll events array..." << std::endl;
   epoll_events_ = new struct epoll_event[max_count_];
   if (epoll_events_ == nullptr) {
@@ -164,30 +261,199 @@ bool NtripCaster::Run(void) {
   }
   std::cout << "[DEBUG] Registering listen socket with epoll..." << std::endl;
   EpollRegister(epoll_fd_, listen_sock_);
+  if (udp_sock_ != -1) EpollRegister(epoll_fd_, udp_sock_);
+  event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (event_fd_ == -1) {
+    std::cout << "[ERROR] Eventfd creation failed: " << strerror(errno) << std::endl;
+    // Nothing runs yet, undo the setup above.
+    if (udp_sock_ != -1) close(udp_sock_);
+    udp_sock_ = -1;
+    close(listen_sock_);
+    listen_sock_ = -1;
+    close(epoll_fd_);
+    epoll_fd_ = -1;
+    delete [] epoll_events_;
+    epoll_events_ = nullptr;
+    return false;
+  }
+  EpollRegister(epoll_fd_, event_fd_);
+  loop_exit_ = false;
+  {
+    // Commands queued before Run().
+    std::lock_guard<std::mutex> lock(command_mutex_);
+    uint64_t one = 1;
+    if (!commands_.empty() &&
+        write(event_fd_, &one, sizeof(one)) != sizeof(one)) ;
+  }
+  if (recording_ && !recorder_.Start()) {
+    printf("Stream recording disabled\n");
+  }
   std::cout << "[DEBUG] Setting service as running..." << std::endl;
   service_is_running_.store(true);
   std::cout << "[DEBUG] Starting thread..." << std::endl;
+  thread_.set_default_name("ntrip_caster");
   thread_.reset(&NtripCaster::ThreadHandler, this);
   std::cout << "[DEBUG] Run method completed successfully" << std::endl;
   return true;
 }
 
 void NtripCaster::Stop(void) {
+  // The loop thread leaves on its own, nothing is torn down under it.
+  if (thread_.joinable()) {
+    PostCommand([this] () { loop_exit_ = true; });
+    thread_.join();
+  }
   service_is_running_.store(false);
   ClearAllConnection(epoll_fd_, &mount_point_infos_);
   if (listen_sock_ > 0) {
     EpollUnregister(epoll_fd_, listen_sock_);
     close(listen_sock_);
+    listen_sock_ = -1;
+  }
+  if (udp_sock_ > 0) {
+    EpollUnregister(epoll_fd_, udp_sock_);
+    close(udp_sock_);
+    udp_sock_ = -1;
+  }
+  if (event_fd_ > 0) {
+    close(event_fd_);
+    event_fd_ = -1;
   }
   if (epoll_fd_ > 0) {
     close(epoll_fd_);
+    epoll_fd_ = -1;
   }
   if (epoll_events_ != nullptr) {
     delete [] epoll_events_;
     epoll_events_ = nullptr;
   }
-  ntrip_str_list_.clear();
-  thread_.join();
+  {
+    std::lock_guard<std::mutex> lock(command_mutex_);
+    commands_.clear();
+  }
+  data_taps_.clear();
+  source_table_.Clear();
+  recorder_.Stop();
+  for (auto& connection : connections_) {
+    connection_allocator_.Delete(connection);
+    connection = nullptr;
+  }
+  handshake_count_ = 0;
+}
+
+void NtripCaster::KickClient(std::string const& mountpoint,
+    std::string const& client_ip) {
+  PostCommand([this, mountpoint, client_ip] () {
+    uint32_t ip = client_ip.empty() ? 0 : inet_addr(client_ip.c_str());
+    for (auto& info : mount_point_infos_) {
+      if (info.mountpoint != mountpoint) continue;
+      std::vector<int> kicked;
+      for (auto fd : info.client_socket_list) {
+        ConnectionInformation* connection = FindConnection(fd);
+        if (client_ip.empty() ||
+            (connection != nullptr && connection->ip == ip)) {
+          kicked.push_back(fd);
+        }
+      }
+      printf("MountPoint %s kicks %d clients\n", mountpoint.c_str(),
+          static_cast<int>(kicked.size()));
+      for (auto fd : kicked) Disconnect(fd);
+      return;
+    }
+  });
+}
+
+void NtripCaster::AddMountPoint(std::string const& mountpoint,
+    std::string const& username, std::string const& password,
+    std::string const& ntrip_str) {
+  PostCommand([this, mountpoint, username, password, ntrip_str] () {
+    for (auto const& info : mount_point_infos_) {
+      if (info.mountpoint == mountpoint) {
+        printf("MountPoint %s already exists\n", mountpoint.c_str());
+        return;
+      }
+    }
+    MountPointInformation mount_point_info;
+    mount_point_info.mountpoint = mountpoint;
+    mount_point_info.username = username;
+    mount_point_info.password = password;
+    mount_point_info.persistent = true;
+    InitMountPoint(&mount_point_info);
+    if (recorder_.is_running()) {
+      mount_point_info.record_stream = recorder_.OpenStream(mountpoint);
+    }
+    mount_point_infos_.push_back(mount_point_info);
+    if (!ntrip_str.empty()) source_table_.Set(mountpoint, ntrip_str);
+    printf("MountPoint %s added\n", mountpoint.c_str());
+  });
+}
+
+std::shared_ptr<DataTap> NtripCaster::AddDataTap(
+    DataTapOptions const& options) {
+  std::shared_ptr<DataTap> tap = std::make_shared<DataTap>(options);
+  PostCommand([this, tap] () {
+    data_taps_.push_back(tap);
+    for (auto& info : mount_point_infos_) InitMountPoint(&info);
+  });
+  return tap;
+}
+
+void NtripCaster::RemoveDataTap(std::shared_ptr<DataTap> const& tap) {
+  PostCommand([this, tap] () {
+    data_taps_.erase(std::remove(data_taps_.begin(), data_taps_.end(), tap),
+        data_taps_.end());
+    for (auto& info : mount_point_infos_) InitMountPoint(&info);
+  });
+}
+
+std::string NtripCaster::mountpoint_name(int mountpoint_id) const {
+  std::lock_guard<std::mutex> lock(mountpoint_id_mutex_);
+  if (mountpoint_id < 0 ||
+      mountpoint_id >= static_cast<int>(mountpoint_names_.size())) {
+    return "";
+  }
+  return mountpoint_names_[mountpoint_id];
+}
+
+void NtripCaster::InitMountPoint(MountPointInformation* info) {
+  if (info->id < 0) {
+    std::lock_guard<std::mutex> lock(mountpoint_id_mutex_);
+    auto it = mountpoint_ids_.find(info->mountpoint);
+    if (it == mountpoint_ids_.end()) {
+      it = mountpoint_ids_.emplace(info->mountpoint,
+          static_cast<int>(mountpoint_names_.size())).first;
+      mountpoint_names_.push_back(info->mountpoint);
+    }
+    info->id = it->second;
+  }
+  info->taps.clear();
+  for (auto const& tap : data_taps_) {
+    if (tap->Accepts(info->mountpoint)) info->taps.push_back(tap.get());
+  }
+}
+
+void NtripCaster::PostCommand(std::function<void(void)> command) {
+  {
+    std::lock_guard<std::mutex> lock(command_mutex_);
+    commands_.push_back(std::move(command));
+  }
+  uint64_t one = 1;
+  if (write(event_fd_, &one, sizeof(one)) != sizeof(one)) ;
+}
+
+void NtripCaster::RunCommands(void) {
+  uint64_t count;
+  if (read(event_fd_, &count, sizeof(count)) != sizeof(count)) ;
+  std::vector<std::function<void(void)>> commands;
+  {
+    std::lock_guard<std::mutex> lock(command_mutex_);
+    commands.swap(commands_);
+  }
+  for (auto& command : commands) command();
+}
+
+MemoryPoolStatistics NtripCaster::buffer_pool_statistics(void) const {
+  return BufferPool::Instance(kBufferSize)->statistics();
 }
 
 //
@@ -199,16 +465,28 @@ void NtripCaster::ThreadHandler(void) {
   int ret;
   int alive_count;
   
-  std::unique_ptr<char[]> buffer(
-      new char[kBufferSize], std::default_delete<char[]>());
+  BufferPool* pool = BufferPool::Instance(kBufferSize);
+  receive_buffer_ = pool->Allocate();
+  int64_t last_event_ms = NowMilliseconds();
   printf("NtripCaster service running...\n");
   std::cout << "[DEBUG] Entering main epoll loop..." << std::endl;
-  while (1) {
-    ret = epoll_wait(epoll_fd_, epoll_events_, max_count_, time_out_);
+  while (!loop_exit_) {
+    // Deferred by the previous batch.
+    for (int fd : closing_fds_) close(fd);
+    closing_fds_.clear();
+    int timeout = time_out_;
+    if (low_latency_.busy_poll && ((low_latency_.spin_idle_ms == 0) ||
+        (NowMilliseconds() - last_event_ms < low_latency_.spin_idle_ms))) {
+      timeout = 0;
+    }
+    ret = epoll_wait(epoll_fd_, epoll_events_, max_count_, timeout);
+    if ((ret > 0) && low_latency_.busy_poll) last_event_ms = NowMilliseconds();
+    PeriodicCheck();
     if (ret == 0) {
       // printf("Epoll timeout\n");
       continue;
     } else if (ret == -1) {
+      if (errno == EINTR) continue;
       printf("Epoll error\n");
       break;
     } else {
@@ -220,14 +498,39 @@ void NtripCaster::ThreadHandler(void) {
           if (epoll_events_[i].events & EPOLLIN) {
             AcceptNewConnect();
           }
-        } else {
+        } else if (epoll_events_[i].data.fd == udp_sock_) {
           if (epoll_events_[i].events & EPOLLIN) {
+            ReceiveRtpPacket();
+          }
+        } else if (epoll_events_[i].data.fd == event_fd_) {
+          RunCommands();
+          if (loop_exit_) break;
+        } else {
+          // Dropped earlier in this batch.
+          if (ClosingAfterBatch(epoll_events_[i].data.fd)) continue;
+          if (epoll_events_[i].events & EPOLLOUT) {
+            FlushBacklog(epoll_events_[i].data.fd);
+          }
+          if ((epoll_events_[i].events & EPOLLIN) &&
+              !ClosingAfterBatch(epoll_events_[i].data.fd)) {
+            // Never overwrite data a slow subscriber still has to send.
+            if (receive_buffer_.use_count() > 1) {
+              receive_buffer_ = pool->Allocate();
+            }
             int ret = recv(epoll_events_[i].data.fd,
-                buffer.get(), kBufferSize, 0);
+                receive_buffer_.data(), kBufferSize, 0);
             if (ret > 0) {
               // Start parsing received's remote data.
-              if (ParseData(epoll_events_[i].data.fd, buffer.get(), ret) < 0) {
-                close(epoll_events_[i].data.fd);
+              if (ParseData(epoll_events_[i].data.fd,
+                  receive_buffer_.data(), ret) < 0) {
+                ConnectionInformation* connection =
+                    FindConnection(epoll_events_[i].data.fd);
+                // Otherwise FlushBacklog() closes it once the reply is sent.
+                if (connection == nullptr || !connection->close_when_flushed) {
+                  EpollUnregister(epoll_fd_, epoll_events_[i].data.fd);
+                  ReleaseConnection(epoll_events_[i].data.fd);
+                  CloseAfterBatch(epoll_events_[i].data.fd);
+                }
               }
             } else {
               Disconnect(epoll_events_[i].data.fd);
@@ -237,6 +540,9 @@ void NtripCaster::ThreadHandler(void) {
       }
     }
   }
+  for (int fd : closing_fds_) close(fd);
+  closing_fds_.clear();
+  receive_buffer_.reset();
   printf("NtripCaster service done.\n");
   service_is_running_.store(false);
 }
@@ -246,6 +552,18 @@ int NtripCaster::AcceptNewConnect(void) {
   memset(&client_addr, 0, sizeof(struct sockaddr_in));
   socklen_t clilen = sizeof(struct sockaddr);
   int new_sock = accept(listen_sock_, (struct sockaddr*)&client_addr, &clilen);
+  if (new_sock < 0) return -1;
+  // Shed before anything else is spent on the connection.
+  int64_t now = NowMilliseconds();
+  if (!admission_.AdmitConnection(client_addr.sin_addr.s_addr,
+      handshake_count_, now)) {
+    // Reset instead of a graceful close, leaves no TIME_WAIT behind.
+    struct linger so_linger = {1, 0};
+    setsockopt(new_sock, SOL_SOCKET, SO_LINGER, &so_linger,
+        sizeof(so_linger));
+    close(new_sock);
+    return -1;
+  }
   // TCP socket keepalive.
   int keepalive = 1;     // Enable keepalive attributes.
   int keepidle = 30;     // Time out for starting detection.
@@ -257,30 +575,99 @@ int NtripCaster::AcceptNewConnect(void) {
   setsockopt(new_sock, SOL_TCP, TCP_KEEPINTVL, &keepinterval,
              sizeof(keepinterval));
   setsockopt(new_sock, SOL_TCP, TCP_KEEPCNT, &keepcount, sizeof(keepcount));
+#if defined(SO_BUSY_POLL)
+  if (low_latency_.socket_busy_poll_us > 0) {
+    setsockopt(new_sock, SOL_SOCKET, SO_BUSY_POLL,
+        &low_latency_.socket_busy_poll_us,
+        sizeof(low_latency_.socket_busy_poll_us));
+  }
+#endif  // defined(SO_BUSY_POLL)
   EpollRegister(epoll_fd_, new_sock);
+  if (static_cast<int>(connections_.size()) <= new_sock) {
+    connections_.resize(new_sock+1, nullptr);
+  }
+  ReleaseConnection(new_sock);
+  ConnectionInformation* connection = connection_allocator_.New();
+  connection->fd = new_sock;
+  connection->ip = client_addr.sin_addr.s_addr;
+  connection->accept_ms = now;
+  connections_[new_sock] = connection;
+  ++handshake_count_;
   return new_sock;
 }
 
+ConnectionInformation* NtripCaster::FindConnection(int socket_fd) const {
+  if (socket_fd < 0 || socket_fd >= static_cast<int>(connections_.size())) {
+    return nullptr;
+  }
+  return connections_[socket_fd];
+}
+
+void NtripCaster::FinishHandshake(int socket_fd) {
+  ConnectionInformation* connection = FindConnection(socket_fd);
+  if (connection != nullptr && connection->handshaking) {
+    connection->handshaking = false;
+    --handshake_count_;
+  }
+}
+
+void NtripCaster::ReleaseConnection(int socket_fd) {
+  ConnectionInformation* connection = FindConnection(socket_fd);
+  if (connection == nullptr) return;
+  if (connection->handshaking) --handshake_count_;
+  connection_allocator_.Delete(connection);
+  connections_[socket_fd] = nullptr;
+}
+
 void NtripCaster::Disconnect(int socket_fd) {
   auto it = mount_point_infos_.begin();
   while (it != mount_point_infos_.end()) {
-    if (it->server_fd == socket_fd) {  // It is ntrip server.
+    if ((it->source_list.size() > 1) &&
+        (FindSource(&(it->source_list), socket_fd) != nullptr)) {
+      // Redundant mountpoint, the remaining sources keep it alive.
+      it->source_list.remove_if([socket_fd] (MountPointSource const& src) {
+        return src.fd == socket_fd;
+      });
+      printf("NtripServer disconnect, %s keeps %d sources.\n",
+          it->mountpoint.c_str(), static_cast<int>(it->source_list.size()));
+      if (it->server_fd == socket_fd) {
+        SelectActiveSource(&*it, nullptr, NowMilliseconds());
+      }
+      break;
+    } else if (it->server_fd == socket_fd ||
+        FindSource(&(it->source_list), socket_fd) != nullptr) {
+      // It is ntrip server.
       printf("NtripServer disconnect.\n");
-      ClearCilentConnection(epoll_fd_, &(it->client_socket_list));
-      // Remove mount point information from source table list.
-      std::string ntrip_str = "STR;" + it->mountpoint + ";";
-      auto str_it = ntrip_str_list_.begin();
-      while (str_it != ntrip_str_list_.end()) {
-        if (str_it->find(ntrip_str) != std::string::npos) {
-          ntrip_str_list_.erase(str_it);
-          break;
-        }
-        ++str_it;
+      if (it->persistent) {
+        // Subscribers wait for the base to come back.
+        it->source_list.clear();
+        it->server_fd = -1;
+        it->redundant = false;
+        it->source_lost_ms = NowMilliseconds();
+        break;
       }
+      // Later events of this batch may still name the subscribers.
+      for (auto fd : it->client_socket_list) {
+        EpollUnregister(epoll_fd_, fd);
+        ReleaseConnection(fd);
+        CloseAfterBatch(fd);
+      }
+      it->client_socket_list.clear();
+      source_table_.Remove(it->mountpoint);
       mount_point_infos_.erase(it);
       break;
     } else {  // is ntrip client.
       bool find_client = false;
+      auto rtp_it = it->rtp_session_list.begin();
+      while (rtp_it != it->rtp_session_list.end()) {
+        if (rtp_it->control_fd == socket_fd) {
+          printf("RTP session %08X closed\n", rtp_it->session_id);
+          rtp_it = it->rtp_session_list.erase(rtp_it);
+          find_client = true;
+        } else {
+          ++rtp_it;
+        }
+      }
       auto cli_it = it->client_socket_list.begin();
       while (cli_it != it->client_socket_list.end()) {
         if (*cli_it == socket_fd) {
@@ -297,7 +684,18 @@ void NtripCaster::Disconnect(int socket_fd) {
     }
     ++it;
   }
-  close(socket_fd);
+  EpollUnregister(epoll_fd_, socket_fd);
+  ReleaseConnection(socket_fd);
+  CloseAfterBatch(socket_fd);
+}
+
+void NtripCaster::CloseAfterBatch(int socket_fd) {
+  closing_fds_.push_back(socket_fd);
+}
+
+bool NtripCaster::ClosingAfterBatch(int socket_fd) const {
+  return std::find(closing_fds_.begin(), closing_fds_.end(), socket_fd) !=
+      closing_fds_.end();
 }
 
 int NtripCaster::ParseData(
@@ -308,6 +706,7 @@ int NtripCaster::ParseData(
   if ((str.find("GET /") != std::string::npos) ||
       (str.find("POST /") != std::string::npos)) {
     // printf("%s\n", str.c_str());
+    if (!AdmitRequest(socket_fd, str)) return -1;
     StringSplit(str, "\r\n", &request_lines, true);
     // Server request to connect to Caster.
     if ((str.find("POST /") != std::string::npos) &&
@@ -319,6 +718,13 @@ int NtripCaster::ParseData(
       // retval = DealClientConnectRequest(&request_lines, sock);
       retval = ClientConnectRequest(request_lines, socket_fd);
     }
+    if (retval == 0) FinishHandshake(socket_fd);
+  } else if (str.find(" RTSP/1.0\r\n") != std::string::npos) {
+    // NTRIP 2.0 RTP session control.
+    if (!AdmitRequest(socket_fd, str)) return -1;
+    StringSplit(str, "\r\n", &request_lines, true);
+    retval = RtspRequest(request_lines, socket_fd);
+    if (retval == 0) FinishHandshake(socket_fd);
   } else {
     // Data sent by Server, it needs to be forwarded to connected client.
     if ((retval = TryToForwardServerData(socket_fd, buffer, buffer_len)) < 0) {
@@ -348,49 +754,395 @@ int NtripCaster::ParseData(
   return retval;
 }
 
-void NtripCaster::SendSourceTableData(int socket_fd) {
-  std::string ntrip_str = "";
-  for (auto const& str : ntrip_str_list_) {
-    ntrip_str += str;
+bool NtripCaster::AdmitRequest(int socket_fd, std::string const& request) {
+  // Only new connections are limited, not requests on served ones.
+  ConnectionInformation* connection = FindConnection(socket_fd);
+  if (connection == nullptr || !connection->handshaking) return true;
+  std::string credential = BasicCredential(request);
+  if (credential.empty()) return true;
+  return admission_.AdmitCredential(credential, NowMilliseconds());
+}
+
+void NtripCaster::SendSourceTableData(int socket_fd,
+    std::string const& query, bool ntrip_version_2,
+    std::string const& if_none_match) {
+  // The table version is the validator, clients that have it get a 304.
+  // A filtered answer also depends on the filter.
+  std::string etag = "\"" + std::to_string(source_table_.version());
+  std::string filter = SourceTable::NormalizeQuery(query);
+  if (!filter.empty()) {
+    char hash[16];
+    snprintf(hash, sizeof(hash), "-%08X", HashString(filter));
+    etag += hash;
+  }
+  etag += "\"";
+  if (if_none_match == etag) {
+    std::string response = "HTTP/1.1 304 Not Modified\r\n"
+        "ETag: " + etag + "\r\n"
+        "Server: " + std::string(kCasterAgent) + "\r\n"
+        "\r\n";
+    if (send(socket_fd, response.data(), response.size(), 0) < 0) ;
+    return;
   }
-  std::unique_ptr<char[]> datetime(
-      new char[128], std::default_delete<char[]>());
+  std::string ntrip_str;
+  if (query.empty()) {
+    ntrip_str = source_table_.Render();
+  } else if (source_table_.Query(query, &ntrip_str) != 0) {
+    // Not a stream filter, answer with the whole table.
+    ntrip_str = source_table_.Render();
+  }
+  char datetime[128];
   time_t now;
   time(&now);
   struct tm *tm_now = localtime(&now);
-  strftime(datetime.get(), 128, "%x %H:%M:%S %Z", tm_now);
-  std::unique_ptr<char[]> buffer(
-      new char[kBufferSize], std::default_delete<char[]>());
-  int len = snprintf(buffer.get(), kBufferSize-1,
-      "SOURCETABLE 200 OK\r\n"
+  strftime(datetime, sizeof(datetime), "%x %H:%M:%S %Z", tm_now);
+  ntrip_str += "ENDSOURCETABLE\r\n";
+  char header[512];
+  int len = snprintf(header, sizeof(header),
+      "%s"
       "Server: %s\r\n"
-      "Content-Type: text/plain\r\n"
+      "%s"
+      "Content-Type: %s\r\n"
       "Content-Length: %d\r\n"
+      "ETag: %s\r\n"
       "Date: %s\r\n"
-      "\r\n"
-      "%s"
-      "ENDSOURCETABLE\r\n",
-      kCasterAgent, static_cast<int>(ntrip_str.size()),
-      datetime.get(), ntrip_str.c_str());
-  if (send(socket_fd, buffer.get(), len, 0) != len) {
+      "\r\n",
+      ntrip_version_2 ? "HTTP/1.1 200 OK\r\n" : "SOURCETABLE 200 OK\r\n",
+      kCasterAgent,
+      ntrip_version_2 ?
+          "Ntrip-Version: Ntrip/2.0\r\nConnection: close\r\n" : "",
+      ntrip_version_2 ? "gnss/sourcetable" : "text/plain",
+      static_cast<int>(ntrip_str.size()), etag.c_str(), datetime);
+  std::string response(header, len);
+  response += ntrip_str;
+  // Large tables do not fit in one send on a non-blocking socket, the rest
+  // is sent on EPOLLOUT and the connection closed after it.
+  size_t sent = 0;
+  bool would_block = false;
+  while (sent < response.size()) {
+    ssize_t ret = send(socket_fd, response.data()+sent,
+        response.size()-sent, 0);
+    if (ret > 0) {
+      sent += ret;
+    } else if (ret < 0 && errno == EINTR) {
+      continue;
+    } else {
+      would_block = (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+      break;
+    }
+  }
+  if (sent == response.size()) return;
+  ConnectionInformation* connection = FindConnection(socket_fd);
+  if (!would_block || connection == nullptr) {
     printf("Send source table failed!!!\n");
+    return;
   }
+  bool idle = connection->backlog.empty();
+  QueueBytes(connection, response.data()+sent,
+      static_cast<int>(response.size()-sent), nullptr);
+  connection->close_when_flushed = true;
+  if (idle) EpollModify(epoll_fd_, socket_fd, EPOLLIN | EPOLLOUT);
 }
 
 // TODO(mengyuming@hotmail.com) : Multiple connections still have problems.
 int NtripCaster::TryToForwardServerData(
     int socket_fd, char const* buffer, int buffer_len) {
   for (auto& info : mount_point_infos_) {
-    if (info.server_fd == socket_fd) {
-      for (auto& fd : info.client_socket_list) {
-        if (send(fd, buffer, buffer_len, 0) != buffer_len) ;
-      }
-      return 0;
+    MountPointSource* source = FindSource(&info.source_list, socket_fd);
+    if (source == nullptr) continue;
+    if (info.redundant) {
+      ForwardRedundantData(&info, source, buffer, buffer_len);
+    } else {
+      ForwardToSubscribers(&info, source, buffer, buffer_len);
     }
+    return 0;
   }
   return -1;
 }
 
+void NtripCaster::ForwardToSubscribers(MountPointInformation* info,
+    MountPointSource* source, char const* buffer, int buffer_len) {
+  SendToSubscribers(info, buffer, buffer_len, &receive_buffer_);
+  if (!info->rtp_session_list.empty() || info->record_stream >= 0 ||
+      !info->taps.empty()) {
+    // Datagram transports need whole frames, so a lost datagram costs
+    // exactly one RTCM message. Recordings and taps keep frame boundaries
+    // too.
+    source->framer.Feed(buffer, buffer_len,
+        [this, info] (char const* frame, int frame_len) {
+          if (!info->rtp_session_list.empty()) {
+            SendRtpFrame(info, frame, frame_len);
+          }
+          if (info->record_stream >= 0) {
+            recorder_.Append(info->record_stream, frame, frame_len);
+          }
+          if (!info->taps.empty()) DeliverToTaps(info, frame, frame_len);
+        });
+  }
+}
+
+void NtripCaster::ForwardRedundantData(MountPointInformation* info,
+    MountPointSource* source, char const* buffer, int buffer_len) {
+  int64_t now = NowMilliseconds();
+  frame_batch_.clear();
+  // Every source is framed to track its cadence, only whole frames of the
+  // active source reach the subscribers.
+  source->framer.Feed(buffer, buffer_len,
+      [&] (char const* frame, int frame_len) {
+        if (UpdateSourceCadence(source, now)) {
+          SelectActiveSource(info, source, now);
+        }
+        if (info->server_fd != source->fd) return;
+        frame_batch_.insert(frame_batch_.end(), frame, frame+frame_len);
+        if (!info->rtp_session_list.empty()) {
+          SendRtpFrame(info, frame, frame_len);
+        }
+        if (info->record_stream >= 0) {
+          recorder_.Append(info->record_stream, frame, frame_len);
+        }
+        if (!info->taps.empty()) DeliverToTaps(info, frame, frame_len);
+      });
+  if (frame_batch_.empty()) return;
+  SendToSubscribers(info, frame_batch_.data(),
+      static_cast<int>(frame_batch_.size()), nullptr);
+}
+
+void NtripCaster::DeliverToTaps(MountPointInformation* info,
+    char const* frame, int frame_len) {
+  static BufferPool* frame_pool = BufferPool::Instance(kRtcm3MaxFrameLength);
+  TappedFrame tapped;
+  tapped.mountpoint_id = info->id;
+  tapped.receive_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  tapped.utc_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+  tapped.size = frame_len;
+  // One copy shared by every tap. Sharing the receive buffer instead would
+  // let a full ring pin a 64 KiB buffer per frame.
+  tapped.buffer = frame_pool->Allocate();
+  memcpy(tapped.buffer.data(), frame, frame_len);
+  for (size_t i = 0; i+1 < info->taps.size(); ++i) {
+    info->taps[i]->Push(TappedFrame(tapped));
+  }
+  info->taps.back()->Push(std::move(tapped));
+}
+
+void NtripCaster::SendToSubscribers(MountPointInformation* info,
+    char const* data, int size, PooledBuffer const* owner) {
+  // One chunk header per payload, shared by every NTRIP 2.0 subscriber.
+  char chunk_header[16];
+  int header_len = snprintf(chunk_header, sizeof(chunk_header),
+      "%X\r\n", size);
+  struct iovec chunk[3];
+  chunk[0].iov_base = chunk_header;
+  chunk[0].iov_len = header_len;
+  chunk[1].iov_base = const_cast<char*>(data);
+  chunk[1].iov_len = size;
+  chunk[2].iov_base = const_cast<char*>("\r\n");
+  chunk[2].iov_len = 2;
+  for (auto& fd : info->client_socket_list) {
+    ConnectionInformation* connection = FindConnection(fd);
+    if (connection == nullptr) continue;
+    if (connection->chunked) {
+      SendToSubscriber(connection, chunk, 3, owner);
+    } else {
+      SendToSubscriber(connection, &chunk[1], 1, owner);
+    }
+  }
+}
+
+void NtripCaster::SendToSubscriber(ConnectionInformation* connection,
+    struct iovec const* iov, int iovcnt, PooledBuffer const* owner) {
+  int total = 0;
+  for (int i = 0; i < iovcnt; ++i) total += static_cast<int>(iov[i].iov_len);
+  bool idle = connection->backlog.empty();
+  int sent = 0;
+  if (idle) {
+    ssize_t ret = writev(connection->fd, iov, iovcnt);
+    if (ret == total) return;
+    if (ret < 0) {
+      // A broken socket is cleaned up by the read side.
+      if (errno != EAGAIN && errno != EWOULDBLOCK) return;
+      ret = 0;
+    }
+    sent = static_cast<int>(ret);
+  }
+  // Whole payloads are dropped for a subscriber that keeps falling behind,
+  // so neither the RTCM stream nor the chunk framing is cut in the middle.
+  if (sent == 0 &&
+      (connection->backlog_bytes + total > kMaxBacklogBytes ||
+       static_cast<int>(connection->backlog.size()) >= kMaxBacklogEntries)) {
+    return;
+  }
+  for (int i = 0; i < iovcnt; ++i) {
+    int len = static_cast<int>(iov[i].iov_len);
+    if (sent >= len) {
+      sent -= len;
+      continue;
+    }
+    QueueBytes(connection, static_cast<char const*>(iov[i].iov_base)+sent,
+        len-sent, owner);
+    sent = 0;
+  }
+  if (idle) EpollModify(epoll_fd_, connection->fd, EPOLLIN | EPOLLOUT);
+}
+
+void NtripCaster::QueueBytes(ConnectionInformation* connection,
+    char const* data, int size, PooledBuffer const* owner) {
+  connection->backlog_bytes += size;
+  if (owner != nullptr && *owner && size >= kMinSharedPayload &&
+      data >= owner->data() &&
+      data+size <= owner->data()+owner->capacity()) {
+    // Keep a reference, the payload is not copied.
+    connection->backlog.emplace_back();
+    PendingWrite& pending = connection->backlog.back();
+    pending.buffer = *owner;
+    pending.shared = true;
+    pending.offset = static_cast<int>(data-owner->data());
+    pending.size = size;
+    return;
+  }
+  auto& backlog = connection->backlog;
+  if (!backlog.empty() && !backlog.back().shared) {
+    // Append to the last private copy while it has room.
+    PendingWrite& pending = backlog.back();
+    int capacity = pending.buffer ? pending.buffer.capacity() :
+        static_cast<int>(sizeof(pending.bytes));
+    int len = std::min(size, capacity - pending.offset - pending.size);
+    if (len > 0) {
+      char* tail = (pending.buffer ? pending.buffer.data() : pending.bytes) +
+          pending.offset + pending.size;
+      memcpy(tail, data, len);
+      pending.size += len;
+      data += len;
+      size -= len;
+    }
+  }
+  while (size > 0) {
+    backlog.emplace_back();
+    PendingWrite& pending = backlog.back();
+    if (size <= static_cast<int>(sizeof(pending.bytes))) {
+      memcpy(pending.bytes, data, size);
+      pending.size = size;
+    } else {
+      pending.buffer = BufferPool::Instance(
+          size < kCopyBufferSize ? kCopyBufferSize : kBufferSize)->Allocate();
+      pending.size = std::min(size, pending.buffer.capacity());
+      memcpy(pending.buffer.data(), data, pending.size);
+    }
+    data += pending.size;
+    size -= pending.size;
+  }
+}
+
+void NtripCaster::FlushBacklog(int socket_fd) {
+  ConnectionInformation* connection = FindConnection(socket_fd);
+  if (connection == nullptr) return;
+  auto& backlog = connection->backlog;
+  while (!backlog.empty()) {
+    struct iovec iov[kMaxFlushIovecs];
+    int iovcnt = 0;
+    for (auto it = backlog.begin();
+         it != backlog.end() && iovcnt < kMaxFlushIovecs; ++it) {
+      iov[iovcnt].iov_base = const_cast<char*>(it->data());
+      iov[iovcnt].iov_len = it->size;
+      ++iovcnt;
+    }
+    ssize_t ret = writev(socket_fd, iov, iovcnt);
+    if (ret <= 0) {
+      if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+      // Broken, Disconnect() will release the backlog.
+      backlog.clear();
+      connection->backlog_bytes = 0;
+      break;
+    }
+    connection->backlog_bytes -= static_cast<int>(ret);
+    while (ret > 0) {
+      PendingWrite& pending = backlog.front();
+      if (ret < pending.size) {
+        pending.offset += static_cast<int>(ret);
+        pending.size -= static_cast<int>(ret);
+        return;
+      }
+      ret -= pending.size;
+      backlog.pop_front();
+    }
+  }
+  if (connection->close_when_flushed) {
+    EpollUnregister(epoll_fd_, socket_fd);
+    ReleaseConnection(socket_fd);
+    CloseAfterBatch(socket_fd);
+    return;
+  }
+  EpollModify(epoll_fd_, socket_fd, EPOLLIN);
+}
+
+void NtripCaster::SelectActiveSource(MountPointInformation* info,
+    MountPointSource* candidate, int64_t now) {
+  MountPointSource* active = FindSource(&info->source_list, info->server_fd);
+  if (candidate == nullptr) {
+    // The active source is gone, take the best remaining one.
+    for (auto& source : info->source_list) {
+      if ((candidate == nullptr) ||
+          (SourceIsStalled(*candidate, now) &&
+           !SourceIsStalled(source, now)) ||
+          ((SourceIsStalled(*candidate, now) ==
+            SourceIsStalled(source, now)) &&
+           (source.priority < candidate->priority))) {
+        candidate = &source;
+      }
+    }
+    if (candidate == nullptr) return;
+  } else if (candidate == active) {
+    return;
+  } else if ((active != nullptr) && !SourceIsStalled(*active, now)) {
+    // Only a recovered source of higher priority takes over a live one.
+    if ((candidate->priority >= active->priority) ||
+        (candidate->healthy_epochs < kRecoveryEpochs)) {
+      return;
+    }
+  }
+  printf("MountPoint %s switched to source priority %d\n",
+      info->mountpoint.c_str(), candidate->priority);
+  info->server_fd = candidate->fd;
+}
+
+void NtripCaster::SendRtpFrame(MountPointInformation* info,
+    char const* frame, int frame_len) {
+  uint8_t header[kRtpHeaderLength];
+  uint32_t timestamp = static_cast<uint32_t>(NowMilliseconds());
+  header[0] = 0x80;  // Version 2, no padding, no extension, no CSRC.
+  header[1] = kRtpPayloadTypeGnss;
+  header[4] = static_cast<uint8_t>(timestamp >> 24);
+  header[5] = static_cast<uint8_t>(timestamp >> 16);
+  header[6] = static_cast<uint8_t>(timestamp >> 8);
+  header[7] = static_cast<uint8_t>(timestamp);
+  struct iovec iov[2];
+  iov[0].iov_base = header;
+  iov[0].iov_len = kRtpHeaderLength;
+  iov[1].iov_base = const_cast<char*>(frame);
+  iov[1].iov_len = frame_len;
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 2;
+  msg.msg_namelen = sizeof(struct sockaddr_in);
+  for (auto& session : info->rtp_session_list) {
+    if (!session.playing) continue;
+    header[2] = static_cast<uint8_t>(session.sequence >> 8);
+    header[3] = static_cast<uint8_t>(session.sequence);
+    header[8] = static_cast<uint8_t>(session.session_id >> 24);
+    header[9] = static_cast<uint8_t>(session.session_id >> 16);
+    header[10] = static_cast<uint8_t>(session.session_id >> 8);
+    header[11] = static_cast<uint8_t>(session.session_id);
+    msg.msg_name = &session.client_addr;
+    // A dropped datagram is a lost frame, the sequence number still
+    // advances so the rover can see the gap.
+    if (sendmsg(udp_sock_, &msg, MSG_DONTWAIT) < 0) ;
+    ++session.sequence;
+  }
+}
+
 int NtripCaster::ServerConnectRequest(
     std::vector<std::string> const& lines, int socket_fd) {
   std::string mount_point;
@@ -402,6 +1154,8 @@ int NtripCaster::ServerConnectRequest(
   double latitude = 0.0;
   double longitude = 0.0;
   bool has_position = false;
+  int priority = 0;
+  bool has_priority = false;
   
   for (auto const& line : lines) {
     if (line.find("POST") != std::string::npos) {
@@ -412,14 +1166,6 @@ int NtripCaster::ServerConnectRequest(
         return -1;
       }
       mount_point = line.substr(pos_beg+1, pos_end-pos_beg-1);
-      // Check mountpoint.
-      for (auto const& info : mount_point_infos_) {
-        if (mount_point == info.mountpoint) {
-          printf("MountPoint already used!!!\n");
-          if (send(socket_fd, "ERROR - Bad Password\r\n", 22, 0) != 22) ;
-          return -1;
-        }
-      }
     } else if (line.find("Authorization: Basic") != std::string::npos) {
       auto pos_beg = line.find_last_of(' ');
       auto pos_end = line.find('\r', pos_beg);
@@ -441,9 +1187,41 @@ int NtripCaster::ServerConnectRequest(
         has_position = true;
         printf("Base station position: lat=%.6f, lon=%.6f\n", latitude, longitude);
       }
+    } else if (line.find("Source-Priority: ") != std::string::npos) {
+      // Redundant base stations: 0 is the primary, 1, 2... are standby.
+      priority = atoi(line.c_str()+line.find(' ')+1);
+      if (priority < 0) return -1;
+      has_priority = true;
     }
   }
   
+  // Check mountpoint. With the same credentials, a base that reconnects
+  // replaces its stale session instead of waiting for keepalive to clear it,
+  // and a base of another priority joins the redundant group.
+  MountPointInformation* group_info = nullptr;
+  MountPointSource* stale_source = nullptr;
+  for (auto& info : mount_point_infos_) {
+    if (mount_point == info.mountpoint) {
+      if (user.empty() || user != info.username || passwd != info.password) {
+        printf("MountPoint already used!!!\n");
+        if (send(socket_fd, "ERROR - Bad Password\r\n", 22, 0) != 22) ;
+        return -1;
+      }
+      for (auto& source : info.source_list) {
+        if (source.priority == priority) stale_source = &source;
+      }
+      if ((stale_source != nullptr ||
+           (!has_priority && !info.source_list.empty())) &&
+          !mountpoint_takeover_) {
+        printf("MountPoint already used!!!\n");
+        if (send(socket_fd, "ERROR - Bad Password\r\n", 22, 0) != 22) ;
+        return -1;
+      }
+      group_info = &info;
+      break;
+    }
+  }
+
   for (auto const& line : lines) {
     if (line.find("Ntrip-STR: ") != std::string::npos) {
       std::vector<std::string> sections;
@@ -470,12 +1248,62 @@ int NtripCaster::ServerConnectRequest(
     }
   }
   
+  if (group_info != nullptr) {
+    if (send(socket_fd, "HTTP/1.1 200 OK\r\n", 17, 0) != 17) return -1;
+    if (stale_source != nullptr) {
+      TakeOverMountPoint(group_info, stale_source, socket_fd, ntrip_str);
+    } else if (group_info->source_list.empty()) {
+      // A reserved mountpoint gets its base.
+      MountPointSource source;
+      source.fd = socket_fd;
+      source.priority = priority;
+      group_info->source_list.push_back(source);
+      group_info->redundant = has_priority;
+      group_info->server_fd = socket_fd;
+      group_info->source_lost_ms = 0;
+      if (!ntrip_str.empty()) source_table_.Set(mount_point, ntrip_str);
+      printf("MountPoint %s fed by its base\n", mount_point.c_str());
+    } else if (has_priority) {
+      MountPointSource source;
+      source.fd = socket_fd;
+      source.priority = priority;
+      group_info->source_list.push_back(source);
+      group_info->redundant = true;
+      printf("MountPoint %s added source priority %d, %d sources\n",
+          mount_point.c_str(), priority,
+          static_cast<int>(group_info->source_list.size()));
+    } else {
+      TakeOverMountPoint(group_info, &group_info->source_list.front(),
+          socket_fd, ntrip_str);
+    }
+    if (has_position) {
+      group_info->latitude = latitude;
+      group_info->longitude = longitude;
+      group_info->has_position = true;
+    }
+    return 0;
+  }
   if (!mount_point.empty() && !user.empty() && !passwd.empty()) {
-    MountPointInformation mount_point_info = {
-        socket_fd, mount_point, user, passwd, {}, latitude, longitude, has_position};
+    MountPointInformation mount_point_info;
+    MountPointSource source;
+    source.fd = socket_fd;
+    source.priority = priority;
+    mount_point_info.source_list.push_back(source);
+    mount_point_info.redundant = has_priority;
+    mount_point_info.server_fd = socket_fd;
+    mount_point_info.mountpoint = mount_point;
+    mount_point_info.username = user;
+    mount_point_info.password = passwd;
+    mount_point_info.latitude = latitude;
+    mount_point_info.longitude = longitude;
+    mount_point_info.has_position = has_position;
+    InitMountPoint(&mount_point_info);
+    if (recorder_.is_running()) {
+      mount_point_info.record_stream = recorder_.OpenStream(mount_point);
+    }
     if (send(socket_fd, "HTTP/1.1 200 OK\r\n", 17, 0) == 17) {
       mount_point_infos_.push_back(mount_point_info);
-      ntrip_str_list_.push_back(ntrip_str);
+      source_table_.Set(mount_point, ntrip_str);
       printf("Base station registered: %s (has_position=%s)\n", 
              mount_point.c_str(), has_position ? "yes" : "no");
       return 0;
@@ -484,6 +1312,23 @@ int NtripCaster::ServerConnectRequest(
   return -1;
 }
 
+void NtripCaster::TakeOverMountPoint(MountPointInformation* info,
+    MountPointSource* source, int socket_fd, std::string const& ntrip_str) {
+  printf("MountPoint %s taken over by new session, %d clients kept\n",
+      info->mountpoint.c_str(),
+      static_cast<int>(info->client_socket_list.size()));
+  EpollUnregister(epoll_fd_, source->fd);
+  ReleaseConnection(source->fd);
+  CloseAfterBatch(source->fd);
+  if (info->server_fd == source->fd) info->server_fd = socket_fd;
+  // The old session may have stopped in the middle of a frame.
+  int priority = source->priority;
+  *source = MountPointSource();
+  source->fd = socket_fd;
+  source->priority = priority;
+  if (!ntrip_str.empty()) source_table_.Set(info->mountpoint, ntrip_str);
+}
+
 int NtripCaster::ClientConnectRequest(
     std::vector<std::string> const& lines, int socket_fd) {
   std::string mount_point;
@@ -492,6 +1337,8 @@ int NtripCaster::ClientConnectRequest(
   std::string user;
   std::string passwd;
   bool ntrip_version_1 = false;
+  bool ntrip_version_2 = false;
+  std::string if_none_match;
   double client_lat = 0.0;
   double client_lon = 0.0;
   bool has_client_position = false;
@@ -527,8 +1374,21 @@ int NtripCaster::ClientConnectRequest(
         has_client_position = true;
         printf("Client position from header: lat=%.6f, lon=%.6f\n", client_lat, client_lon);
       }
+    } else if (line.find("Ntrip-Version: Ntrip/2.0") != std::string::npos) {
+      ntrip_version_2 = true;
+    } else if (line.compare(0, 15, "If-None-Match: ") == 0) {
+      if_none_match = line.substr(15, line.find_last_not_of("\r\n")-14);
     }
   }
+
+  // Empty mountpoint or a '?' query asks for the source table, the
+  // connection is closed after it is sent.
+  if (mount_point.empty() || mount_point[0] == '?') {
+    SendSourceTableData(socket_fd,
+        mount_point.empty() ? "" : mount_point.substr(1), ntrip_version_2,
+        if_none_match);
+    return -1;
+  }
   
   if (!mount_point.empty() && !user.empty() && !passwd.empty()) {
     // Handle auto-selection
@@ -562,11 +1422,8 @@ int NtripCaster::ClientConnectRequest(
         
         // Check authentication for the selected mountpoint
         if (user == best_mountpoint->username && passwd == best_mountpoint->password) {
-          std::string response = "HTTP/1.1 200 OK\r\n";
-          if (ntrip_version_1) response = "ICY 200 OK\r\n";
-          int len = response.size();
-          if (send(socket_fd, response.c_str(), len, 0) == len) {
-            best_mountpoint->client_socket_list.push_back(socket_fd);
+          if (AddSubscriber(best_mountpoint, socket_fd, ntrip_version_1,
+              ntrip_version_2) == 0) {
             return 0;
           }
         } else {
@@ -583,11 +1440,8 @@ int NtripCaster::ClientConnectRequest(
       for (auto& info : mount_point_infos_) {
         if ((mount_point == info.mountpoint) && (user == info.username) &&
             (passwd == info.password)) {
-          std::string response = "HTTP/1.1 200 OK\r\n";
-          if (ntrip_version_1) response = "ICY 200 OK\r\n";
-          int len = response.size();
-          if (send(socket_fd, response.c_str(), len, 0) == len) {
-            info.client_socket_list.push_back(socket_fd);
+          if (AddSubscriber(&info, socket_fd, ntrip_version_1,
+              ntrip_version_2) == 0) {
             return 0;
           }
         }
@@ -599,4 +1453,303 @@ int NtripCaster::ClientConnectRequest(
   return -1;
 }
 
+int NtripCaster::AddSubscriber(MountPointInformation* info, int socket_fd,
+    bool ntrip_version_1, bool ntrip_version_2) {
+  // NTRIP 2.0 data is framed in HTTP chunks, 1.0 and ICY clients get it raw.
+  bool chunked = ntrip_version_2 && !ntrip_version_1;
+  std::string response = "HTTP/1.1 200 OK\r\n";
+  if (ntrip_version_1) {
+    response = "ICY 200 OK\r\n";
+  } else if (chunked) {
+    response += "Ntrip-Version: Ntrip/2.0\r\n"
+        "Server: " + std::string(kCasterAgent) + "\r\n"
+        "Cache-Control: no-store, no-cache, max-age=0\r\n"
+        "Pragma: no-cache\r\n"
+        "Connection: close\r\n"
+        "Content-Type: gnss/data\r\n"
+        "Transfer-Encoding: chunked\r\n"
+        "\r\n";
+  }
+  int len = response.size();
+  if (send(socket_fd, response.c_str(), len, 0) != len) return -1;
+  ConnectionInformation* connection = FindConnection(socket_fd);
+  if (connection != nullptr) connection->chunked = chunked;
+  info->client_socket_list.push_back(socket_fd);
+  TuneSubscriberSocket(socket_fd, info->mountpoint);
+  return 0;
+}
+
+void NtripCaster::TuneSubscriberSocket(int socket_fd,
+    std::string const& mountpoint) {
+  SocketTuning const* tuning = nullptr;
+  size_t matched = 0;
+  for (auto const& item : socket_tunings_) {
+    if (mountpoint.compare(0, item.first.size(), item.first) != 0) continue;
+    if (tuning == nullptr || item.first.size() > matched) {
+      tuning = &item.second;
+      matched = item.first.size();
+    }
+  }
+  if (tuning == nullptr) return;
+  if (tuning->no_delay) {
+    int flag = 1;
+    setsockopt(socket_fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+  }
+#if defined(TCP_NOTSENT_LOWAT)
+  if (tuning->not_sent_lowat > 0) {
+    setsockopt(socket_fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+        &tuning->not_sent_lowat, sizeof(tuning->not_sent_lowat));
+  }
+#endif  // defined(TCP_NOTSENT_LOWAT)
+  if (tuning->send_buffer > 0) {
+    setsockopt(socket_fd, SOL_SOCKET, SO_SNDBUF, &tuning->send_buffer,
+        sizeof(tuning->send_buffer));
+  }
+}
+
+int NtripCaster::RtspRequest(
+    std::vector<std::string> const& lines, int socket_fd) {
+  if (lines.empty()) return -1;
+  std::string method;
+  std::string mount_point;
+  std::string cseq = "0";
+  std::string user_passwd;
+  std::string user;
+  std::string passwd;
+  uint32_t session_id = 0;
+  int client_port = -1;
+  bool has_session = false;
+  // Request line: "SETUP rtsp://host:port/mountpoint RTSP/1.0".
+  auto const& request = lines.front();
+  auto pos = request.find(' ');
+  if (pos == std::string::npos) return -1;
+  method = request.substr(0, pos);
+  auto url_beg = request.find("://", pos);
+  auto url_end = request.find(' ', pos+1);
+  if (url_beg != std::string::npos && url_beg < url_end) {
+    auto path_beg = request.find('/', url_beg+3);
+    if (path_beg != std::string::npos && path_beg < url_end) {
+      mount_point = request.substr(path_beg+1, url_end-path_beg-1);
+    }
+  }
+  for (auto const& line : lines) {
+    if (line.find("CSeq:") == 0) {
+      cseq = RtspHeaderValue(line);
+    } else if (line.find("Session:") == 0) {
+      std::string value = RtspHeaderValue(line);
+      session_id = static_cast<uint32_t>(strtoul(value.c_str(), nullptr, 16));
+      has_session = true;
+    } else if (line.find("Transport:") == 0) {
+      auto port_pos = line.find("client_port=");
+      if (port_pos != std::string::npos) {
+        client_port = atoi(line.c_str()+port_pos+12);
+      }
+    } else if (line.find("Authorization: Basic") != std::string::npos) {
+      auto pos_beg = line.find_last_of(' ');
+      auto pos_end = line.find('\r', pos_beg);
+      if (pos_beg == std::string::npos || pos_end == std::string::npos) {
+        return -1;
+      }
+      if (Base64Decode(line.substr(pos_beg+1, pos_end-pos_beg-1),
+          &user_passwd) != 0) {
+        return -1;
+      }
+      auto pos = user_passwd.find(":");
+      if (pos == std::string::npos) return -1;
+      user = user_passwd.substr(0, pos);
+      passwd = user_passwd.substr(pos+1);
+    }
+  }
+
+  char response[256];
+  auto reply = [&] (char const* status, std::string const& extra) -> int {
+    int len = snprintf(response, sizeof(response),
+        "RTSP/1.0 %s\r\n"
+        "CSeq: %s\r\n"
+        "Ntrip-Version: Ntrip/2.0\r\n"
+        "Server: %s\r\n"
+        "%s"
+        "\r\n",
+        status, cseq.c_str(), kCasterAgent, extra.c_str());
+    if (len < 0 || len >= static_cast<int>(sizeof(response))) return -1;
+    return (send(socket_fd, response, len, 0) == len) ? 0 : -1;
+  };
+  auto find_session = [&] (MountPointInformation** info_out)
+      -> std::list<RtpSessionInformation>::iterator {
+    for (auto& info : mount_point_infos_) {
+      for (auto it = info.rtp_session_list.begin();
+           it != info.rtp_session_list.end(); ++it) {
+        if (it->session_id == session_id && it->control_fd == socket_fd) {
+          *info_out = &info;
+          return it;
+        }
+      }
+    }
+    *info_out = nullptr;
+    return std::list<RtpSessionInformation>::iterator();
+  };
+
+  if (method == "SETUP") {
+    if (udp_sock_ == -1) {
+      reply("461 Unsupported Transport", "");
+      return -1;
+    }
+    if (client_port <= 0 || client_port > 65535) {
+      reply("400 Bad Request", "");
+      return -1;
+    }
+    for (auto& info : mount_point_infos_) {
+      if (info.mountpoint != mount_point) continue;
+      if (user != info.username || passwd != info.password) break;
+      RtpSessionInformation session;
+      do {
+        session.session_id = session_id_engine_();
+      } while (session.session_id == 0);
+      session.control_fd = socket_fd;
+      socklen_t addr_len = sizeof(session.client_addr);
+      if (getpeername(socket_fd,
+          reinterpret_cast<struct sockaddr*>(&session.client_addr),
+          &addr_len) != 0) {
+        return -1;
+      }
+      session.client_addr.sin_port = htons(client_port);
+      session.last_active_ms = NowMilliseconds();
+      char extra[128];
+      snprintf(extra, sizeof(extra),
+          "Session: %08X\r\n"
+          "Transport: RTP/GNSS;unicast;client_port=%d;server_port=%d\r\n",
+          session.session_id, client_port, server_port_);
+      if (reply("200 OK", extra) != 0) return -1;
+      info.rtp_session_list.push_back(session);
+      printf("RTP session %08X setup on %s\n",
+          session.session_id, info.mountpoint.c_str());
+      return 0;
+    }
+    if (reply("401 Unauthorized", "") != 0) ;
+    return -1;
+  } else if (method == "PLAY" || method == "GET_PARAMETER" ||
+      method == "TEARDOWN") {
+    MountPointInformation* info = nullptr;
+    auto it = find_session(&info);
+    if (!has_session || info == nullptr) {
+      return reply("454 Session Not Found", "");
+    }
+    char extra[32];
+    snprintf(extra, sizeof(extra), "Session: %08X\r\n", session_id);
+    if (method == "TEARDOWN") {
+      printf("RTP session %08X teardown\n", session_id);
+      info->rtp_session_list.erase(it);
+      return reply("200 OK", extra);
+    }
+    if (method == "PLAY" && !it->playing) {
+      // The frame splitter is idle while no session exists.
+      bool first = true;
+      for (auto const& session : info->rtp_session_list) {
+        if (session.playing) first = false;
+      }
+      MountPointSource* source =
+          FindSource(&info->source_list, info->server_fd);
+      if (first && !info->redundant && source != nullptr) {
+        source->framer.Reset();
+      }
+      it->playing = true;
+    }
+    it->last_active_ms = NowMilliseconds();
+    return reply("200 OK", extra);
+  } else if (method == "OPTIONS") {
+    return reply("200 OK",
+        "Public: SETUP, PLAY, TEARDOWN, GET_PARAMETER, OPTIONS\r\n");
+  }
+  reply("501 Not Implemented", "");
+  return -1;
+}
+
+void NtripCaster::ReceiveRtpPacket(void) {
+  uint8_t buffer[1500];
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  int ret = recvfrom(udp_sock_, buffer, sizeof(buffer), 0,
+      reinterpret_cast<struct sockaddr*>(&addr), &addr_len);
+  // Keep-alive packets from the rover carry the session ID as SSRC.
+  if (ret < kRtpHeaderLength || (buffer[0] & 0xC0) != 0x80) return;
+  uint32_t ssrc = (static_cast<uint32_t>(buffer[8]) << 24) |
+      (static_cast<uint32_t>(buffer[9]) << 16) |
+      (static_cast<uint32_t>(buffer[10]) << 8) | buffer[11];
+  for (auto& info : mount_point_infos_) {
+    for (auto& session : info.rtp_session_list) {
+      if (session.session_id == ssrc &&
+          session.client_addr.sin_addr.s_addr == addr.sin_addr.s_addr) {
+        session.last_active_ms = NowMilliseconds();
+        // Follow the NAT mapping of the rover.
+        session.client_addr.sin_port = addr.sin_port;
+        return;
+      }
+    }
+  }
+}
+
+void NtripCaster::PeriodicCheck(void) {
+  int64_t now = NowMilliseconds();
+  if (now - last_check_ms_ < kPeriodicCheckIntervalMs) return;
+  last_check_ms_ = now;
+  CheckRtpSessionTimeout(now);
+  CheckHandshakeTimeout(now);
+  CheckSourceReconnect(now);
+  if (now - last_prune_ms_ >= kAdmissionPruneIntervalMs) {
+    last_prune_ms_ = now;
+    admission_.Prune(now);
+  }
+}
+
+void NtripCaster::CheckRtpSessionTimeout(int64_t now) {
+  for (auto& info : mount_point_infos_) {
+    auto it = info.rtp_session_list.begin();
+    while (it != info.rtp_session_list.end()) {
+      if (now - it->last_active_ms > kRtpSessionTimeoutMs) {
+        printf("RTP session %08X timeout\n", it->session_id);
+        it = info.rtp_session_list.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+}
+
+void NtripCaster::CheckSourceReconnect(int64_t now) {
+  for (auto& info : mount_point_infos_) {
+    if (info.source_lost_ms == 0 ||
+        now - info.source_lost_ms <= kSourceReconnectWindowMs) {
+      continue;
+    }
+    info.source_lost_ms = 0;
+    printf("MountPoint %s base did not come back, %d clients dropped\n",
+        info.mountpoint.c_str(),
+        static_cast<int>(info.client_socket_list.size()));
+    // The batch being handled may still hold events for them.
+    for (auto fd : info.client_socket_list) {
+      EpollUnregister(epoll_fd_, fd);
+      ReleaseConnection(fd);
+      CloseAfterBatch(fd);
+    }
+    info.client_socket_list.clear();
+  }
+}
+
+void NtripCaster::CheckHandshakeTimeout(int64_t now) {
+  int timeout = admission_.options().handshake_timeout_ms;
+  if (timeout <= 0) return;
+  if (handshake_count_ == 0) return;
+  for (auto connection : connections_) {
+    if ((connection != nullptr) && connection->handshaking &&
+        (now - connection->accept_ms > timeout)) {
+      int fd = connection->fd;
+      // The batch being handled may still hold events for it.
+      EpollUnregister(epoll_fd_, fd);
+      ReleaseConnection(fd);
+      CloseAfterBatch(fd);
+      admission_.OnHandshakeTimeout();
+    }
+  }
+}
+
 }  // namespace libntrip
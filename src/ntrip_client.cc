@@ -28,20 +28,32 @@
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#else
+#include <ws2tcpip.h>
 #endif  // defined(__linux__)
+#include <ctype.h>
 #include <errno.h>
 #include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
+#include <chrono>  // NOLINT.
 #include <string>
 #include <list>
 #include <memory>
+#include <random>
 
+#include "ntrip/memory_pool.h"
 #include "ntrip/ntrip_util.h"
+#include "ntrip/rtcm3_frame.h"
 #include "cmake_definition.h.in"
 
 
@@ -53,15 +65,77 @@ namespace libntrip {
 
 namespace {
 
-using socket_t = decltype(socket(AF_INET, SOCK_STREAM, 0));
-
 // GPGGA format example.
 constexpr char gpgga_buffer[] =
     "$GPGGA,083552.00,3000.0000000,N,11900.0000000,E,"
     "1,08,1.0,0.000,M,100.000,M,,*57\r\n";
 
 constexpr int kBufferSize = 4096;
+// Receive buffer of the frame mode, a multiple of the largest frame.
+constexpr int kFrameBufferSize = 64 * 1024;
 constexpr int kReceiveTimeoutPeriod = 3;
+// Longest caster reply header accepted.
+constexpr size_t kMaxReplyHeader = 8192;
+// How long a resolved caster address is reused.
+constexpr int64_t kResolveTtlMs = 60000;
+// A session that lasted this long resets the reconnect backoff.
+constexpr int64_t kStableSessionMs = 10000;
+// Data closer together than this belongs to one epoch.
+constexpr int64_t kBurstGapMs = 50;
+// Stall timeout until the epoch interval is known, and its lower bound.
+constexpr int64_t kDefaultStallMs = 2000;
+constexpr int64_t kMinStallMs = 100;
+// Frames remembered for dropping the overlap after a failover.
+constexpr int kRecentFrames = 256;
+
+enum LinkState {
+  kLinkIdle = 0,
+  kLinkConnecting,
+  kLinkLoggingIn,
+  kLinkStreaming,
+};
+
+int64_t NowMs(void) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int64_t NowNs(void) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#if defined(WIN32) || defined(_WIN32)
+void CloseSocket(SOCKET fd) { closesocket(fd); }
+bool IsValidSocket(SOCKET fd) { return fd != INVALID_SOCKET; }
+bool ConnectInProgress(void) { return WSAGetLastError() == WSAEWOULDBLOCK; }
+bool WouldBlock(void) { return WSAGetLastError() == WSAEWOULDBLOCK; }
+void SetWouldBlock(void) { WSASetLastError(WSAEWOULDBLOCK); }
+int SetNonBlocking(SOCKET fd) {
+  unsigned long ul = 1;
+  return (ioctlsocket(fd, FIONBIO, &ul) == SOCKET_ERROR) ? -1 : 0;
+}
+#else
+void CloseSocket(int fd) { close(fd); }
+bool IsValidSocket(int fd) { return fd >= 0; }
+bool ConnectInProgress(void) { return errno == EINPROGRESS; }
+bool WouldBlock(void) {
+  return (errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR);
+}
+void SetWouldBlock(void) { errno = EAGAIN; }
+int SetNonBlocking(int fd) {
+  int flags = fcntl(fd, F_GETFL);
+  return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+#endif  // defined(WIN32) || defined(_WIN32)
+
+// Frames are told apart by CRC and length.
+uint64_t FrameKey(char const* frame, int size) {
+  uint8_t const* crc = reinterpret_cast<uint8_t const*>(frame+size-3);
+  return (static_cast<uint64_t>(size) << 24) |
+      (static_cast<uint64_t>(crc[0]) << 16) |
+      (static_cast<uint64_t>(crc[1]) << 8) | crc[2];
+}
 
 }  // namespace
 
@@ -72,164 +146,181 @@ constexpr int kReceiveTimeoutPeriod = 3;
 bool NtripClient::Run(void) {
   if (service_is_running_.load()) return true;
   Stop();
-  socket_t socket_fd;
-  // Establish a connection with NtripCaster.
-  struct sockaddr_in server_addr;
-  memset(&server_addr, 0, sizeof(server_addr));
-  server_addr.sin_family = AF_INET;
-  server_addr.sin_port = htons(server_port_);
-  server_addr.sin_addr.s_addr = inet_addr(server_ip_.c_str());
 #if defined(WIN32) || defined(_WIN32)
   WSADATA ws_data;
   if (WSAStartup(MAKEWORD(2,2), &ws_data) != 0) {
     return false;
   }
-  socket_fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-  if (socket_fd == INVALID_SOCKET) {
-    printf("Create socket failed!\r\n");
-    WSACleanup();
-    return false;
-  }
-  server_addr.sin_addr.S_un.S_addr = inet_addr(server_ip_.c_str());
+  winsock_started_ = true;
 #else
-  socket_fd = socket(AF_INET, SOCK_STREAM, 0);
-  if (socket_fd == -1) {
-    printf("Create socket failed, errno = -%d\r\n", errno);
-    return false;
-  }
-#endif  // defined(WIN32) || defined(_WIN32)
-  if (connect(socket_fd, reinterpret_cast<struct sockaddr *>(&server_addr),
-      sizeof(server_addr)) < 0) {
-    printf("Connect to NtripCaster[%s:%d] failed, errno = -%d\r\n",
-        server_ip_.c_str(), server_port_, errno);
-#if defined(WIN32) || defined(_WIN32)
-    closesocket(socket_fd);
-    WSACleanup();
-#else
-    close(socket_fd);
+  wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
 #endif  // defined(WIN32) || defined(_WIN32)
-    return false;
+  endpoints_.assign(1 + standby_endpoints_.size(), EndpointState());
+  endpoints_[0].config.ip = server_ip_;
+  endpoints_[0].config.port = server_port_;
+  endpoints_[0].config.user = user_;
+  endpoints_[0].config.passwd = passwd_;
+  endpoints_[0].config.mountpoint = mountpoint_;
+  for (size_t i = 0; i < standby_endpoints_.size(); ++i) {
+    endpoints_[i+1].config = standby_endpoints_[i];
   }
-  // Set non-blocking.
-#if defined(WIN32) || defined(_WIN32)
-  unsigned long ul = 1;
-  if (ioctlsocket(socket_fd, FIONBIO, &ul) == SOCKET_ERROR) {
-    closesocket(socket_fd);
-    WSACleanup();
-    return false;
-  }
-#else
-  int flags = fcntl(socket_fd, F_GETFL);
-  fcntl(socket_fd, F_SETFL, flags | O_NONBLOCK);
-#endif  // defined(WIN32) || defined(_WIN32)
-  // Ntrip connection authentication.
-  int ret = -1;
-  std::string user_passwd = user_ + ":" + passwd_;
-  std::string user_passwd_base64;
-  std::unique_ptr<char[]> buffer(
-      new char[kBufferSize], std::default_delete<char[]>());
-  // Generate base64 encoding of username and password.
-  Base64Encode(user_passwd, &user_passwd_base64);
-  // Generate request data format of ntrip.
-  ret = snprintf(buffer.get(), kBufferSize-1,
-      "GET /%s HTTP/1.1\r\n"
-      "User-Agent: %s\r\n"
-      "Authorization: Basic %s\r\n"
-      "\r\n",
-      mountpoint_.c_str(), kClientAgent, user_passwd_base64.c_str());
-  if (send(socket_fd, buffer.get(), ret, 0) < 0) {
-    printf("Send request failed!!!\r\n");
-#if defined(WIN32) || defined(_WIN32)
-    closesocket(socket_fd);
-    WSACleanup();
-#else
-    close(socket_fd);
-#endif  // defined(WIN32) || defined(_WIN32)
-    return false;
-  }
-  // Waitting for request to connect caster success.
-  int timeout = 30;  // 30*100ms=3s.
-  while (timeout--) {
-    ret = recv(socket_fd, buffer.get(), kBufferSize, 0);
-    if (ret > 0) {
-      std::string result(buffer.get(), ret);
-      if ((result.find("HTTP/1.1 200 OK") != std::string::npos) ||
-          (result.find("ICY 200 OK") != std::string::npos)) {
-        if (gga_buffer_.empty()) {
-          GGAFrameGenerate(latitude_, longitude_, 10.0, &gga_buffer_);
-        }
-        ret = send(socket_fd, gga_buffer_.c_str(), gga_buffer_.size(), 0);
-        if (ret < 0) {
-          printf("Send gpgga data fail\r\n");
-#if defined(WIN32) || defined(_WIN32)
-          closesocket(socket_fd);
-          WSACleanup();
-#else
-          close(socket_fd);
-#endif  // defined(WIN32) || defined(_WIN32)
-          return false;
-        }
-        break;
-      } else {
-        printf("Request result: %s\r\n", result.c_str());
-      }
-    } else if (ret == 0) {
-      printf("Remote socket close!!!\r\n");
-#if defined(WIN32) || defined(_WIN32)
-      closesocket(socket_fd);
-      WSACleanup();
-#else
-      close(socket_fd);
-#endif  // defined(WIN32) || defined(_WIN32)
+  if (station_table_) {
+    station_ = -1;
+    if (!SelectStation()) {
+      printf("No suitable station in the sourcetable\r\n");
+      Stop();
       return false;
     }
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
   }
-  if (timeout <= 0) {
-    printf("NtripCaster[%s:%d %s %s %s] access failed!!!\r\n",
-        server_ip_.c_str(), server_port_,
-        user_.c_str(), passwd_.c_str(), mountpoint_.c_str());
-#if defined(WIN32) || defined(_WIN32)
-    closesocket(socket_fd);
-    WSACleanup();
-#else
-    close(socket_fd);
-#endif  // defined(WIN32) || defined(_WIN32)
+  active_endpoint_.store(0);
+  standby_next_ = 1;
+  standby_retry_ms_ = 0;
+  standby_delay_ms_ = 0;
+  epoch_interval_ms_ = 0;
+  bool dedup = frame_callback_ && (endpoints_.size() > 1);
+  recent_frames_.assign(dedup ? kRecentFrames : 0, 0);
+  recent_next_ = 0;
+  dedup_until_ms_ = 0;
+  service_is_running_.store(true);
+  // The first connection is made synchronously so that bad parameters
+  // are reported to the caller, later ones by the receive thread.
+  if (Connect(&active_, 0) != 0) {
+    Stop();
     return false;
   }
-  // TCP socket keepalive.
-#if defined(ENABLE_TCP_KEEPALIVE)
-  int keepalive = 1;  // Enable keepalive attributes.
-  int keepidle = 30;  // Time out for starting detection.
-  int keepinterval = 5;  // Time interval for sending packets during detection.
-  int keepcount = 3;  // Max times for sending packets during detection.
-  setsockopt(socket_fd, SOL_SOCKET, SO_KEEPALIVE,
-      &keepalive, sizeof(keepalive));
-  setsockopt(socket_fd, SOL_TCP, TCP_KEEPIDLE, &keepidle, sizeof(keepidle));
-  setsockopt(socket_fd, SOL_TCP, TCP_KEEPINTVL,
-      &keepinterval, sizeof(keepinterval));
-  setsockopt(socket_fd, SOL_TCP, TCP_KEEPCNT, &keepcount, sizeof(keepcount));
-#endif  // defined(ENABLE_TCP_KEEPALIVE)
-  socket_fd_ = socket_fd;
+  if (delivery_queue_ != nullptr) {
+    delivery_peak_.store(0);
+    delivery_delivered_.store(0);
+    delivery_dropped_.store(0);
+    delivery_blocked_ns_.store(0);
+    if (delivery_options_.dispatch_thread) {
+      dispatching_.store(true);
+      dispatch_thread_.set_default_name("ntrip_dispatch");
+      dispatch_thread_.reset(&NtripClient::DispatchHandler, this);
+    }
+  }
+  thread_.set_default_name("ntrip_client");
   thread_.reset(&NtripClient::ThreadHandler, this);
   return true;
 }
 
 void NtripClient::Stop(void) {
   service_is_running_.store(false);
+#if defined(__linux__)
+  if (wake_fd_ >= 0) {
+    uint64_t one = 1;
+    if (write(wake_fd_, &one, sizeof(one)) != sizeof(one)) ;
+  }
+#endif  // defined(__linux__)
+  // The sockets are closed once the receive thread no longer uses them.
+  thread_.join();
+  if (dispatching_.load()) {
+    {
+      std::lock_guard<std::mutex> lock(delivery_mutex_);
+      dispatching_.store(false);
+    }
+    delivery_cv_.notify_all();
+    dispatch_thread_.join();
+  }
+#if defined(__linux__)
+  if (wake_fd_ >= 0) {
+    close(wake_fd_);
+    wake_fd_ = -1;
+  }
+#endif  // defined(__linux__)
+  CloseLink(&active_);
+  CloseLink(&standby_);
 #if defined(WIN32) || defined(_WIN32)
-  if (socket_fd_ != INVALID_SOCKET) {
-    closesocket(socket_fd_);
+  if (winsock_started_) {
     WSACleanup();
-    socket_fd_ = INVALID_SOCKET;
+    winsock_started_ = false;
   }
-#else
-  if (socket_fd_ > 0) {
-    close(socket_fd_);
-    socket_fd_ = -1;
+#endif  // defined(WIN32) || defined(_WIN32)
+}
+
+int NtripClient::FetchSourceTable(SourceTableSnapshot* table,
+    std::string const& cache_path) {
+  if (table == nullptr) return -1;
+  bool cached = !cache_path.empty() && (table->Load(cache_path) == 0);
+#if defined(WIN32) || defined(_WIN32)
+  WSADATA ws_data;
+  if (WSAStartup(MAKEWORD(2,2), &ws_data) != 0) {
+    return -1;
   }
 #endif  // defined(WIN32) || defined(_WIN32)
-  thread_.join();
+  EndpointState server;
+  server.config.ip = server_ip_;
+  server.config.port = server_port_;
+  server.config.user = user_;
+  server.config.passwd = passwd_;
+  SourceTableSnapshot fresh;
+  int ret = -1;
+  if (ResolveServer(&server) == 0) {
+    ret = DownloadSourceTable(&server, cached ? table : nullptr, &fresh);
+  }
+#if defined(WIN32) || defined(_WIN32)
+  WSACleanup();
+#endif  // defined(WIN32) || defined(_WIN32)
+  if (ret < 0) return -1;
+  if (ret == 0) {
+    *table = std::move(fresh);
+    if (!cache_path.empty()) table->Save(cache_path);
+  }
+  return 0;
+}
+
+int NtripClient::Dispatch(int max_items, int timeout_ms) {
+  SpscRing<QueuedData>* queue = delivery_queue_.get();
+  if (queue == nullptr) return 0;
+  QueuedData data;
+  int count = 0;
+  while (count < max_items) {
+    if (!queue->TryPop(&data)) {
+      if (count > 0 || timeout_ms <= 0) break;
+      // Sleep until the network thread queues something.
+      std::unique_lock<std::mutex> lock(delivery_mutex_);
+      consumer_waiting_.store(true);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      delivery_cv_.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+          [&] () -> bool {
+            return (queue->size() > 0) ||
+                (delivery_options_.dispatch_thread && !dispatching_.load());
+          });
+      consumer_waiting_.store(false);
+      timeout_ms = 0;
+      continue;
+    }
+    ++count;
+    // A blocked network thread can go on.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (producer_waiting_.load()) {
+      std::lock_guard<std::mutex> lock(delivery_mutex_);
+      delivery_cv_.notify_all();
+    }
+    char const* bytes = data.buffer.data() + data.offset;
+    if (frame_callback_) {
+      Rtcm3FrameView frame;
+      frame.data = bytes;
+      frame.size = data.size;
+      frame.message_type = data.message_type;
+      frame.receive_ns = data.receive_ns;
+      frame_callback_(frame);
+    } else {
+      callback_(bytes, data.size);
+    }
+  }
+  delivery_delivered_.fetch_add(count);
+  return count;
+}
+
+DeliveryStatistics NtripClient::delivery_statistics(void) const {
+  DeliveryStatistics statistics;
+  if (delivery_queue_ != nullptr) statistics.depth = delivery_queue_->size();
+  statistics.peak_depth = delivery_peak_.load();
+  statistics.delivered = delivery_delivered_.load();
+  statistics.dropped = delivery_dropped_.load();
+  statistics.blocked_ns = delivery_blocked_ns_.load();
+  return statistics;
 }
 
 //
@@ -237,57 +328,887 @@ void NtripClient::Stop(void) {
 //
 
 void NtripClient::ThreadHandler(void) {
-  service_is_running_.store(true);
+  printf("NtripClient service running...\r\n");
+  std::minstd_rand random(static_cast<uint32_t>(NowMs()));
+  int delay_ms = 0;
+  while (true) {
+    int64_t session_begin = NowMs();
+    if (!ReceiveLoop()) break;
+    int endpoint = active_.endpoint;
+    CloseLink(&active_);
+    if (station_changed_) {
+      station_changed_ = false;
+      if (Connect(&active_, endpoint) == 0) continue;
+    }
+    if (standby_.state == kLinkStreaming) {
+      Failover();
+      continue;
+    }
+    CloseLink(&standby_);
+    if (!auto_reconnect_) break;
+    // A caster restart is retried at once, a caster that keeps dropping
+    // the connection is retried with an exponential, jittered backoff.
+    // While it is down the endpoints are tried in order.
+    if (NowMs()-session_begin >= kStableSessionMs) delay_ms = 0;
+    bool connected = false;
+    while (service_is_running_.load()) {
+      if (delay_ms > 0) {
+        int wait_ms = delay_ms/2 + static_cast<int>(random() % (delay_ms/2+1));
+        printf("Reconnect to NtripCaster in %d ms\r\n", wait_ms);
+        if (!WaitForStop(wait_ms)) break;
+      }
+      connected = (Connect(&active_, endpoint) == 0);
+      delay_ms = (delay_ms == 0) ? reconnect_initial_ms_ :
+          std::min(delay_ms*2, reconnect_max_ms_);
+      if (connected) break;
+      endpoint = (endpoint+1) % static_cast<int>(endpoints_.size());
+    }
+    if (!connected) break;
+    active_endpoint_.store(active_.endpoint);
+    reconnect_count_.fetch_add(1);
+  }
+  CloseLink(&active_);
+  CloseLink(&standby_);
+  printf("NtripClient service done.\r\n");
+  service_is_running_.store(false);
+}
+
+bool NtripClient::ReceiveLoop(void) {
   int ret;
-  std::unique_ptr<char[]> buffer(
-      new char[kBufferSize], std::default_delete<char[]>());
+  int receive_timeout_cnt = kReceiveTimeoutPeriod;
+  active_.last_data_ms = NowMs();
+  int size = TakeReplyData(&active_);
+  if (size > 0) Deliver(size);
+#if defined(__linux__)
+  bool standby_enabled = endpoints_.size() > 1;
+  // Sleep until data arrives, the GGA report is due, the standby needs
+  // care or Stop() is called.
+  int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  struct itimerspec report_period;
+  memset(&report_period, 0, sizeof(report_period));
+  report_period.it_interval.tv_sec = (report_interval_ > 0) ?
+      report_interval_ : 1;
+  report_period.it_value = report_period.it_interval;
+  timerfd_settime(timer_fd, 0, &report_period, nullptr);
+  struct pollfd fds[4];
+  fds[1].fd = timer_fd;
+  fds[2].fd = wake_fd_;
+  for (auto& pfd : fds) pfd.events = POLLIN;
+  while (service_is_running_.load()) {
+    int64_t now = NowMs();
+    int timeout = -1;
+    if (standby_enabled) {
+      MaintainStandby(now);
+      int64_t next = standby_retry_ms_;
+      if (standby_.state == kLinkStreaming) {
+        // Switch as soon as the active stream misses its cadence while
+        // the standby still gets data.
+        next = active_.last_data_ms + StallTimeoutMs();
+        if ((now >= next) &&
+            (standby_.last_data_ms > active_.last_data_ms)) {
+          Failover();
+          receive_timeout_cnt = kReceiveTimeoutPeriod;
+          continue;
+        }
+      } else if (standby_.state != kLinkIdle) {
+        next = standby_.deadline_ms;
+      }
+      timeout = static_cast<int>(std::max<int64_t>(next-now, 10));
+    }
+    // Stream data that came with a reply is already here.
+    bool active_pending = !active_.reply.empty();
+    bool standby_pending = (standby_.state == kLinkStreaming) &&
+        !standby_.reply.empty();
+    if (active_pending || standby_pending) timeout = 0;
+    int nfds = 3;
+    fds[0].fd = active_.fd;
+    if (IsValidSocket(standby_.fd)) {
+      fds[3].fd = standby_.fd;
+      fds[3].events = (standby_.state == kLinkConnecting) ? POLLOUT : POLLIN;
+      nfds = 4;
+    }
+    ret = poll(fds, nfds, timeout);
+    if (ret < 0) {
+      if (errno == EINTR) continue;
+      printf("Poll error, errno=%d\r\n", errno);
+      break;
+    }
+    now = NowMs();
+    if (fds[2].revents != 0) break;
+    if ((fds[0].revents != 0) || active_pending) {
+      ret = Receive(&active_);
+      if (ret == 0) {
+        printf("Remote socket close!!!\r\n");
+        break;
+      } else if (ret < 0) {
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+          printf("Remote socket error, errno=%d\r\n", errno);
+          break;
+        }
+      } else {
+        receive_timeout_cnt = kReceiveTimeoutPeriod;
+        int64_t gap = now - active_.last_data_ms;
+        if (gap >= kBurstGapMs) {
+          epoch_interval_ms_ = (epoch_interval_ms_ == 0) ? gap :
+              (epoch_interval_ms_*7 + gap) / 8;
+        }
+        active_.last_data_ms = now;
+        Deliver(ret);
+      }
+    }
+    if ((nfds == 4) && ((fds[3].revents != 0) || standby_pending)) {
+      if (standby_.state == kLinkStreaming) {
+        ret = Receive(&standby_);
+        if ((ret == 0) || ((ret < 0) && !WouldBlock())) {
+          printf("Standby NtripCaster[%s] closed\r\n",
+              endpoints_[standby_.endpoint].config.ip.c_str());
+          DropStandby(now);
+        } else if (ret > 0) {
+          standby_.last_data_ms = now;
+          HoldStandbyData(ret);
+        }
+      } else {
+        ret = AdvanceLogin(&standby_);
+        if (ret > 0) {
+          standby_delay_ms_ = 0;
+          HoldStandbyData(TakeReplyData(&standby_));
+        } else if (ret < 0) {
+          DropStandby(now);
+        }
+      }
+    }
+    if (fds[1].revents != 0) {
+      uint64_t expirations;
+      if (read(timer_fd, &expirations, sizeof(expirations)) < 0) ;
+      if (receive_timeout_cnt-- <= 0) break;
+      SendGga(active_.fd);
+      if (standby_.state == kLinkStreaming) SendGga(standby_.fd);
+      if (station_table_ && (active_.endpoint == 0) && SelectStation()) {
+        station_changed_ = true;
+        break;
+      }
+    }
+  }
+  close(timer_fd);
+#else
   auto tp_beg = std::chrono::steady_clock::now();
   auto tp_end = tp_beg;
   int intv_ms = report_interval_ * 1000;
-  int receive_timeout_cnt = kReceiveTimeoutPeriod;
-  printf("NtripClient service running...\r\n");
   while (service_is_running_.load()) {
-    ret = recv(socket_fd_, buffer.get(), kBufferSize, 0);
+    int room = active_.buffer_size-active_.end;
+    ret = Receive(&active_);
     if (ret == 0) {
       printf("Remote socket close!!!\r\n");
       break;
     } else if (ret < 0) {
-      if ((errno != 0) && (errno != EAGAIN) &&
-          (errno != EWOULDBLOCK) && (errno != EINTR)) {
+      if (!WouldBlock()) {
         printf("Remote socket error, errno=%d\r\n", errno);
         break;
       }
     } else {
       receive_timeout_cnt = kReceiveTimeoutPeriod;
-      callback_(buffer.get(), ret);
-      if (ret == kBufferSize) continue;
+      Deliver(ret);
+      if (active_.received == room) continue;
     }
     tp_end = std::chrono::steady_clock::now();
     if (std::chrono::duration_cast<std::chrono::milliseconds>(
         tp_end-tp_beg).count() >= intv_ms) {
       if (receive_timeout_cnt-- <= 0) break;
       tp_beg = std::chrono::steady_clock::now();
-      if (!gga_is_update_.load()) {
-        GGAFrameGenerate(latitude_, longitude_, 10.0, &gga_buffer_);
+      SendGga(active_.fd);
+      if (station_table_ && SelectStation()) {
+        station_changed_ = true;
+        break;
       }
-      send(socket_fd_, gga_buffer_.c_str(), gga_buffer_.size(), 0);
     }
     std::this_thread::sleep_for(std::chrono::milliseconds(10));
   }
+#endif  // defined(__linux__)
+  return service_is_running_.load();
+}
+
+int NtripClient::ResolveServer(EndpointState* endpoint) {
+  int64_t now = NowMs();
+  if ((endpoint->addr_len > 0) && (endpoint->resolved_ms > 0) &&
+      (now-endpoint->resolved_ms < kResolveTtlMs)) {
+    return 0;
+  }
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_protocol = IPPROTO_TCP;
+  struct addrinfo* result = nullptr;
+  std::string port = std::to_string(endpoint->config.port);
+  int ret = getaddrinfo(endpoint->config.ip.c_str(), port.c_str(),
+      &hints, &result);
+  if ((ret != 0) || (result == nullptr)) {
+    printf("Resolve NtripCaster[%s] failed, ret = %d\r\n",
+        endpoint->config.ip.c_str(), ret);
+    // Keep using the last known address while the resolver is down.
+    return (endpoint->addr_len > 0) ? 0 : -1;
+  }
+  memcpy(&endpoint->addr, result->ai_addr, result->ai_addrlen);
+  endpoint->addr_len = static_cast<int>(result->ai_addrlen);
+  endpoint->resolved_ms = now;
+  freeaddrinfo(result);
+  return 0;
+}
+
+int NtripClient::Connect(Link* link, int endpoint) {
+  if (StartConnect(link, endpoint) != 0) return -1;
+  while (true) {
+    int16_t events = (link->state == kLinkConnecting) ? POLLOUT : POLLIN;
+    if (WaitSocket(link->fd, events, link->deadline_ms) <= 0) {
+      CasterEndpoint const& config = endpoints_[endpoint].config;
+      printf("NtripCaster[%s:%d %s %s %s] access failed!!!\r\n",
+          config.ip.c_str(), config.port, config.user.c_str(),
+          config.passwd.c_str(), config.mountpoint.c_str());
+      endpoints_[endpoint].resolved_ms = 0;
+      CloseLink(link);
+      return -1;
+    }
+    int ret = AdvanceLogin(link);
+    if (ret != 0) return (ret > 0) ? 0 : -1;
+  }
+}
+
+int NtripClient::StartConnect(Link* link, int endpoint) {
+  CloseLink(link);
+  link->endpoint = endpoint;
+  EndpointState& state = endpoints_[endpoint];
+  if (ResolveServer(&state) != 0) return -1;
+  if (!link->buffer) {
+    link->buffer_size = frame_callback_ ? kFrameBufferSize : kBufferSize;
+    link->buffer = BufferPool::Instance(link->buffer_size)->Allocate();
+  }
+  link->fd = socket(state.addr.ss_family, SOCK_STREAM, IPPROTO_TCP);
+  if (!IsValidSocket(link->fd)) {
+    printf("Create socket failed, errno = -%d\r\n", errno);
+    return -1;
+  }
+  link->deadline_ms = NowMs() + connect_timeout_ms_;
+  if (SetNonBlocking(link->fd) != 0) {
+    CloseLink(link);
+    return -1;
+  }
+  if (connect(link->fd, reinterpret_cast<struct sockaddr *>(&state.addr),
+      state.addr_len) == 0) {
+    return SendRequest(link);
+  }
+  if (!ConnectInProgress()) {
+    printf("Connect to NtripCaster[%s:%d] failed, errno = -%d\r\n",
+        state.config.ip.c_str(), state.config.port, errno);
+    // Look the caster up again, it may have moved.
+    state.resolved_ms = 0;
+    CloseLink(link);
+    return -1;
+  }
+  link->state = kLinkConnecting;
+  return 0;
+}
+
+int NtripClient::SendRequest(Link* link) {
+  CasterEndpoint const& config = endpoints_[link->endpoint].config;
+  // Ntrip connection authentication.
+  std::string user_passwd = config.user + ":" + config.passwd;
+  std::string user_passwd_base64;
+  // Generate base64 encoding of username and password.
+  Base64Encode(user_passwd, &user_passwd_base64);
+  // Generate request data format of ntrip.
+  char* request = link->buffer.data();
+  int ret = snprintf(request, link->buffer_size-1,
+      "GET /%s HTTP/1.1\r\n"
+      "Host: %s:%d\r\n"
+      "Ntrip-Version: Ntrip/2.0\r\n"
+      "User-Agent: %s\r\n"
+      "Authorization: Basic %s\r\n"
+      "\r\n",
+      config.mountpoint.c_str(), config.ip.c_str(), config.port,
+      kClientAgent, user_passwd_base64.c_str());
+  if (send(link->fd, request, ret, 0) != ret) {
+    printf("Send request failed!!!\r\n");
+    CloseLink(link);
+    return -1;
+  }
+  link->state = kLinkLoggingIn;
+  return 0;
+}
+
+int NtripClient::AdvanceLogin(Link* link) {
+  EndpointState& state = endpoints_[link->endpoint];
+  auto fail = [&] () -> int {
+    state.resolved_ms = 0;
+    CloseLink(link);
+    return -1;
+  };
+  if (link->state == kLinkConnecting) {
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if ((getsockopt(link->fd, SOL_SOCKET, SO_ERROR,
+            reinterpret_cast<char*>(&error), &len) != 0) || (error != 0)) {
+      printf("Connect to NtripCaster[%s:%d] failed, error = %d\r\n",
+          state.config.ip.c_str(), state.config.port, error);
+      return fail();
+    }
+    return (SendRequest(link) == 0) ? 0 : -1;
+  }
+  // Waitting for the caster reply.
+  int ret = recv(link->fd, link->buffer.data(), link->buffer_size, 0);
+  if (ret == 0) {
+    printf("Remote socket close!!!\r\n");
+    return fail();
+  } else if (ret < 0) {
+    if (WouldBlock()) return 0;
+    printf("Remote socket error, errno=%d\r\n", errno);
+    return fail();
+  }
+  link->reply.append(link->buffer.data(), ret);
+  size_t line_end = link->reply.find("\r\n");
+  if (line_end == std::string::npos) {
+    if (link->reply.size() <= kMaxReplyHeader) return 0;
+    printf("Caster reply is too long\r\n");
+    return fail();
+  }
+  std::string status = link->reply.substr(0, line_end);
+  bool http = (status.compare(0, 5, "HTTP/") == 0);
+  size_t space = status.find(' ');
+  if (http ? ((space == std::string::npos) ||
+              (atoi(status.c_str()+space+1) != 200)) :
+      (status.compare(0, 10, "ICY 200 OK") != 0)) {
+    printf("Request result: %s\r\n", status.c_str());
+    return fail();
+  }
+  size_t body = ReplyBodyOffset(link->reply);
+  if (body == std::string::npos) {
+    if (!http) {
+      body = line_end + 2;
+    } else if (link->reply.size() <= kMaxReplyHeader) {
+      return 0;
+    } else {
+      printf("Caster reply header is too long\r\n");
+      return fail();
+    }
+  }
+  if (http) {
+    // NTRIP 2.0 casters send the stream in HTTP chunks.
+    std::string encoding = HeaderValue(link->reply.substr(0, body),
+        "Transfer-Encoding:");
+    for (auto& c : encoding) c = tolower(static_cast<unsigned char>(c));
+    link->chunked = (encoding.find("chunked") != std::string::npos);
+  }
+  link->reply.erase(0, body);
+  if (SendGga(link->fd) < 0) {
+    printf("Send gpgga data fail\r\n");
+    return fail();
+  }
+  // TCP socket keepalive.
+#if defined(ENABLE_TCP_KEEPALIVE)
+  int keepalive = 1;  // Enable keepalive attributes.
+  int keepidle = 30;  // Time out for starting detection.
+  int keepinterval = 5;  // Time interval for sending packets during detection.
+  int keepcount = 3;  // Max times for sending packets during detection.
+  setsockopt(link->fd, SOL_SOCKET, SO_KEEPALIVE,
+      &keepalive, sizeof(keepalive));
+  setsockopt(link->fd, SOL_TCP, TCP_KEEPIDLE, &keepidle, sizeof(keepidle));
+  setsockopt(link->fd, SOL_TCP, TCP_KEEPINTVL,
+      &keepinterval, sizeof(keepinterval));
+  setsockopt(link->fd, SOL_TCP, TCP_KEEPCNT, &keepcount, sizeof(keepcount));
+#endif  // defined(ENABLE_TCP_KEEPALIVE)
+  link->state = kLinkStreaming;
+  link->last_data_ms = NowMs();
+  return 1;
+}
+
+void NtripClient::CloseLink(Link* link) {
+  if (IsValidSocket(link->fd)) CloseSocket(link->fd);
+  // Leave a buffer that queued data points into to the consumer.
+  if (link->buffer.use_count() > 1) link->buffer = PooledBuffer();
 #if defined(WIN32) || defined(_WIN32)
-  if (socket_fd_ != INVALID_SOCKET) {
-    closesocket(socket_fd_);
-    WSACleanup();
-    socket_fd_ = INVALID_SOCKET;
+  link->fd = INVALID_SOCKET;
+#else
+  link->fd = -1;
+#endif  // defined(WIN32) || defined(_WIN32)
+  link->state = kLinkIdle;
+  link->reply.clear();
+  link->chunked = false;
+  link->chunks.Reset();
+  link->begin = link->end = link->scanned = 0;
+  link->held.clear();
+  link->framer.Reset();
+}
+
+int NtripClient::TakeReplyData(Link* link) {
+  if (link->reply.empty()) return 0;
+  // A framing error shows up again with the next receive.
+  return std::max(Receive(link), 0);
+}
+
+int NtripClient::Receive(Link* link) {
+  int ret;
+  if (!link->reply.empty()) {
+    // The reply may carry more than the buffer takes at once, the chunk
+    // decoder must still see every byte in order.
+    ret = std::min(static_cast<int>(link->reply.size()),
+        link->buffer_size-link->end);
+    memcpy(link->buffer.data()+link->end, link->reply.data(), ret);
+    link->reply.erase(0, ret);
+  } else {
+    ret = recv(link->fd, link->buffer.data()+link->end,
+        link->buffer_size-link->end, 0);
+  }
+  link->received = ret;
+  if (ret <= 0 || !link->chunked) return ret;
+  // Chunk framing is removed in place, the payload stays in the buffer.
+  ret = link->chunks.Decode(link->buffer.data()+link->end, ret);
+  if (ret < 0) {
+    printf("Chunked stream error\r\n");
+    return 0;
   }
+  if (ret == 0) {
+    if (link->chunks.finished()) return 0;
+    SetWouldBlock();
+    return -1;
+  }
+  return ret;
+}
+
+int NtripClient::WaitSocket(Socket fd, int16_t events, int64_t deadline_ms,
+    bool interruptible) {
+  while (!interruptible || service_is_running_.load()) {
+    int64_t remain = deadline_ms - NowMs();
+    if (remain <= 0) return 0;
+#if defined(__linux__)
+    struct pollfd fds[2];
+    fds[0].fd = fd;
+    fds[0].events = events;
+    fds[1].fd = interruptible ? wake_fd_ : -1;
+    fds[1].events = POLLIN;
+    fds[1].revents = 0;
+    int ret = poll(fds, 2, static_cast<int>(remain));
+    if (ret < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    if (fds[1].revents != 0) return -1;
+    if (fds[0].revents != 0) return 1;
 #else
-  if (socket_fd_ > 0) {
-    close(socket_fd_);
-    socket_fd_ = -1;
+    // No wakeup handle here, check for Stop() every 100ms.
+    WSAPOLLFD pfd;
+    pfd.fd = fd;
+    pfd.events = events;
+    pfd.revents = 0;
+    int ret = WSAPoll(&pfd, 1, static_cast<int>(std::min<int64_t>(remain, 100)));
+    if (ret < 0) return -1;
+    if (ret > 0) return 1;
+#endif  // defined(__linux__)
   }
-#endif  // defined(WIN32) | defined(_WIN32)
-  printf("NtripClient service done.\r\n");
-  service_is_running_.store(false);
+  return -1;
+}
+
+bool NtripClient::WaitForStop(int timeout_ms) {
+#if defined(__linux__)
+  struct pollfd pfd;
+  pfd.fd = wake_fd_;
+  pfd.events = POLLIN;
+  int64_t deadline = NowMs() + timeout_ms;
+  int64_t remain = timeout_ms;
+  while ((remain > 0) && service_is_running_.load()) {
+    if (poll(&pfd, 1, static_cast<int>(remain)) > 0) break;
+    remain = deadline - NowMs();
+  }
+#else
+  int64_t deadline = NowMs() + timeout_ms;
+  while ((NowMs() < deadline) && service_is_running_.load()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+#endif  // defined(__linux__)
+  return service_is_running_.load();
+}
+
+void NtripClient::Deliver(int size) {
+  Link& link = active_;
+  if (!frame_callback_) {
+    if (delivery_queue_ == nullptr) {
+      callback_(link.buffer.data(), size);
+      return;
+    }
+    QueuedData data;
+    data.buffer = link.buffer;
+    data.size = size;
+    data.receive_ns = NowNs();
+    Enqueue(std::move(data));
+    // The consumer holds the buffer now, receive into another one.
+    if (link.buffer.use_count() > 1) {
+      link.buffer = BufferPool::Instance(link.buffer_size)->Allocate();
+    }
+    return;
+  }
+  // In frame mode the stream is read with large receives into one buffer
+  // and frames are handed out in place. Only a frame cut by the end of
+  // the buffer is moved back to the front.
+  link.end += size;
+  int64_t receive_ns = NowNs();
+  bool dedup = NowMs() < dedup_until_ms_;
+  uint64_t discarded = link.framer.discarded_bytes();
+  link.begin += link.framer.Scan(link.buffer.data()+link.begin,
+      link.end-link.begin, [&] (char const* data, int length) -> void {
+        DeliverFrame(data, length, receive_ns, dedup);
+      });
+  if (link.framer.discarded_bytes() != discarded) {
+    discarded_bytes_.fetch_add(link.framer.discarded_bytes()-discarded);
+  }
+  // Queued frames may still point into the buffer, it is then only
+  // appended to and replaced once it is full.
+  bool shared = link.buffer.use_count() > 1;
+  if (link.begin == link.end && !shared) {
+    link.begin = link.end = 0;
+  } else if (link.buffer_size-link.end < kRtcm3MaxFrameLength) {
+    if (shared) {
+      PooledBuffer buffer = BufferPool::Instance(link.buffer_size)->Allocate();
+      memcpy(buffer.data(), link.buffer.data()+link.begin,
+          link.end-link.begin);
+      link.buffer = buffer;
+    } else {
+      memmove(link.buffer.data(), link.buffer.data()+link.begin,
+          link.end-link.begin);
+    }
+    link.end -= link.begin;
+    link.begin = 0;
+  }
+}
+
+void NtripClient::DeliverFrame(char const* data, int size,
+    int64_t receive_ns, bool dedup) {
+  if (!recent_frames_.empty()) {
+    uint64_t key = FrameKey(data, size);
+    if (dedup && (std::find(recent_frames_.begin(), recent_frames_.end(),
+        key) != recent_frames_.end())) {
+      return;
+    }
+    recent_frames_[recent_next_] = key;
+    recent_next_ = (recent_next_+1) % recent_frames_.size();
+  }
+  if (delivery_queue_ != nullptr) {
+    QueuedData queued;
+    queued.buffer = active_.buffer;
+    queued.offset = static_cast<int>(data-active_.buffer.data());
+    queued.size = size;
+    queued.message_type = Rtcm3MessageType(data);
+    queued.receive_ns = receive_ns;
+    Enqueue(std::move(queued));
+    return;
+  }
+  Rtcm3FrameView frame;
+  frame.data = data;
+  frame.size = size;
+  frame.message_type = Rtcm3MessageType(data);
+  frame.receive_ns = receive_ns;
+  frame_callback_(frame);
+}
+
+bool NtripClient::Enqueue(QueuedData&& data) {
+  SpscRing<QueuedData>& queue = *delivery_queue_;
+  bool queued = queue.TryPush(std::move(data));
+  if (!queued && delivery_options_.policy == DeliveryPolicy::kBlock) {
+    int64_t begin = NowNs();
+    std::unique_lock<std::mutex> lock(delivery_mutex_);
+    producer_waiting_.store(true);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while (!(queued = queue.TryPush(std::move(data))) &&
+        service_is_running_.load()) {
+      delivery_cv_.wait_for(lock, std::chrono::milliseconds(10));
+    }
+    producer_waiting_.store(false);
+    delivery_blocked_ns_.fetch_add(NowNs()-begin);
+  }
+  if (!queued) {
+    delivery_dropped_.fetch_add(1);
+    return false;
+  }
+  size_t depth = queue.size();
+  if (depth > delivery_peak_.load(std::memory_order_relaxed)) {
+    delivery_peak_.store(depth, std::memory_order_relaxed);
+  }
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (consumer_waiting_.load()) {
+    std::lock_guard<std::mutex> lock(delivery_mutex_);
+    delivery_cv_.notify_all();
+  }
+  return true;
+}
+
+void NtripClient::DispatchHandler(void) {
+  while (dispatching_.load()) Dispatch(64, 100);
+}
+
+void NtripClient::HoldStandbyData(int size) {
+  Link& link = standby_;
+  // Raw streams cannot be merged, the standby data is only drained.
+  if (!frame_callback_) return;
+  link.end += size;
+  int64_t receive_ns = NowNs();
+  link.scanned += link.framer.Scan(link.buffer.data()+link.scanned,
+      link.end-link.scanned, [&] (char const* data, int length) -> void {
+        HeldFrame held;
+        held.offset = static_cast<int>(data-link.buffer.data());
+        held.size = length;
+        held.receive_ns = receive_ns;
+        link.held.push_back(held);
+      });
+  // Frames older than two stall timeouts were delivered by the active
+  // stream or are too old to help.
+  int64_t oldest = receive_ns - StallTimeoutMs()*2*1000000;
+  while (!link.held.empty() && (link.held.front().receive_ns < oldest)) {
+    link.held.pop_front();
+  }
+  link.begin = link.held.empty() ? link.scanned : link.held.front().offset;
+  while ((link.buffer_size-link.end+link.begin < kRtcm3MaxFrameLength) &&
+      !link.held.empty()) {
+    link.held.pop_front();
+    link.begin = link.held.empty() ? link.scanned : link.held.front().offset;
+  }
+  if (link.buffer_size-link.end < kRtcm3MaxFrameLength) {
+    int shift = link.begin;
+    memmove(link.buffer.data(), link.buffer.data()+shift, link.end-shift);
+    link.end -= shift;
+    link.scanned -= shift;
+    link.begin = 0;
+    for (auto& held : link.held) held.offset -= shift;
+  }
+}
+
+void NtripClient::MaintainStandby(int64_t now_ms) {
+  if (standby_.state == kLinkIdle) {
+    if (now_ms < standby_retry_ms_) return;
+    int count = static_cast<int>(endpoints_.size());
+    int endpoint = standby_next_ % count;
+    if (endpoint == active_.endpoint) endpoint = (endpoint+1) % count;
+    if (StartConnect(&standby_, endpoint) != 0) DropStandby(now_ms);
+  } else if (standby_.state != kLinkStreaming) {
+    if (now_ms >= standby_.deadline_ms) {
+      printf("Standby NtripCaster[%s] login timeout\r\n",
+          endpoints_[standby_.endpoint].config.ip.c_str());
+      endpoints_[standby_.endpoint].resolved_ms = 0;
+      DropStandby(now_ms);
+    }
+  } else if (now_ms-standby_.last_data_ms >
+      kReceiveTimeoutPeriod*std::max(report_interval_, 1)*1000) {
+    printf("Standby NtripCaster[%s] receive timeout\r\n",
+        endpoints_[standby_.endpoint].config.ip.c_str());
+    DropStandby(now_ms);
+  }
+}
+
+void NtripClient::DropStandby(int64_t now_ms) {
+  int count = static_cast<int>(endpoints_.size());
+  if (standby_.endpoint >= 0) standby_next_ = (standby_.endpoint+1) % count;
+  CloseLink(&standby_);
+  standby_delay_ms_ = (standby_delay_ms_ == 0) ? reconnect_initial_ms_ :
+      std::min(standby_delay_ms_*2, reconnect_max_ms_);
+  standby_retry_ms_ = now_ms + standby_delay_ms_;
+}
+
+void NtripClient::Failover(void) {
+  printf("Switch from NtripCaster[%s] to NtripCaster[%s]\r\n",
+      endpoints_[active_.endpoint].config.ip.c_str(),
+      endpoints_[standby_.endpoint].config.ip.c_str());
+  std::swap(active_, standby_);
+  int64_t now = NowMs();
+  if (frame_callback_) {
+    // Pass on what the standby got while the old stream stalled, minus
+    // the frames the old stream did deliver. The overlap is dropped for
+    // a while after the switch as well.
+    for (auto const& held : active_.held) {
+      DeliverFrame(active_.buffer.data()+held.offset, held.size,
+          held.receive_ns, true);
+    }
+    active_.held.clear();
+    active_.begin = active_.scanned;
+    active_.scanned = 0;
+    dedup_until_ms_ = now + StallTimeoutMs()*2;
+  } else {
+    active_.begin = active_.end = 0;
+  }
+  active_endpoint_.store(active_.endpoint);
+  failover_count_.fetch_add(1);
+  // The stalled caster is tried again as the standby after the others.
+  int count = static_cast<int>(endpoints_.size());
+  standby_next_ = (standby_.endpoint+1) % count;
+  CloseLink(&standby_);
+  standby_delay_ms_ = 0;
+  standby_retry_ms_ = now;
+}
+
+int NtripClient::DownloadSourceTable(EndpointState* server,
+    SourceTableSnapshot const* cached, SourceTableSnapshot* table) {
+  CasterEndpoint const& config = server->config;
+  Socket fd = socket(server->addr.ss_family, SOCK_STREAM, IPPROTO_TCP);
+  if (!IsValidSocket(fd)) {
+    printf("Create socket failed, errno = -%d\r\n", errno);
+    return -1;
+  }
+  auto fail = [fd] () -> int {
+    CloseSocket(fd);
+    return -1;
+  };
+  int64_t deadline = NowMs() + connect_timeout_ms_;
+  if (SetNonBlocking(fd) != 0) return fail();
+  if (connect(fd, reinterpret_cast<struct sockaddr *>(&server->addr),
+      server->addr_len) != 0) {
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (!ConnectInProgress() ||
+        (WaitSocket(fd, POLLOUT, deadline, false) <= 0) ||
+        (getsockopt(fd, SOL_SOCKET, SO_ERROR,
+            reinterpret_cast<char*>(&error), &len) != 0) ||
+        (error != 0)) {
+      printf("Connect to NtripCaster[%s:%d] failed\r\n",
+          config.ip.c_str(), config.port);
+      return fail();
+    }
+  }
+  std::string request = "GET / HTTP/1.1\r\n"
+      "Host: " + config.ip + ":" + std::to_string(config.port) + "\r\n"
+      "Ntrip-Version: Ntrip/2.0\r\n"
+      "User-Agent: " + std::string(kClientAgent) + "\r\n";
+  if (!config.user.empty()) {
+    std::string user_passwd_base64;
+    Base64Encode(config.user + ":" + config.passwd, &user_passwd_base64);
+    request += "Authorization: Basic " + user_passwd_base64 + "\r\n";
+  }
+  // Casters that know the validators answer 304 for an unchanged table.
+  if (cached != nullptr && !cached->etag().empty()) {
+    request += "If-None-Match: " + cached->etag() + "\r\n";
+  }
+  if (cached != nullptr && !cached->last_modified().empty()) {
+    request += "If-Modified-Since: " + cached->last_modified() + "\r\n";
+  }
+  request += "Connection: close\r\n\r\n";
+  int size = static_cast<int>(request.size());
+  if (send(fd, request.data(), size, 0) != size) {
+    printf("Send request failed!!!\r\n");
+    return fail();
+  }
+  // The table is parsed while it arrives.
+  PooledBuffer buffer = BufferPool::Instance(kFrameBufferSize)->Allocate();
+  std::string header;
+  bool in_body = false;
+  bool chunked = false;
+  HttpChunkDecoder chunks;
+  int64_t content_length = -1;
+  int64_t received = 0;
+  while (!table->complete() && !chunks.finished() &&
+      (content_length < 0 || received < content_length)) {
+    if (WaitSocket(fd, POLLIN, NowMs()+connect_timeout_ms_, false) <= 0) {
+      printf("Receive sourcetable timeout\r\n");
+      return fail();
+    }
+    int ret = recv(fd, buffer.data(), kFrameBufferSize, 0);
+    if (ret == 0) break;
+    if (ret < 0) {
+      if (WouldBlock()) continue;
+      printf("Remote socket error, errno=%d\r\n", errno);
+      return fail();
+    }
+    if (in_body) {
+      received += ret;
+      if (chunked) ret = chunks.Decode(buffer.data(), ret);
+      if (ret < 0) {
+        printf("Chunked sourcetable error\r\n");
+        return fail();
+      }
+      table->Feed(buffer.data(), ret);
+      continue;
+    }
+    header.append(buffer.data(), ret);
+    size_t end = header.find("\r\n\r\n");
+    if (end == std::string::npos) continue;
+    std::string status = header.substr(0, header.find("\r\n"));
+    if (status.find(" 304") != std::string::npos) {
+      CloseSocket(fd);
+      return 1;
+    }
+    if ((status.compare(0, 15, "SOURCETABLE 200") != 0) &&
+        ((status.compare(0, 5, "HTTP/") != 0) ||
+         (status.find(" 200") == std::string::npos))) {
+      printf("Request result: %s\r\n", status.c_str());
+      return fail();
+    }
+    std::string head = header.substr(0, end+2);
+    std::string encoding = HeaderValue(head, "Transfer-Encoding:");
+    for (auto& c : encoding) c = tolower(static_cast<unsigned char>(c));
+    chunked = (encoding.find("chunked") != std::string::npos);
+    std::string length = HeaderValue(head, "Content-Length:");
+    if (!length.empty() && !chunked) content_length = atoll(length.c_str());
+    table->set_validators(HeaderValue(head, "ETag:"),
+        HeaderValue(head, "Last-Modified:"));
+    in_body = true;
+    int size = static_cast<int>(header.size()-end-4);
+    received = size;
+    if (chunked) size = chunks.Decode(&header[end+4], size);
+    if (size < 0) {
+      printf("Chunked sourcetable error\r\n");
+      return fail();
+    }
+    table->Feed(header.data()+end+4, size);
+    header.clear();
+  }
+  CloseSocket(fd);
+  table->Finish();
+  if (!table->complete() &&
+      (content_length < 0 || received < content_length)) {
+    printf("Sourcetable is incomplete\r\n");
+    return -1;
+  }
+  return 0;
+}
+
+bool NtripClient::SelectStation(void) {
+  double latitude;
+  double longitude;
+  RoverPosition(&latitude, &longitude);
+  double distance = 0.0;
+  int nearest = station_table_->Nearest(latitude, longitude, station_filter_,
+      &distance);
+  if (nearest < 0 || nearest == station_) return false;
+  auto const& stations = station_table_->stations();
+  if (station_ >= 0) {
+    // Stay unless the other station is clearly nearer, so the rover does
+    // not flip between two stations at the same distance.
+    StationRecord const& current = stations[station_];
+    if (CalculateDistance(latitude, longitude, current.latitude,
+        current.longitude) - distance < switch_margin_m_) {
+      return false;
+    }
+  }
+  std::string mountpoint = station_table_->Mountpoint(stations[nearest]);
+  printf("Select mountpoint %s, %.1f km away\r\n", mountpoint.c_str(),
+      distance/1000.0);
+  station_ = nearest;
+  endpoints_[0].config.mountpoint = mountpoint;
+  return true;
+}
+
+void NtripClient::RoverPosition(double* latitude, double* longitude) {
+  *latitude = latitude_;
+  *longitude = longitude_;
+  if (gga_is_update_.load()) {
+    ParsePositionFromGGA(gga_buffer_, latitude, longitude);
+  }
+}
+
+int64_t NtripClient::StallTimeoutMs(void) const {
+  if (stall_timeout_ms_ > 0) return stall_timeout_ms_;
+  if (epoch_interval_ms_ == 0) return kDefaultStallMs;
+  return std::max(kMinStallMs, epoch_interval_ms_ + epoch_interval_ms_/2);
+}
+
+int NtripClient::SendGga(Socket fd) {
+  if (!gga_is_update_.load()) {
+    GGAFrameGenerate(latitude_, longitude_, 10.0, &gga_buffer_);
+  }
+  return send(fd, gga_buffer_.c_str(), gga_buffer_.size(), 0);
 }
 
 }  // namespace libntrip
@@ -0,0 +1,523 @@
+// MIT License
+//
+// Copyright (c) 2021 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "ntrip/ntrip_client_pool.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>  // NOLINT.
+#include <functional>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "ntrip/memory_pool.h"
+#include "ntrip/ntrip_util.h"
+#include "cmake_definition.h.in"
+
+
+namespace libntrip {
+
+namespace {
+
+constexpr int kBufferSize = 4096;
+constexpr int kMaxEvents = 256;
+constexpr int kReceiveTimeoutPeriod = 3;  // GGA intervals without data.
+constexpr int64_t kHandshakeTimeoutMs = 3000;
+constexpr size_t kMaxResponseLength = 1024;
+constexpr uint64_t kWakeEvent = UINT64_MAX;
+
+enum class SessionState {
+  kConnecting,
+  kHandshaking,
+  kStreaming,
+};
+
+struct ClientSession {
+  int id = -1;
+  int fd = -1;
+  SessionState state = SessionState::kConnecting;
+  ClientSessionOptions options;
+  ClientCallback callback;
+  std::string response;  // Caster reply until it is accepted.
+  bool chunked = false;  // NTRIP 2.0 stream in HTTP chunks.
+  HttpChunkDecoder chunks;
+  int64_t deadline_ms = 0;  // End of the handshake or next GGA report.
+  int receive_timeout_cnt = kReceiveTimeoutPeriod;
+  bool gga_is_update = false;  // `options.gga` set by the user.
+};
+
+inline
+int64_t NowMilliseconds(void) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}  // namespace
+
+// One epoll thread and the sessions it owns. Sessions are only touched by
+// that thread, other threads post commands through an eventfd.
+class NtripClientPool::Worker {
+ public:
+  explicit Worker(NtripClientPool* pool) : pool_(pool) {}
+  Worker(Worker const&) = delete;
+  Worker& operator=(Worker const&) = delete;
+  ~Worker() { Stop(); }
+
+  bool Start(ThreadOptions const& options);
+  void Stop(void);
+  void Post(std::function<void(void)> command);
+
+  // Loop thread only.
+  void Open(int session_id, ClientSessionOptions const& options,
+      ClientCallback const& callback);
+  void Close(int session_id, bool notify);
+  ClientSession* Find(int session_id);
+
+ private:
+  void ThreadHandler(void);
+  void RunCommands(void);
+  void HandleEvent(ClientSession* session, uint32_t events);
+  void SendRequest(ClientSession* session);
+  void ReceiveResponse(ClientSession* session);
+  void ReceiveData(ClientSession* session);
+  // Strip the chunk framing if any and pass the stream data on.
+  void Deliver(ClientSession* session, char* data, int size);
+  void SendGga(ClientSession* session);
+  void SetDeadline(ClientSession* session, int64_t deadline_ms);
+  void CheckDeadlines(int64_t now);
+
+  NtripClientPool* pool_;
+  int epoll_fd_ = -1;
+  int event_fd_ = -1;
+  bool loop_exit_ = false;
+  std::mutex command_mutex_;
+  std::vector<std::function<void(void)>> commands_;
+  std::unordered_map<int, std::unique_ptr<ClientSession>> sessions_;
+  // (deadline, session id), stale entries are skipped when they expire.
+  std::priority_queue<std::pair<int64_t, int>,
+      std::vector<std::pair<int64_t, int>>,
+      std::greater<std::pair<int64_t, int>>> deadlines_;
+  PooledBuffer buffer_;
+  Thread thread_;
+};
+
+bool NtripClientPool::Worker::Start(ThreadOptions const& options) {
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (epoll_fd_ < 0 || event_fd_ < 0) {
+    printf("NtripClientPool: create epoll failed, errno = -%d\r\n", errno);
+    return false;
+  }
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.u64 = kWakeEvent;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, event_fd_, &ev);
+  buffer_ = BufferPool::Instance(kBufferSize)->Allocate();
+  loop_exit_ = false;
+  thread_.set_options(options);
+  thread_.set_default_name("ntrip_pool");
+  thread_.reset(&NtripClientPool::Worker::ThreadHandler, this);
+  return true;
+}
+
+void NtripClientPool::Worker::Stop(void) {
+  if (thread_.joinable()) {
+    Post([this] () { loop_exit_ = true; });
+    thread_.join();
+  }
+  for (auto& item : sessions_) {
+    if (item.second->fd >= 0) close(item.second->fd);
+  }
+  sessions_.clear();
+  deadlines_ = decltype(deadlines_)();
+  commands_.clear();
+  if (event_fd_ >= 0) close(event_fd_);
+  if (epoll_fd_ >= 0) close(epoll_fd_);
+  event_fd_ = -1;
+  epoll_fd_ = -1;
+}
+
+void NtripClientPool::Worker::Post(std::function<void(void)> command) {
+  {
+    std::lock_guard<std::mutex> lock(command_mutex_);
+    commands_.push_back(std::move(command));
+  }
+  uint64_t one = 1;
+  if (write(event_fd_, &one, sizeof(one)) != sizeof(one)) ;
+}
+
+void NtripClientPool::Worker::RunCommands(void) {
+  uint64_t count;
+  if (read(event_fd_, &count, sizeof(count)) != sizeof(count)) ;
+  std::vector<std::function<void(void)>> commands;
+  {
+    std::lock_guard<std::mutex> lock(command_mutex_);
+    commands.swap(commands_);
+  }
+  for (auto& command : commands) command();
+}
+
+void NtripClientPool::Worker::Open(int session_id,
+    ClientSessionOptions const& options, ClientCallback const& callback) {
+  std::unique_ptr<ClientSession> session(new ClientSession);
+  session->id = session_id;
+  session->options = options;
+  session->callback = callback;
+  session->gga_is_update = !options.gga.empty();
+  if (session->options.report_interval <= 0) {
+    session->options.report_interval = 1;
+  }
+  ClientSession* ptr = session.get();
+  sessions_[session_id] = std::move(session);
+  struct sockaddr_in server_addr;
+  memset(&server_addr, 0, sizeof(server_addr));
+  server_addr.sin_family = AF_INET;
+  server_addr.sin_port = htons(options.port);
+  server_addr.sin_addr.s_addr = inet_addr(options.ip.c_str());
+  ptr->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (ptr->fd < 0) {
+    printf("Create socket failed, errno = -%d\r\n", errno);
+    Close(session_id, true);
+    return;
+  }
+  int ret = connect(ptr->fd, reinterpret_cast<struct sockaddr*>(&server_addr),
+      sizeof(server_addr));
+  if (ret < 0 && errno != EINPROGRESS) {
+    printf("Connect to NtripCaster[%s:%d] failed, errno = -%d\r\n",
+        options.ip.c_str(), options.port, errno);
+    Close(session_id, true);
+    return;
+  }
+  struct epoll_event ev;
+  ev.events = EPOLLOUT;
+  ev.data.u64 = static_cast<uint64_t>(session_id);
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, ptr->fd, &ev);
+  SetDeadline(ptr, NowMilliseconds() + kHandshakeTimeoutMs);
+}
+
+void NtripClientPool::Worker::Close(int session_id, bool notify) {
+  auto it = sessions_.find(session_id);
+  if (it == sessions_.end()) return;
+  // Closing the fd also takes it out of the epoll set.
+  if (it->second->fd >= 0) close(it->second->fd);
+  sessions_.erase(it);
+  pool_->session_count_.fetch_sub(1);
+  if (notify) pool_->closed_callback_(session_id);
+}
+
+ClientSession* NtripClientPool::Worker::Find(int session_id) {
+  auto it = sessions_.find(session_id);
+  return (it == sessions_.end()) ? nullptr : it->second.get();
+}
+
+void NtripClientPool::Worker::ThreadHandler(void) {
+  struct epoll_event events[kMaxEvents];
+  while (!loop_exit_) {
+    int timeout = -1;
+    if (!deadlines_.empty()) {
+      int64_t wait = deadlines_.top().first - NowMilliseconds();
+      timeout = (wait > 0) ? static_cast<int>(wait) : 0;
+    }
+    int ret = epoll_wait(epoll_fd_, events, kMaxEvents, timeout);
+    if (ret < 0) {
+      if (errno == EINTR) continue;
+      printf("NtripClientPool: epoll error, errno = -%d\r\n", errno);
+      break;
+    }
+    for (int i = 0; i < ret; ++i) {
+      if (events[i].data.u64 == kWakeEvent) {
+        RunCommands();
+        if (loop_exit_) break;
+        continue;
+      }
+      // The session may have been closed by an earlier event.
+      ClientSession* session =
+          Find(static_cast<int>(events[i].data.u64));
+      if (session != nullptr) HandleEvent(session, events[i].events);
+    }
+    CheckDeadlines(NowMilliseconds());
+  }
+}
+
+void NtripClientPool::Worker::HandleEvent(ClientSession* session,
+    uint32_t events) {
+  switch (session->state) {
+    case SessionState::kConnecting: {
+      int error = 0;
+      socklen_t len = sizeof(error);
+      getsockopt(session->fd, SOL_SOCKET, SO_ERROR, &error, &len);
+      if (error != 0 || (events & (EPOLLERR | EPOLLHUP))) {
+        printf("Connect to NtripCaster[%s:%d] failed, errno = -%d\r\n",
+            session->options.ip.c_str(), session->options.port, error);
+        Close(session->id, true);
+        return;
+      }
+      SendRequest(session);
+      break;
+    }
+    case SessionState::kHandshaking:
+      ReceiveResponse(session);
+      break;
+    case SessionState::kStreaming:
+      ReceiveData(session);
+      break;
+  }
+}
+
+void NtripClientPool::Worker::SendRequest(ClientSession* session) {
+  std::string user_passwd_base64;
+  Base64Encode(session->options.user + ":" + session->options.passwd,
+      &user_passwd_base64);
+  int ret = snprintf(buffer_.data(), kBufferSize-1,
+      "GET /%s HTTP/1.1\r\n"
+      "User-Agent: %s\r\n"
+      "Authorization: Basic %s\r\n"
+      "\r\n",
+      session->options.mountpoint.c_str(), kClientAgent,
+      user_passwd_base64.c_str());
+  if (send(session->fd, buffer_.data(), ret, MSG_NOSIGNAL) != ret) {
+    printf("Send request failed!!!\r\n");
+    Close(session->id, true);
+    return;
+  }
+  session->state = SessionState::kHandshaking;
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.u64 = static_cast<uint64_t>(session->id);
+  epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, session->fd, &ev);
+}
+
+void NtripClientPool::Worker::ReceiveResponse(ClientSession* session) {
+  int ret = recv(session->fd, buffer_.data(), kBufferSize, 0);
+  if (ret <= 0) {
+    if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+    printf("Remote socket close!!!\r\n");
+    Close(session->id, true);
+    return;
+  }
+  session->response.append(buffer_.data(), ret);
+  std::string& reply = session->response;
+  size_t line_end = reply.find("\r\n");
+  if (line_end == std::string::npos) {
+    if (reply.size() <= kMaxResponseLength) return;
+    printf("Caster reply is too long\r\n");
+    Close(session->id, true);
+    return;
+  }
+  std::string status = reply.substr(0, line_end);
+  bool http = (status.compare(0, 5, "HTTP/") == 0);
+  size_t space = status.find(' ');
+  if (http ? ((space == std::string::npos) ||
+              (atoi(status.c_str()+space+1) != 200)) :
+      (status.compare(0, 10, "ICY 200 OK") != 0)) {
+    printf("Request result: %s\r\n", status.c_str());
+    Close(session->id, true);
+    return;
+  }
+  size_t body = ReplyBodyOffset(reply);
+  if (body == std::string::npos) {
+    if (!http) {
+      body = line_end + 2;
+    } else if (reply.size() <= kMaxResponseLength) {
+      return;
+    } else {
+      printf("Caster reply header is too long\r\n");
+      Close(session->id, true);
+      return;
+    }
+  }
+  if (http) {
+    std::string encoding = HeaderValue(reply.substr(0, body),
+        "Transfer-Encoding:");
+    for (auto& c : encoding) c = tolower(static_cast<unsigned char>(c));
+    session->chunked = (encoding.find("chunked") != std::string::npos);
+  }
+  session->state = SessionState::kStreaming;
+  SendGga(session);
+  SetDeadline(session,
+      NowMilliseconds() + session->options.report_interval*1000);
+  // Stream data that shared a read with the reply.
+  std::string data = reply.substr(body);
+  std::string().swap(session->response);
+  if (!data.empty()) Deliver(session, &data[0], static_cast<int>(data.size()));
+}
+
+void NtripClientPool::Worker::ReceiveData(ClientSession* session) {
+  int ret = recv(session->fd, buffer_.data(), kBufferSize, 0);
+  if (ret > 0) {
+    session->receive_timeout_cnt = kReceiveTimeoutPeriod;
+    Deliver(session, buffer_.data(), ret);
+  } else if (ret == 0) {
+    printf("Remote socket close!!!\r\n");
+    Close(session->id, true);
+  } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+    printf("Remote socket error, errno=%d\r\n", errno);
+    Close(session->id, true);
+  }
+}
+
+void NtripClientPool::Worker::Deliver(ClientSession* session, char* data,
+    int size) {
+  if (session->chunked) size = session->chunks.Decode(data, size);
+  if (size < 0) {
+    printf("Chunked stream error\r\n");
+    Close(session->id, true);
+    return;
+  }
+  if (size > 0) session->callback(data, size);
+}
+
+void NtripClientPool::Worker::SendGga(ClientSession* session) {
+  if (!session->gga_is_update) {
+    GGAFrameGenerate(session->options.latitude, session->options.longitude,
+        10.0, &session->options.gga);
+  }
+  std::string const& gga = session->options.gga;
+  if (send(session->fd, gga.c_str(), gga.size(), MSG_NOSIGNAL) < 0) ;
+}
+
+void NtripClientPool::Worker::SetDeadline(ClientSession* session,
+    int64_t deadline_ms) {
+  session->deadline_ms = deadline_ms;
+  deadlines_.emplace(deadline_ms, session->id);
+}
+
+void NtripClientPool::Worker::CheckDeadlines(int64_t now) {
+  while (!deadlines_.empty() && deadlines_.top().first <= now) {
+    auto top = deadlines_.top();
+    deadlines_.pop();
+    ClientSession* session = Find(top.second);
+    if (session == nullptr || session->deadline_ms != top.first) continue;
+    if (session->state != SessionState::kStreaming) {
+      printf("NtripCaster[%s:%d %s] access failed!!!\r\n",
+          session->options.ip.c_str(), session->options.port,
+          session->options.mountpoint.c_str());
+      Close(session->id, true);
+      continue;
+    }
+    if (session->receive_timeout_cnt-- <= 0) {
+      printf("NtripCaster[%s:%d %s] receive timeout!!!\r\n",
+          session->options.ip.c_str(), session->options.port,
+          session->options.mountpoint.c_str());
+      Close(session->id, true);
+      continue;
+    }
+    SendGga(session);
+    SetDeadline(session,
+        top.first + session->options.report_interval*1000);
+  }
+}
+
+//
+// NtripClientPool.
+//
+
+NtripClientPool::NtripClientPool() = default;
+
+NtripClientPool::~NtripClientPool() {
+  Stop();
+}
+
+bool NtripClientPool::Run(void) {
+  if (service_is_running_.load()) return true;
+  for (int i = 0; i < thread_count_; ++i) {
+    workers_.emplace_back(new Worker(this));
+    if (!workers_.back()->Start(thread_options_)) {
+      Stop();
+      return false;
+    }
+  }
+  service_is_running_.store(true);
+  printf("NtripClientPool running with %d threads\r\n", thread_count_);
+  return true;
+}
+
+void NtripClientPool::Stop(void) {
+  service_is_running_.store(false);
+  for (auto& worker : workers_) worker->Stop();
+  workers_.clear();
+  session_count_.store(0);
+}
+
+NtripClientPool::Worker* NtripClientPool::WorkerOf(int session_id) const {
+  if (session_id < 0 || workers_.empty()) return nullptr;
+  return workers_[session_id % workers_.size()].get();
+}
+
+int NtripClientPool::AddSession(ClientSessionOptions const& options,
+    ClientCallback const& callback) {
+  if (!service_is_running_.load()) return -1;
+  int session_id = next_session_id_.fetch_add(1);
+  Worker* worker = WorkerOf(session_id);
+  session_count_.fetch_add(1);
+  worker->Post([worker, session_id, options, callback] () {
+    worker->Open(session_id, options, callback);
+  });
+  return session_id;
+}
+
+void NtripClientPool::RemoveSession(int session_id) {
+  Worker* worker = WorkerOf(session_id);
+  if (worker == nullptr) return;
+  worker->Post([worker, session_id] () { worker->Close(session_id, false); });
+}
+
+void NtripClientPool::set_gga_buffer(int session_id,
+    std::string const& gga_buffer) {
+  Worker* worker = WorkerOf(session_id);
+  if (worker == nullptr) return;
+  worker->Post([worker, session_id, gga_buffer] () {
+    ClientSession* session = worker->Find(session_id);
+    if (session == nullptr) return;
+    session->options.gga = gga_buffer;
+    session->gga_is_update = true;
+  });
+}
+
+void NtripClientPool::set_location(int session_id,
+    double latitude, double longitude) {
+  Worker* worker = WorkerOf(session_id);
+  if (worker == nullptr) return;
+  worker->Post([worker, session_id, latitude, longitude] () {
+    ClientSession* session = worker->Find(session_id);
+    if (session == nullptr) return;
+    session->options.latitude = latitude;
+    session->options.longitude = longitude;
+  });
+}
+
+}  // namespace libntrip
@@ -28,17 +28,23 @@
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
 #endif  // defined(__linux__)
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
+#include <algorithm>
+#include <chrono>  // NOLINT.
 #include <string>
-#include <list>
 
+#include "ntrip/memory_pool.h"
 #include "ntrip/ntrip_util.h"
 #include "cmake_definition.h.in"
 
@@ -54,6 +60,30 @@ namespace {
 using socket_t = decltype(socket(AF_INET, SOCK_STREAM, 0));
 
 constexpr int kBufferSize = 4096;
+// Smallest buffer PushData() copies into, larger pushes take the next
+// power of two so that each push stays one queue item.
+constexpr int kPushBufferSize = 2048;
+constexpr int kMaxPushSize = 1 << 30;
+// Most buffers the I/O thread writes at once.
+constexpr int kMaxBatch = 64;
+#if defined(__linux__)
+constexpr int kSendFlags = MSG_NOSIGNAL | MSG_DONTWAIT;
+#else
+constexpr int kSendFlags = 0;
+#endif  // defined(__linux__)
+
+#if defined(WIN32) || defined(_WIN32)
+bool WouldBlock(void) { return WSAGetLastError() == WSAEWOULDBLOCK; }
+#else
+bool WouldBlock(void) {
+  return (errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR);
+}
+#endif  // defined(WIN32) || defined(_WIN32)
+
+int64_t NowNs(void) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
 }  // namespace
 
@@ -122,12 +152,11 @@ bool NtripServer::Run(void) {
   int ret = -1;
   std::string user_passwd = user_ + ":" + passwd_;
   std::string user_passwd_base64;
-  std::unique_ptr<char[]> buffer(
-      new char[kBufferSize], std::default_delete<char[]>());
+  PooledBuffer buffer = BufferPool::Instance(kBufferSize)->Allocate();
   // Generate base64 encoding of username and password.
   Base64Encode(user_passwd, &user_passwd_base64);
   // Generate request data format of ntrip.
-  ret = snprintf(buffer.get(), kBufferSize-1,
+  ret = snprintf(buffer.data(), kBufferSize-1,
       "POST /%s HTTP/1.1\r\n"
       "Host: %s:%d\r\n"
       "Ntrip-Version: Ntrip/2.0\r\n"
@@ -138,7 +167,11 @@ bool NtripServer::Run(void) {
       "Transfer-Encoding: chunked\r\n",
       mountpoint_.c_str(), server_ip_.c_str(), server_port_,
       kServerAgent, user_passwd_base64.c_str(), ntrip_str_.c_str());
-  if (send(socket_fd, buffer.get(), ret, 0) < 0) {
+  if ((source_priority_ >= 0) && (ret > 0) && (ret < kBufferSize-1)) {
+    ret += snprintf(buffer.data()+ret, kBufferSize-1-ret,
+        "Source-Priority: %d\r\n", source_priority_);
+  }
+  if (send(socket_fd, buffer.data(), ret, 0) < 0) {
     printf("Send authentication request failed!!!\n");
 #if defined(WIN32) || defined(_WIN32)
     closesocket(socket_fd);
@@ -151,9 +184,9 @@ bool NtripServer::Run(void) {
   // Waitting for request to connect caster success.
   int timeout = 30;  // 30*100ms=3s.
   while (timeout--) {
-    ret = recv(socket_fd, buffer.get(), kBufferSize, 0);
+    ret = recv(socket_fd, buffer.data(), kBufferSize, 0);
     if (ret > 0) {
-      std::string result(buffer.get(), ret);
+      std::string result(buffer.data(), ret);
       if ((result.find("HTTP/1.1 200 OK") != std::string::npos) ||
           (result.find("ICY 200 OK") != std::string::npos)) {
         // printf("Connect to caster success\n");
@@ -198,31 +231,175 @@ bool NtripServer::Run(void) {
       &keepinterval, sizeof(keepinterval));
   setsockopt(socket_fd, SOL_TCP, TCP_KEEPCNT, &keepcount, sizeof(keepcount));
 #endif  // defined(ENABLE_TCP_KEEPALIVE)
-  socket_fd_ = socket_fd;
+#if defined(__linux__)
+  int wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wake_fd < 0) {
+    printf("Create eventfd failed, errno = -%d\n", errno);
+    close(socket_fd);
+    return false;
+  }
+#endif  // defined(__linux__)
+  {
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    socket_fd_ = socket_fd;
+#if defined(__linux__)
+    wake_fd_ = wake_fd;
+#endif  // defined(__linux__)
+    send_backlog_.clear();
+    send_backlog_offset_ = 0;
+    send_backlog_bytes_.store(0);
+    writable_wanted_ = false;
+  }
+#if defined(__linux__)
+  push_queue_.reset(new MpmcRing<PushItem>(push_options_.capacity));
+  push_queued_bytes_.store(0);
+  push_peak_bytes_.store(0);
+  push_count_.store(0);
+  push_dropped_.store(0);
+  push_dropped_bytes_.store(0);
+  push_sent_bytes_.store(0);
+  push_flushes_.store(0);
+  push_flushed_.store(0);
+  push_latency_total_ns_.store(0);
+  push_latency_max_ns_.store(0);
+  push_blocked_ns_.store(0);
+#endif  // defined(__linux__)
+  // Set before the thread starts, so a quick Stop() is not lost.
+  service_is_running_.store(true);
+  thread_.set_default_name("ntrip_server");
   thread_.reset(&NtripServer::ThreadHandler, this);
   return true;
 }
 
-int NtripServer::SendData(const char *data, int size) {
-  return (size == send(socket_fd_, data, size, 0))-1;
+int NtripServer::SendData(char const* data, int size, SendResult* result) {
+  if (result != nullptr) *result = SendResult();
+  std::lock_guard<std::mutex> lock(send_mutex_);
+#if defined(WIN32) || defined(_WIN32)
+  if (socket_fd_ == INVALID_SOCKET) return -1;
+#else
+  if (socket_fd_ < 0) return -1;
+#endif  // defined(WIN32) || defined(_WIN32)
+  // Older bytes go first.
+  if (FlushBacklog() < 0) return -1;
+  int pending = send_backlog_bytes_.load();
+  if ((pending > 0) && (pending+size > send_backlog_limit_)) {
+    writable_wanted_ = true;
+    return kSendWouldBlock;
+  }
+  int sent = 0;
+  if (pending == 0) {
+    sent = send(socket_fd_, data, size, kSendFlags);
+    if (sent < 0) {
+      if (!WouldBlock()) return -1;
+      sent = 0;
+    }
+  }
+  if (sent < size) {
+    send_backlog_.insert(send_backlog_.end(), data+sent, data+size);
+    send_backlog_bytes_.fetch_add(size-sent);
+#if defined(__linux__)
+    // Let the server thread wait for the socket to become writable.
+    if ((pending == 0) && (wake_fd_ >= 0)) {
+      uint64_t one = 1;
+      if (write(wake_fd_, &one, sizeof(one)) < 0) ;
+    }
+#endif  // defined(__linux__)
+  }
+  if (result != nullptr) {
+    result->accepted = sent;
+    result->queued = size-sent;
+  }
+  return 0;
+}
+
+int NtripServer::PushData(char const* data, int size) {
+#if defined(__linux__)
+  if ((push_queue_ == nullptr) || !service_is_running_.load()) return -1;
+  if ((size < 0) || (size > kMaxPushSize)) return -1;
+  if (size == 0) return 0;
+  int ret = 0;
+  int buffer_size = kPushBufferSize;
+  while (buffer_size < size) buffer_size <<= 1;
+  PushItem item;
+  item.buffer = BufferPool::Instance(buffer_size)->Allocate();
+  memcpy(item.buffer.data(), data, size);
+  item.buffer.set_size(size);
+  item.push_ns = NowNs();
+  if (!Enqueue(std::move(item))) ret = -1;
+  if (!service_is_running_.load()) {
+    // The I/O thread may have left after the check above, nothing would
+    // send what is still queued.
+    PushItem item;
+    while (push_queue_->TryPop(&item)) {
+      uint64_t dropped = item.buffer.size();
+      push_dropped_.fetch_add(1);
+      push_dropped_bytes_.fetch_add(dropped);
+      push_queued_bytes_.fetch_sub(dropped);
+    }
+    ret = -1;
+  }
+  return ret;
+#else
+  return SendData(data, size);
+#endif  // defined(__linux__)
+}
+
+PushStatistics NtripServer::push_statistics(void) const {
+  PushStatistics statistics;
+  statistics.queued_bytes = push_queued_bytes_.load();
+  statistics.peak_queued_bytes = push_peak_bytes_.load();
+  statistics.pushed = push_count_.load();
+  statistics.dropped = push_dropped_.load();
+  statistics.dropped_bytes = push_dropped_bytes_.load();
+  statistics.sent_bytes = push_sent_bytes_.load();
+  statistics.flushes = push_flushes_.load();
+  uint64_t flushed = push_flushed_.load();
+  if (flushed > 0) {
+    statistics.mean_flush_latency_ns =
+        push_latency_total_ns_.load() / static_cast<int64_t>(flushed);
+  }
+  statistics.max_flush_latency_ns = push_latency_max_ns_.load();
+  statistics.blocked_ns = push_blocked_ns_.load();
+  return statistics;
 }
 
 void NtripServer::Stop(void) {
   service_is_running_.store(false);
-#if defined(WIN32) || defined(_WIN32)
-  if (socket_fd_ != INVALID_SOCKET) {
-    closesocket(socket_fd_);
-    WSACleanup();
-    socket_fd_ = INVALID_SOCKET;
+#if defined(__linux__)
+  // The I/O thread writes what is queued and leaves, it owns the socket
+  // until then.
+  if (wake_fd_ >= 0) {
+    uint64_t one = 1;
+    if (write(wake_fd_, &one, sizeof(one)) < 0) ;
   }
-#else
-  if (socket_fd_ > 0) {
-    close(socket_fd_);
-    socket_fd_ = -1;
+  {
+    std::lock_guard<std::mutex> lock(push_mutex_);
+    push_cv_.notify_all();
   }
+  thread_.join();
+#endif  // defined(__linux__)
+  {
+    // SendData() may run on another thread.
+    std::lock_guard<std::mutex> lock(send_mutex_);
+#if defined(WIN32) || defined(_WIN32)
+    if (socket_fd_ != INVALID_SOCKET) {
+      closesocket(socket_fd_);
+      WSACleanup();
+      socket_fd_ = INVALID_SOCKET;
+    }
+#else
+    if (socket_fd_ > 0) {
+      close(socket_fd_);
+      socket_fd_ = -1;
+    }
 #endif  // defined(WIN32) || defined(_WIN32)
-  if (!data_list_.empty()) {
-    data_list_.clear();
+#if defined(__linux__)
+    // SendData() writes it under the same lock.
+    if (wake_fd_ >= 0) {
+      close(wake_fd_);
+      wake_fd_ = -1;
+    }
+#endif  // defined(__linux__)
   }
   thread_.join();
 }
@@ -232,13 +409,111 @@ void NtripServer::Stop(void) {
 //
 
 void NtripServer::ThreadHandler(void) {
-  service_is_running_.store(true);
   int ret;
-  std::unique_ptr<char[]> buffer(
-      new char[kBufferSize], std::default_delete<char[]>());
+  PooledBuffer buffer = BufferPool::Instance(kBufferSize)->Allocate();
   printf("NtripServer service running...\n");
+#if defined(__linux__)
+  MpmcRing<PushItem>& queue = *push_queue_;
+  int64_t budget_ns = static_cast<int64_t>(push_options_.latency_budget_us) *
+      1000;
+  // Popped from the queue, not completely written yet.
+  std::vector<PushItem> batch;
+  batch.reserve(kMaxBatch);
+  int batch_bytes = 0;
+  int sent = 0;  // Bytes of batch.front() written already.
+  bool blocked = false;  // The socket took less than offered.
+  struct pollfd fds[2];
+  fds[0].fd = socket_fd_;
+  fds[1].fd = wake_fd_;
+  fds[1].events = POLLIN;
+  while (true) {
+    bool running = service_is_running_.load();
+    PushItem item;
+    bool popped = false;
+    while ((batch.size() < kMaxBatch) && queue.TryPop(&item)) {
+      batch_bytes += item.buffer.size();
+      batch.push_back(std::move(item));
+      popped = true;
+    }
+    if (popped) {
+      // Room for a producer that waits on a full queue.
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (producer_waiting_.load()) {
+        std::lock_guard<std::mutex> lock(push_mutex_);
+        push_cv_.notify_all();
+      }
+    }
+    int64_t now = NowNs();
+    if (!batch.empty() && !blocked &&
+        (!running || (batch_bytes-sent >= push_options_.flush_bytes) ||
+         (batch.size() == kMaxBatch) ||
+         (now-batch.front().push_ns >= budget_ns))) {
+      if (Flush(&batch, &sent, &blocked) < 0) {
+        printf("Remote socket error!!!\n");
+        break;
+      }
+      batch_bytes = 0;
+      for (auto const& queued : batch) batch_bytes += queued.buffer.size();
+      continue;
+    }
+    // Data that did not fit into the socket before Stop() is lost.
+    if (!running) break;
+    // Sleep until the caster sends or closes, the socket takes more,
+    // new data is pushed or the oldest queued byte is due.
+    struct timespec due;
+    struct timespec* timeout = nullptr;
+    if (!batch.empty() && !blocked) {
+      int64_t wait_ns = std::max<int64_t>(
+          batch.front().push_ns+budget_ns-now, 0);
+      due.tv_sec = wait_ns / 1000000000;
+      due.tv_nsec = wait_ns % 1000000000;
+      timeout = &due;
+    }
+    io_waiting_.store(true);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!blocked && (batch.size() < kMaxBatch) && (queue.size() > 0)) {
+      io_waiting_.store(false);
+      continue;
+    }
+    bool backlog = send_backlog_bytes_.load() > 0;
+    fds[0].events = POLLIN | ((blocked || backlog) ? POLLOUT : 0);
+    ret = ppoll(fds, 2, timeout, nullptr);
+    io_waiting_.store(false);
+    if (ret < 0) {
+      if (errno == EINTR) continue;
+      printf("Poll error, errno=%d\n", errno);
+      break;
+    }
+    if (fds[1].revents != 0) {
+      uint64_t count;
+      if (read(wake_fd_, &count, sizeof(count)) < 0) ;
+    }
+    if (fds[0].revents & POLLOUT) {
+      blocked = false;
+      if (backlog && (ServiceBacklog() < 0)) {
+        printf("Remote socket error!!!\n");
+        break;
+      }
+    }
+    if (fds[0].revents & (POLLIN | POLLERR | POLLHUP)) {
+      ret = recv(socket_fd_, buffer.data(), kBufferSize, 0);
+      if (ret == 0) {
+        printf("Remote socket closed!!!\n");
+        break;
+      } else if ((ret < 0) && (errno != EAGAIN) &&
+          (errno != EWOULDBLOCK) && (errno != EINTR)) {
+        printf("Remote socket error!!!\n");
+        break;
+      }
+    }
+  }
+#else
   while (service_is_running_.load()) {
-    ret = recv(socket_fd_, buffer.get(), kBufferSize, 0);
+    if (ServiceBacklog() < 0) {
+      printf("Remote socket error!!!\n");
+      break;
+    }
+    ret = recv(socket_fd_, buffer.data(), kBufferSize, 0);
     if (ret == 0) {
       printf("Remote socket closed!!!\n");
       break;
@@ -251,20 +526,170 @@ void NtripServer::ThreadHandler(void) {
     }
     std::this_thread::sleep_for(std::chrono::milliseconds(100));
   }
+#endif  // defined(__linux__)
+  {
+    std::lock_guard<std::mutex> lock(send_mutex_);
 #if defined(WIN32) || defined(_WIN32)
-  if (socket_fd_ != INVALID_SOCKET) {
-    closesocket(socket_fd_);
-    WSACleanup();
-    socket_fd_ = INVALID_SOCKET;
-  }
+    if (socket_fd_ != INVALID_SOCKET) {
+      closesocket(socket_fd_);
+      WSACleanup();
+      socket_fd_ = INVALID_SOCKET;
+    }
 #else
-  if (socket_fd_ > 0) {
-    close(socket_fd_);
-    socket_fd_ = -1;
-  }
+    if (socket_fd_ > 0) {
+      close(socket_fd_);
+      socket_fd_ = -1;
+    }
 #endif  // defined(WIN32) || defined(_WIN32)
+  }
   printf("NtripServer service done.\n");
   service_is_running_.store(false);
 }
 
+int NtripServer::FlushBacklog(void) {
+  while (send_backlog_offset_ < send_backlog_.size()) {
+    int size = static_cast<int>(send_backlog_.size()-send_backlog_offset_);
+    int ret = send(socket_fd_, send_backlog_.data()+send_backlog_offset_,
+        size, kSendFlags);
+    if (ret < 0) return WouldBlock() ? 0 : -1;
+    send_backlog_offset_ += ret;
+    send_backlog_bytes_.fetch_sub(ret);
+    if (ret < size) {
+      // Drop the written head before new sends are appended.
+      if (send_backlog_offset_ > send_backlog_.size()/2) {
+        send_backlog_.erase(send_backlog_.begin(),
+            send_backlog_.begin()+send_backlog_offset_);
+        send_backlog_offset_ = 0;
+      }
+      return 0;
+    }
+  }
+  send_backlog_.clear();
+  send_backlog_offset_ = 0;
+  return 0;
+}
+
+int NtripServer::ServiceBacklog(void) {
+  bool writable = false;
+  {
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    if (FlushBacklog() < 0) return -1;
+    if (writable_wanted_ && send_backlog_.empty()) {
+      writable_wanted_ = false;
+      writable = true;
+    }
+  }
+  // Outside the lock, the callback may send right away.
+  if (writable && writable_callback_) writable_callback_();
+  return 0;
+}
+
+#if defined(__linux__)
+bool NtripServer::Enqueue(PushItem&& item) {
+  MpmcRing<PushItem>& queue = *push_queue_;
+  uint64_t size = item.buffer.size();
+  uint64_t queued_bytes = push_queued_bytes_.fetch_add(size) + size;
+  bool queued = queue.TryPush(std::move(item));
+  if (!queued && push_options_.overflow == PushOverflow::kDropOldest) {
+    // Other producers may take the freed slot, drop until this fits.
+    PushItem oldest;
+    while (!queued) {
+      if (queue.TryPop(&oldest)) {
+        uint64_t dropped = oldest.buffer.size();
+        push_dropped_.fetch_add(1);
+        push_dropped_bytes_.fetch_add(dropped);
+        push_queued_bytes_.fetch_sub(dropped);
+      }
+      queued = queue.TryPush(std::move(item));
+    }
+  } else if (!queued) {
+    int64_t begin = NowNs();
+    std::unique_lock<std::mutex> lock(push_mutex_);
+    producer_waiting_.store(true);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while (!(queued = queue.TryPush(std::move(item))) &&
+        service_is_running_.load()) {
+      push_cv_.wait_for(lock, std::chrono::milliseconds(10));
+    }
+    producer_waiting_.store(false);
+    push_blocked_ns_.fetch_add(NowNs()-begin);
+  }
+  if (!queued) {
+    push_dropped_.fetch_add(1);
+    push_dropped_bytes_.fetch_add(size);
+    push_queued_bytes_.fetch_sub(size);
+    return false;
+  }
+  push_count_.fetch_add(1);
+  if (queued_bytes > push_peak_bytes_.load(std::memory_order_relaxed)) {
+    push_peak_bytes_.store(queued_bytes, std::memory_order_relaxed);
+  }
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (io_waiting_.load() && io_waiting_.exchange(false)) {
+    // Stop() closes it under the same lock.
+    std::lock_guard<std::mutex> lock(send_mutex_);
+    uint64_t one = 1;
+    if ((wake_fd_ >= 0) && (write(wake_fd_, &one, sizeof(one)) < 0)) ;
+  }
+  return true;
+}
+
+int NtripServer::Flush(std::vector<PushItem>* batch, int* sent,
+    bool* blocked) {
+  struct iovec iov[kMaxBatch];
+  int count = static_cast<int>(batch->size());
+  int offered = 0;
+  for (int i = 0; i < count; ++i) {
+    int offset = (i == 0) ? *sent : 0;
+    iov[i].iov_base = (*batch)[i].buffer.data() + offset;
+    iov[i].iov_len = (*batch)[i].buffer.size() - offset;
+    offered += static_cast<int>(iov[i].iov_len);
+  }
+  struct msghdr message;
+  memset(&message, 0, sizeof(message));
+  message.msg_iov = iov;
+  message.msg_iovlen = count;
+  ssize_t ret = sendmsg(socket_fd_, &message, MSG_NOSIGNAL | MSG_DONTWAIT);
+  if (ret < 0) {
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) {
+      *blocked = true;
+      return 0;
+    }
+    return -1;
+  }
+  push_flushes_.fetch_add(1);
+  push_sent_bytes_.fetch_add(ret);
+  push_queued_bytes_.fetch_sub(ret);
+  *blocked = (ret < offered);
+  // Retire the buffers that are out completely.
+  int64_t now = NowNs();
+  int done = 0;
+  int64_t latency_total = 0;
+  int64_t latency_max = 0;
+  int left = static_cast<int>(ret);
+  while (done < count) {
+    int remain = (*batch)[done].buffer.size() - *sent;
+    if (left < remain) {
+      *sent += left;
+      break;
+    }
+    left -= remain;
+    *sent = 0;
+    int64_t latency = now - (*batch)[done].push_ns;
+    latency_total += latency;
+    latency_max = std::max(latency_max, latency);
+    ++done;
+  }
+  if (done > 0) {
+    batch->erase(batch->begin(), batch->begin()+done);
+    push_flushed_.fetch_add(done);
+    push_latency_total_ns_.fetch_add(latency_total);
+    if (latency_max > push_latency_max_ns_.load(std::memory_order_relaxed)) {
+      push_latency_max_ns_.store(latency_max, std::memory_order_relaxed);
+    }
+  }
+  return 0;
+}
+#endif  // defined(__linux__)
+
 }  // namespace libntrip
@@ -22,12 +22,15 @@
 
 #include "ntrip/ntrip_util.h"
 
+#include <ctype.h>
 #include <math.h>
+#include <stdint.h>
 #include <string.h>
 #include <time.h>
 
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <fstream>
 #include <memory>
 
@@ -144,6 +147,34 @@ int GGAFrameGenerate(double latitude, double longitude,
   return BccCheckSumCompareForGGA(gga_out->c_str());
 }
 
+int StringSplit(std::string const& src, std::string const& div_str,
+    std::vector<std::string>* out, bool append_div_str) {
+  if (out == nullptr) return -1;
+  out->clear();
+  std::string::size_type pos_begin = 0;
+  std::string::size_type div_pos_begin = src.find(div_str);
+  std::size_t src_len = src.size();
+  std::size_t div_str_len = div_str.size();
+  std::size_t len;
+  std::string item;
+  while (div_pos_begin != std::string::npos) {
+    len = div_pos_begin-pos_begin;
+    if (len > 0) {
+      item = src.substr(pos_begin, len);
+      if (append_div_str) item += div_str;
+      out->push_back(item);
+    }
+    pos_begin = div_pos_begin + div_str_len;
+    div_pos_begin = src.find(div_str, pos_begin);
+  }
+  if (pos_begin+div_str_len <= src_len) {
+    item = src.substr(pos_begin, src_len-pos_begin);
+    if (append_div_str) item += div_str;
+    out->push_back(item);
+  }
+  return 0;
+}
+
 // New functions for auto-selection feature
 
 double CalculateDistance(double lat1, double lon1, double lat2, double lon2) {
@@ -247,4 +278,118 @@ int ParsePositionFromHeader(std::string const& header_value, double* latitude, d
   }
 }
 
+// Casters answer "ICY 200 OK" or "HTTP/1.1 200 OK", with or without
+// header lines, and may send data in the same segment.
+size_t ReplyBodyOffset(std::string const& reply) {
+  size_t pos = reply.find("\r\n") + 2;
+  if (reply.compare(pos, 2, "\r\n") == 0) return pos + 2;
+  size_t end = reply.find("\r\n\r\n", pos);
+  size_t limit = (end == std::string::npos) ? reply.size() : end;
+  for (size_t i = pos; i < limit; ++i) {
+    unsigned char c = reply[i];
+    if ((c < 0x20 || c > 0x7E) && c != '\r' && c != '\n') return pos;
+  }
+  return (end == std::string::npos) ? end : end + 4;
+}
+
+std::string HeaderValue(std::string const& header, char const* name) {
+  size_t length = strlen(name);
+  size_t pos = 0;
+  while ((pos = header.find("\r\n", pos)) != std::string::npos) {
+    pos += 2;
+    if (header.size()-pos < length) break;
+    bool match = true;
+    for (size_t i = 0; i < length && match; ++i) {
+      match = (tolower(static_cast<unsigned char>(header[pos+i])) ==
+          tolower(static_cast<unsigned char>(name[i])));
+    }
+    if (!match) continue;
+    size_t beg = header.find_first_not_of(' ', pos+length);
+    size_t end = header.find("\r\n", pos);
+    if (beg == std::string::npos || beg >= end) return "";
+    return header.substr(beg, end-beg);
+  }
+  return "";
+}
+
+//
+// HttpChunkDecoder.
+//
+int HttpChunkDecoder::Decode(char* data, int size) {
+  if (state_ == kError) return -1;
+  int out = 0;
+  int pos = 0;
+  while (pos < size && state_ != kDone) {
+    if (state_ == kData) {
+      // Payload is moved in one piece, it stays where it is while no
+      // chunk header came before it in this call.
+      int length = static_cast<int>(
+          std::min<uint64_t>(remaining_, static_cast<uint64_t>(size-pos)));
+      if (out != pos) memmove(data+out, data+pos, length);
+      out += length;
+      pos += length;
+      remaining_ -= length;
+      if (remaining_ == 0) state_ = kDataCr;
+      continue;
+    }
+    if (Step(data[pos++]) != 0) {
+      state_ = kError;
+      return -1;
+    }
+  }
+  return out;
+}
+
+int HttpChunkDecoder::Step(char c) {
+  switch (state_) {
+    case kSize: {
+      int value = -1;
+      if (c >= '0' && c <= '9') value = c-'0';
+      else if (c >= 'a' && c <= 'f') value = c-'a'+10;
+      else if (c >= 'A' && c <= 'F') value = c-'A'+10;
+      if (value >= 0) {
+        if (++digits_ > 15) return -1;
+        remaining_ = remaining_*16 + value;
+        return 0;
+      }
+      if (digits_ == 0) return -1;
+      if (c == ';' || c == ' ' || c == '\t') {
+        state_ = kExtension;
+      } else if (c == '\r') {
+        state_ = kSizeLf;
+      } else {
+        return -1;
+      }
+      return 0;
+    }
+    case kExtension:
+      if (c == '\r') state_ = kSizeLf;
+      return 0;
+    case kSizeLf:
+      if (c != '\n') return -1;
+      digits_ = 0;
+      line_length_ = 0;
+      state_ = (remaining_ == 0) ? kTrailer : kData;
+      return 0;
+    case kDataCr:
+      if (c != '\r') return -1;
+      state_ = kDataLf;
+      return 0;
+    case kDataLf:
+      if (c != '\n') return -1;
+      state_ = kSize;
+      return 0;
+    case kTrailer:
+      if (c == '\n') {
+        if (line_length_ == 0) state_ = kDone;
+        line_length_ = 0;
+      } else if (c != '\r') {
+        ++line_length_;
+      }
+      return 0;
+    default:
+      return 0;
+  }
+}
+
 }  // namespace libntrip
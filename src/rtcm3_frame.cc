@@ -0,0 +1,95 @@
+// MIT License
+//
+// Copyright (c) 2021 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "ntrip/rtcm3_frame.h"
+
+#include <stdint.h>
+
+
+namespace libntrip {
+
+namespace {
+
+constexpr uint32_t kCrc24QPolynomial = 0x1864CFB;
+
+struct Crc24QTable {
+  uint32_t value[256];
+  Crc24QTable() {
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t crc = i << 16;
+      for (int j = 0; j < 8; ++j) {
+        crc <<= 1;
+        if (crc & 0x1000000) crc ^= kCrc24QPolynomial;
+      }
+      value[i] = crc & 0xFFFFFF;
+    }
+  }
+};
+
+Crc24QTable const kCrc24QTable;
+
+}  // namespace
+
+uint32_t Crc24Q(uint8_t const* data, int size) {
+  uint32_t crc = 0;
+  for (int i = 0; i < size; ++i) {
+    crc = ((crc << 8) & 0xFFFFFF) ^ kCrc24QTable.value[(crc >> 16) ^ data[i]];
+  }
+  return crc;
+}
+
+int Rtcm3FrameCheck(char const* data, int size) {
+  auto const* ptr = reinterpret_cast<uint8_t const*>(data);
+  if (size < 1) return 0;
+  if (ptr[0] != kRtcm3Preamble) return -1;
+  if (size < kRtcm3HeaderLength) return 0;
+  // The 6 reserved bits must be zero.
+  if ((ptr[1] & 0xFC) != 0) return -1;
+  int length = ((ptr[1] & 0x03) << 8) | ptr[2];
+  int frame_length = kRtcm3HeaderLength + length + kRtcm3CrcLength;
+  if (size < frame_length) return 0;
+  int crc_pos = kRtcm3HeaderLength + length;
+  uint32_t crc = (static_cast<uint32_t>(ptr[crc_pos]) << 16) |
+      (static_cast<uint32_t>(ptr[crc_pos+1]) << 8) | ptr[crc_pos+2];
+  if (Crc24Q(ptr, crc_pos) != crc) return -1;
+  return frame_length;
+}
+
+int Rtcm3MessageType(char const* frame) {
+  auto const* ptr = reinterpret_cast<uint8_t const*>(frame);
+  if (((ptr[1] & 0x03) << 8 | ptr[2]) < 2) return 0;
+  return (ptr[3] << 4) | (ptr[4] >> 4);
+}
+
+int Rtcm3Framer::PendingNeed(void) const {
+  int have = static_cast<int>(pending_.size());
+  if (have < kRtcm3HeaderLength) return kRtcm3HeaderLength-have;
+  auto const* ptr = reinterpret_cast<uint8_t const*>(pending_.data());
+  // A bad header fails the check as it is.
+  if ((ptr[0] != kRtcm3Preamble) || ((ptr[1] & 0xFC) != 0)) return 0;
+  int length = ((ptr[1] & 0x03) << 8) | ptr[2];
+  int need = kRtcm3HeaderLength+length+kRtcm3CrcLength-have;
+  // After a resync the bytes kept aside may already hold the frame.
+  return (need > 0) ? need : 0;
+}
+
+}  // namespace libntrip
@@ -0,0 +1,839 @@
+// MIT License
+//
+// Copyright (c) 2021 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "ntrip/source_table.h"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "ntrip/ntrip_util.h"
+
+
+namespace libntrip {
+
+namespace {
+
+constexpr int kLongitudeCells = 540;  // -180~359, 0~360 tables also occur.
+// M_PI needs _USE_MATH_DEFINES on MSVC.
+constexpr double kPi = 3.14159265358979323846;
+
+enum class Op {
+  kEqual,
+  kNotEqual,
+  kLess,
+  kGreater,
+  kLessEqual,
+  kGreaterEqual,
+};
+
+struct Term {
+  Op op = Op::kEqual;
+  std::string value;  // Upper case.
+  bool wildcard = false;
+  bool has_number = false;
+  double number = 0.0;
+};
+
+using Alternative = std::vector<Term>;       // All terms match.
+using FieldFilter = std::vector<Alternative>;  // Any alternative matches.
+
+inline
+std::string ToUpper(std::string str) {
+  for (auto& c : str) c = static_cast<char>(toupper(c));
+  return str;
+}
+
+inline
+bool ParseNumber(std::string const& str, double* number) {
+  if (str.empty()) return false;
+  char* end = nullptr;
+  *number = strtod(str.c_str(), &end);
+  return (end != nullptr) && (*end == '\0');
+}
+
+inline
+std::string StripLineEnd(std::string const& line) {
+  auto end = line.find_last_not_of("\r\n");
+  return (end == std::string::npos) ? "" : line.substr(0, end+1);
+}
+
+std::string PercentDecode(std::string const& str) {
+  std::string out;
+  out.reserve(str.size());
+  for (size_t i = 0; i < str.size(); ++i) {
+    if (str[i] == '%' && i+2 < str.size() &&
+        isxdigit(str[i+1]) && isxdigit(str[i+2])) {
+      out.push_back(static_cast<char>(
+          strtol(str.substr(i+1, 2).c_str(), nullptr, 16)));
+      i += 2;
+    } else if (str[i] == '+') {
+      out.push_back(' ');
+    } else {
+      out.push_back(str[i]);
+    }
+  }
+  return out;
+}
+
+void Split(std::string const& str, char div, std::vector<std::string>* out) {
+  out->clear();
+  size_t beg = 0;
+  while (true) {
+    size_t pos = str.find(div, beg);
+    out->push_back(str.substr(beg, pos-beg));
+    if (pos == std::string::npos) break;
+    beg = pos+1;
+  }
+}
+
+// '*' matches any run of characters.
+bool GlobMatch(std::string const& pattern, std::string const& text) {
+  size_t p = 0;
+  size_t t = 0;
+  size_t star = std::string::npos;
+  size_t mark = 0;
+  while (t < text.size()) {
+    if (p < pattern.size() && pattern[p] == '*') {
+      star = p++;
+      mark = t;
+    } else if (p < pattern.size() && pattern[p] == text[t]) {
+      ++p;
+      ++t;
+    } else if (star != std::string::npos) {
+      p = star+1;
+      t = ++mark;
+    } else {
+      return false;
+    }
+  }
+  while (p < pattern.size() && pattern[p] == '*') ++p;
+  return p == pattern.size();
+}
+
+Term ParseTerm(std::string const& str) {
+  Term term;
+  size_t skip = 0;
+  if (str.compare(0, 2, "<=") == 0) {
+    term.op = Op::kLessEqual;
+    skip = 2;
+  } else if (str.compare(0, 2, ">=") == 0) {
+    term.op = Op::kGreaterEqual;
+    skip = 2;
+  } else if (str.compare(0, 2, "!=") == 0) {
+    term.op = Op::kNotEqual;
+    skip = 2;
+  } else if (!str.empty() && str[0] == '<') {
+    term.op = Op::kLess;
+    skip = 1;
+  } else if (!str.empty() && str[0] == '>') {
+    term.op = Op::kGreater;
+    skip = 1;
+  } else if (!str.empty() && str[0] == '!') {
+    term.op = Op::kNotEqual;
+    skip = 1;
+  } else if (!str.empty() && str[0] == '=') {
+    skip = 1;
+  }
+  term.value = ToUpper(str.substr(skip));
+  term.wildcard = term.value.find('*') != std::string::npos;
+  term.has_number = ParseNumber(term.value, &term.number);
+  return term;
+}
+
+bool ValueEqual(Term const& term, std::string const& value) {
+  if (term.wildcard) return GlobMatch(term.value, value);
+  double number;
+  if (term.has_number && ParseNumber(value, &number)) {
+    return number == term.number;
+  }
+  return term.value == value;
+}
+
+// `value` is upper case, `components` are the '+' parts of a nav-system.
+bool TermMatch(Term const& term, std::string const& value,
+    std::vector<std::string> const* components) {
+  if (term.op == Op::kEqual || term.op == Op::kNotEqual) {
+    bool equal = ValueEqual(term, value);
+    if (!equal && components != nullptr) {
+      for (auto const& component : *components) {
+        if (ValueEqual(term, component)) {
+          equal = true;
+          break;
+        }
+      }
+    }
+    return equal == (term.op == Op::kEqual);
+  }
+  double number;
+  if (!term.has_number || !ParseNumber(value, &number)) return false;
+  switch (term.op) {
+    case Op::kLess: return number < term.number;
+    case Op::kGreater: return number > term.number;
+    case Op::kLessEqual: return number <= term.number;
+    case Op::kGreaterEqual: return number >= term.number;
+    default: return false;
+  }
+}
+
+bool FieldMatch(FieldFilter const& filter, std::string const& value,
+    std::vector<std::string> const* components) {
+  std::string upper = ToUpper(value);
+  for (auto const& alternative : filter) {
+    bool match = true;
+    for (auto const& term : alternative) {
+      if (!TermMatch(term, upper, components)) {
+        match = false;
+        break;
+      }
+    }
+    if (match) return true;
+  }
+  return false;
+}
+
+// Values of a filter that is a plain list of alternatives, the only kind
+// the exact-match indexes can answer.
+bool PlainValues(FieldFilter const& filter, std::vector<std::string>* values) {
+  values->clear();
+  for (auto const& alternative : filter) {
+    if (alternative.size() != 1 || alternative[0].op != Op::kEqual ||
+        alternative[0].wildcard) {
+      return false;
+    }
+    values->push_back(alternative[0].value);
+  }
+  return !values->empty();
+}
+
+// Narrow [low, high] by the comparisons of a single-alternative filter.
+void NarrowRange(FieldFilter const& filter, double* low, double* high) {
+  if (filter.size() != 1) return;
+  for (auto const& term : filter[0]) {
+    if (!term.has_number) continue;
+    switch (term.op) {
+      case Op::kEqual:
+        *low = std::max(*low, term.number);
+        *high = std::min(*high, term.number);
+        break;
+      case Op::kLess:
+      case Op::kLessEqual:
+        *high = std::min(*high, term.number);
+        break;
+      case Op::kGreater:
+      case Op::kGreaterEqual:
+        *low = std::max(*low, term.number);
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+inline
+void RemoveId(std::vector<int>* list, int id) {
+  list->erase(std::remove(list->begin(), list->end(), id), list->end());
+}
+
+
+// Case-insensitive compare of `size` bytes.
+bool EqualNoCase(char const* a, char const* b, size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    if (toupper(static_cast<unsigned char>(a[i])) !=
+        toupper(static_cast<unsigned char>(b[i]))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Parse a number that fills the field [data, data+size).
+bool ParseNumber(char const* data, size_t size, double* number) {
+  if (size == 0) return false;
+  char* end = nullptr;
+  *number = strtod(data, &end);
+  return end == data+size;
+}
+
+}  // namespace
+
+void SplitSourceTableLine(std::string const& line,
+    std::vector<std::string>* fields) {
+  Split(StripLineEnd(line), ';', fields);
+}
+
+int ParseStreamRecord(std::string const& line, StreamRecord* record) {
+  if (record == nullptr) return -1;
+  SplitSourceTableLine(line, &record->fields);
+  auto& fields = record->fields;
+  if (fields.size() <= kStrLongitude || fields[0] != "STR" ||
+      fields[kStrMountpoint].empty()) {
+    return -1;
+  }
+  fields.resize(std::max<size_t>(fields.size(), kStrFieldCount));
+  record->mountpoint = fields[kStrMountpoint];
+  record->format = fields[kStrFormat];
+  Split(fields[kStrNavSystem], '+', &record->nav_systems);
+  record->country = fields[kStrCountry];
+  record->has_position =
+      ParseNumber(fields[kStrLatitude], &record->latitude) &&
+      ParseNumber(fields[kStrLongitude], &record->longitude);
+  return 0;
+}
+
+//
+// SourceTable.
+//
+
+void SourceTable::Set(std::string const& mountpoint, std::string const& line) {
+  int id;
+  auto it = by_mountpoint_.find(mountpoint);
+  if (it != by_mountpoint_.end()) {
+    id = it->second;
+    Unindex(id);
+  } else if (!free_ids_.empty()) {
+    id = free_ids_.back();
+    free_ids_.pop_back();
+  } else {
+    id = static_cast<int>(entries_.size());
+    entries_.emplace_back();
+  }
+  by_mountpoint_[mountpoint] = id;
+  Entry& entry = entries_[id];
+  entry.live = true;
+  std::string stripped = StripLineEnd(line);
+  entry.line = stripped.empty() ? "" : stripped + "\r\n";
+  entry.record = StreamRecord();
+  entry.parsed = (ParseStreamRecord(stripped, &entry.record) == 0);
+  Index(id);
+  ++version_;
+}
+
+void SourceTable::Remove(std::string const& mountpoint) {
+  auto it = by_mountpoint_.find(mountpoint);
+  if (it == by_mountpoint_.end()) return;
+  int id = it->second;
+  by_mountpoint_.erase(it);
+  Unindex(id);
+  entries_[id] = Entry();
+  free_ids_.push_back(id);
+  ++version_;
+}
+
+void SourceTable::Clear(void) {
+  entries_.clear();
+  free_ids_.clear();
+  by_mountpoint_.clear();
+  by_format_.clear();
+  by_nav_system_.clear();
+  by_country_.clear();
+  by_position_.clear();
+  ++version_;
+}
+
+std::string SourceTable::Render(void) const {
+  std::string out;
+  for (auto const& entry : entries_) {
+    if (entry.live) out += entry.line;
+  }
+  return out;
+}
+
+std::string SourceTable::NormalizeQuery(std::string const& filter) {
+  std::vector<std::string> fields;
+  SplitSourceTableLine(PercentDecode(filter), &fields);
+  if (fields.empty() || ToUpper(fields[0]) != "STR") return "";
+  while (fields.size() > 1 && fields.back().empty()) fields.pop_back();
+  std::string normalized = "STR";
+  for (size_t i = 1; i < fields.size(); ++i) normalized += ";" + fields[i];
+  return normalized;
+}
+
+int SourceTable::Query(std::string const& filter, std::string* out) const {
+  if (out == nullptr) return -1;
+  out->clear();
+  std::vector<std::string> fields;
+  SplitSourceTableLine(PercentDecode(filter), &fields);
+  if (fields.empty() || ToUpper(fields[0]) != "STR") return -1;
+  std::vector<FieldFilter> filters(std::max<size_t>(fields.size(),
+      kStrFieldCount));
+  std::vector<std::string> parts;
+  std::vector<std::string> terms;
+  for (size_t i = 1; i < fields.size(); ++i) {
+    if (fields[i].empty()) continue;
+    Split(fields[i], '|', &parts);
+    for (auto const& part : parts) {
+      Split(part, '&', &terms);
+      Alternative alternative;
+      for (auto const& term : terms) alternative.push_back(ParseTerm(term));
+      filters[i].push_back(alternative);
+    }
+  }
+
+  // Start from the smallest candidate set any index can give.
+  std::vector<int> candidates;
+  bool narrowed = false;
+  auto consider = [&] (std::vector<int>* list) {
+    std::sort(list->begin(), list->end());
+    list->erase(std::unique(list->begin(), list->end()), list->end());
+    if (!narrowed || list->size() < candidates.size()) candidates.swap(*list);
+    narrowed = true;
+  };
+  struct IndexedField {
+    int field;
+    std::unordered_map<std::string, PostingList> const* index;
+  };
+  IndexedField const indexed_fields[] = {
+    {kStrFormat, &by_format_},
+    {kStrNavSystem, &by_nav_system_},
+    {kStrCountry, &by_country_},
+  };
+  std::vector<std::string> values;
+  for (auto const& indexed : indexed_fields) {
+    if (!PlainValues(filters[indexed.field], &values)) continue;
+    std::vector<int> list;
+    for (auto const& value : values) {
+      auto it = indexed.index->find(value);
+      if (it != indexed.index->end()) {
+        list.insert(list.end(), it->second.begin(), it->second.end());
+      }
+    }
+    consider(&list);
+  }
+  double lat_low = -90.0;
+  double lat_high = 90.0;
+  double lon_low = -180.0;
+  double lon_high = 360.0;
+  NarrowRange(filters[kStrLatitude], &lat_low, &lat_high);
+  NarrowRange(filters[kStrLongitude], &lon_low, &lon_high);
+  if (lat_low > -90.0 || lat_high < 90.0 ||
+      lon_low > -180.0 || lon_high < 360.0) {
+    std::vector<int> list;
+    if (lat_low <= lat_high && lon_low <= lon_high) {
+      int row_low = PositionCell(lat_low, 0.0) / kLongitudeCells;
+      int row_high = PositionCell(lat_high, 0.0) / kLongitudeCells;
+      int col_low = PositionCell(0.0, lon_low) % kLongitudeCells;
+      int col_high = PositionCell(0.0, lon_high) % kLongitudeCells;
+      // Walking more cells than records is slower than a scan.
+      if (static_cast<size_t>((row_high-row_low+1)*(col_high-col_low+1)) <=
+          by_position_.size()*4 + 64) {
+        for (int row = row_low; row <= row_high; ++row) {
+          auto it = by_position_.lower_bound(row*kLongitudeCells + col_low);
+          auto end = by_position_.upper_bound(row*kLongitudeCells + col_high);
+          for (; it != end; ++it) {
+            list.insert(list.end(), it->second.begin(), it->second.end());
+          }
+        }
+        consider(&list);
+      }
+    } else {
+      consider(&list);
+    }
+  }
+  if (!narrowed) {
+    for (int id = 0; id < static_cast<int>(entries_.size()); ++id) {
+      candidates.push_back(id);
+    }
+  }
+
+  for (int id : candidates) {
+    Entry const& entry = entries_[id];
+    if (!entry.live || !entry.parsed) continue;
+    bool match = true;
+    for (size_t i = 1; i < filters.size() && match; ++i) {
+      if (filters[i].empty()) continue;
+      std::string const& value =
+          i < entry.record.fields.size() ? entry.record.fields[i] : "";
+      match = FieldMatch(filters[i], value, i == kStrNavSystem ?
+          &entry.record.nav_systems : nullptr);
+    }
+    if (match) *out += entry.line;
+  }
+  return 0;
+}
+
+void SourceTable::Index(int id) {
+  Entry const& entry = entries_[id];
+  if (!entry.parsed) return;
+  StreamRecord const& record = entry.record;
+  by_format_[ToUpper(record.format)].push_back(id);
+  for (auto const& system : record.nav_systems) {
+    if (!system.empty()) by_nav_system_[ToUpper(system)].push_back(id);
+  }
+  by_country_[ToUpper(record.country)].push_back(id);
+  if (record.has_position) {
+    by_position_[PositionCell(record.latitude, record.longitude)]
+        .push_back(id);
+  }
+}
+
+void SourceTable::Unindex(int id) {
+  Entry const& entry = entries_[id];
+  if (!entry.parsed) return;
+  StreamRecord const& record = entry.record;
+  auto remove = [id] (std::unordered_map<std::string, PostingList>* index,
+      std::string const& key) {
+    auto it = index->find(key);
+    if (it == index->end()) return;
+    RemoveId(&it->second, id);
+    if (it->second.empty()) index->erase(it);
+  };
+  remove(&by_format_, ToUpper(record.format));
+  for (auto const& system : record.nav_systems) {
+    remove(&by_nav_system_, ToUpper(system));
+  }
+  remove(&by_country_, ToUpper(record.country));
+  if (record.has_position) {
+    auto it = by_position_.find(
+        PositionCell(record.latitude, record.longitude));
+    if (it != by_position_.end()) {
+      RemoveId(&it->second, id);
+      if (it->second.empty()) by_position_.erase(it);
+    }
+  }
+}
+
+int SourceTable::PositionCell(double latitude, double longitude) {
+  int row = static_cast<int>(floor(latitude)) + 90;
+  int col = static_cast<int>(floor(longitude)) + 180;
+  row = std::min(std::max(row, 0), 179);
+  col = std::min(std::max(col, 0), kLongitudeCells-1);
+  return row*kLongitudeCells + col;
+}
+
+uint64_t SourceTable::InitialVersion(void) {
+  // Different after a restart, so old validators never match.
+  return static_cast<uint64_t>(time(nullptr)) << 20;
+}
+
+//
+// SourceTableSnapshot.
+//
+
+void SourceTableSnapshot::Feed(char const* data, size_t size) {
+  char const* end = data+size;
+  while (data < end) {
+    char const* eol = static_cast<char const*>(memchr(data, '\n', end-data));
+    if (eol == nullptr) {
+      partial_.append(data, end-data);
+      return;
+    }
+    if (partial_.empty()) {
+      ParseLine(data, eol-data);
+    } else {
+      partial_.append(data, eol-data);
+      ParseLine(partial_.data(), partial_.size());
+      partial_.clear();
+    }
+    data = eol+1;
+  }
+}
+
+void SourceTableSnapshot::Finish(void) {
+  if (partial_.empty()) return;
+  ParseLine(partial_.data(), partial_.size());
+  partial_.clear();
+}
+
+void SourceTableSnapshot::Clear(void) {
+  text_.clear();
+  partial_.clear();
+  stations_.clear();
+  casters_.clear();
+  networks_.clear();
+  cells_.clear();
+  etag_.clear();
+  last_modified_.clear();
+  complete_ = false;
+}
+
+void SourceTableSnapshot::ParseLine(char const* line, size_t size) {
+  if (complete_) return;
+  if (size > 0 && line[size-1] == '\r') --size;
+  if (size < 4) return;
+  if (size >= 14 && memcmp(line, "ENDSOURCETABLE", 14) == 0) {
+    complete_ = true;
+    return;
+  }
+  bool station = memcmp(line, "STR;", 4) == 0;
+  bool caster = memcmp(line, "CAS;", 4) == 0;
+  bool network = memcmp(line, "NET;", 4) == 0;
+  if (!station && !caster && !network) return;
+  if (station) {
+    // Field offsets are 16 bits wide.
+    if (size >= 0xFFFF) return;
+    size_t offset = text_.size();
+    text_.append(line, size);
+    text_.append("\r\n");
+    ParseStation(offset);
+    return;
+  }
+  std::vector<std::string> fields;
+  Split(std::string(line, size), ';', &fields);
+  double number;
+  if (caster) {
+    if (fields.size() < 3) return;
+    fields.resize(std::max<size_t>(fields.size(), 12));
+    CasterRecord record;
+    record.host = fields[1];
+    record.port = atoi(fields[2].c_str());
+    record.identifier = fields[3];
+    record.operator_name = fields[4];
+    record.nmea = (fields[5] == "1");
+    record.country = fields[6];
+    if (ParseNumber(fields[7], &number)) record.latitude = number;
+    if (ParseNumber(fields[8], &number)) record.longitude = number;
+    record.fallback_host = fields[9];
+    record.fallback_port = atoi(fields[10].c_str());
+    casters_.push_back(record);
+  } else {
+    if (fields.size() < 2) return;
+    fields.resize(std::max<size_t>(fields.size(), 9));
+    NetworkRecord record;
+    record.identifier = fields[1];
+    record.operator_name = fields[2];
+    if (!fields[3].empty()) record.authentication = fields[3][0];
+    record.fee = (fields[4] == "Y");
+    record.web_net = fields[5];
+    record.web_str = fields[6];
+    record.web_reg = fields[7];
+    networks_.push_back(record);
+  }
+  text_.append(line, size);
+  text_.append("\r\n");
+}
+
+void SourceTableSnapshot::ParseStation(size_t offset) {
+  char const* line = text_.data()+offset;
+  size_t size = text_.size()-offset-2;
+  StationRecord station;
+  station.line = static_cast<uint32_t>(offset);
+  // The misc field is last and may hold ';' itself.
+  int count = 0;
+  station.field[count++] = 0;
+  for (size_t i = 0; i < size && count < kStrFieldCount; ++i) {
+    if (line[i] == ';') station.field[count++] = static_cast<uint16_t>(i+1);
+  }
+  for (int i = count; i <= kStrFieldCount; ++i) {
+    station.field[i] = static_cast<uint16_t>(size+1);
+  }
+  size_t length;
+  char const* data = FieldData(station, kStrMountpoint, &length);
+  if (count <= kStrLongitude || length == 0) {
+    text_.resize(offset);
+    return;
+  }
+  double latitude = 0.0;
+  double longitude = 0.0;
+  char const* lat = FieldData(station, kStrLatitude, &length);
+  bool has_latitude = ParseNumber(lat, length, &latitude);
+  char const* lon = FieldData(station, kStrLongitude, &length);
+  station.has_position = has_latitude && ParseNumber(lon, length, &longitude);
+  station.latitude = latitude;
+  station.longitude = longitude;
+  data = FieldData(station, kStrCarrier, &length);
+  station.carrier = (length > 0) ? atoi(data) : 0;
+  data = FieldData(station, kStrNmea, &length);
+  station.nmea = (length == 1) && (data[0] == '1');
+  data = FieldData(station, kStrSolution, &length);
+  station.network = (length == 1) && (data[0] == '1');
+  data = FieldData(station, kStrAuthentication, &length);
+  if (length > 0) station.authentication = data[0];
+  data = FieldData(station, kStrFee, &length);
+  station.fee = (length == 1) && (data[0] == 'Y');
+  data = FieldData(station, kStrBitrate, &length);
+  station.bitrate = (length > 0) ? atoi(data) : 0;
+  if (station.has_position) {
+    int cell = StationCell(static_cast<int>(floor(latitude)) + 90,
+        static_cast<int>(floor(longitude)) + 180);
+    cells_[cell].push_back(static_cast<uint32_t>(stations_.size()));
+  }
+  stations_.push_back(station);
+}
+
+int SourceTableSnapshot::StationCell(int row, int column) {
+  row = std::min(std::max(row, 0), 179);
+  column = ((column % 360) + 360) % 360;
+  return row*360 + column;
+}
+
+char const* SourceTableSnapshot::FieldData(StationRecord const& station,
+    int field, size_t* size) const {
+  int beg = station.field[field];
+  int end = station.field[field+1];
+  // Fields missing at the end of the line are empty.
+  *size = (end > beg) ? end-beg-1 : 0;
+  return text_.data() + station.line + station.field[field];
+}
+
+std::string SourceTableSnapshot::Field(StationRecord const& station,
+    StreamRecordField field) const {
+  size_t size;
+  char const* data = FieldData(station, field, &size);
+  return std::string(data, size);
+}
+
+bool SourceTableSnapshot::Matches(StationRecord const& station,
+    StationFilter const& filter) const {
+  if (station.carrier < filter.min_carrier) return false;
+  if (station.network && !filter.allow_network) return false;
+  if (station.fee && !filter.allow_fee) return false;
+  size_t size;
+  char const* data;
+  if (!filter.format.empty()) {
+    data = FieldData(station, kStrFormat, &size);
+    if (size < filter.format.size() ||
+        !EqualNoCase(data, filter.format.data(), filter.format.size())) {
+      return false;
+    }
+  }
+  if (!filter.nav_systems.empty()) {
+    data = FieldData(station, kStrNavSystem, &size);
+    for (auto const& system : filter.nav_systems) {
+      bool found = false;
+      size_t beg = 0;
+      while (beg <= size && !found) {
+        char const* plus = static_cast<char const*>(
+            memchr(data+beg, '+', size-beg));
+        size_t end = (plus == nullptr) ? size : plus-data;
+        found = (end-beg == system.size()) &&
+            EqualNoCase(data+beg, system.data(), system.size());
+        beg = end+1;
+      }
+      if (!found) return false;
+    }
+  }
+  return true;
+}
+
+int SourceTableSnapshot::Nearest(double latitude, double longitude,
+    StationFilter const& filter, double* distance_m) const {
+  int nearest = -1;
+  double nearest_distance = 0.0;
+  double max_distance = filter.max_distance_km * 1000.0;
+  auto visit = [&] (int row, int column) -> void {
+    if (row < 0 || row > 179) return;
+    auto it = cells_.find(StationCell(row, column));
+    if (it == cells_.end()) return;
+    for (uint32_t id : it->second) {
+      StationRecord const& station = stations_[id];
+      double distance = CalculateDistance(latitude, longitude,
+          station.latitude, station.longitude);
+      if (nearest >= 0 && distance >= nearest_distance) continue;
+      if (max_distance > 0.0 && distance > max_distance) continue;
+      if (!Matches(station, filter)) continue;
+      nearest = static_cast<int>(id);
+      nearest_distance = distance;
+    }
+  };
+  // Search rings of cells around the rover until no farther ring can
+  // hold a nearer station.
+  constexpr double kMetersPerDegree = 111195.0;
+  int row = static_cast<int>(floor(latitude)) + 90;
+  int column = static_cast<int>(floor(longitude)) + 180;
+  for (int ring = 0; ring <= 180; ++ring) {
+    for (int r = row-ring; r <= row+ring; ++r) {
+      if (r == row-ring || r == row+ring) {
+        for (int c = column-ring; c <= column+ring; ++c) visit(r, c);
+      } else {
+        visit(r, column-ring);
+        if (ring > 0) visit(r, column+ring);
+      }
+    }
+    // Stations beyond this ring are `ring` whole cells away, a degree of
+    // longitude shrinks towards the poles.
+    double polar = std::min(fabs(latitude) + ring + 1, 90.0);
+    double bound = ring * kMetersPerDegree * cos(polar * kPi / 180.0);
+    if (nearest >= 0 && bound >= nearest_distance) break;
+    if (max_distance > 0.0 && bound > max_distance) break;
+  }
+  if (nearest >= 0 && distance_m != nullptr) *distance_m = nearest_distance;
+  return nearest;
+}
+
+int SourceTableSnapshot::Save(std::string const& path) const {
+  std::string temp = path + ".tmp";
+  FILE* file = fopen(temp.c_str(), "wb");
+  if (file == nullptr) {
+    printf("Open %s failed\r\n", temp.c_str());
+    return -1;
+  }
+  std::string header = "NTRIPLIB-SOURCETABLE 1\r\n"
+      "ETag: " + etag_ + "\r\n"
+      "Last-Modified: " + last_modified_ + "\r\n"
+      "\r\n";
+  bool ok = (fwrite(header.data(), 1, header.size(), file) == header.size()) &&
+      (fwrite(text_.data(), 1, text_.size(), file) == text_.size()) &&
+      (fputs("ENDSOURCETABLE\r\n", file) >= 0);
+  ok = (fclose(file) == 0) && ok;
+  if (!ok || rename(temp.c_str(), path.c_str()) != 0) {
+    printf("Write %s failed\r\n", path.c_str());
+    remove(temp.c_str());
+    return -1;
+  }
+  return 0;
+}
+
+int SourceTableSnapshot::Load(std::string const& path) {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == nullptr) return -1;
+  Clear();
+  char line[1024];
+  if (fgets(line, sizeof(line), file) == nullptr ||
+      strcmp(line, "NTRIPLIB-SOURCETABLE 1\r\n") != 0) {
+    fclose(file);
+    return -1;
+  }
+  std::string etag;
+  std::string last_modified;
+  while (fgets(line, sizeof(line), file) != nullptr) {
+    std::string header = StripLineEnd(line);
+    if (header.empty()) break;
+    if (header.compare(0, 6, "ETag: ") == 0) {
+      etag = header.substr(6);
+    } else if (header.compare(0, 15, "Last-Modified: ") == 0) {
+      last_modified = header.substr(15);
+    }
+  }
+  char buffer[65536];
+  size_t size;
+  while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    Feed(buffer, size);
+  }
+  fclose(file);
+  Finish();
+  if (!complete_) {
+    Clear();
+    return -1;
+  }
+  set_validators(etag, last_modified);
+  return 0;
+}
+
+}  // namespace libntrip
@@ -0,0 +1,395 @@
+// MIT License
+//
+// Copyright (c) 2021 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "ntrip/stream_recorder.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>  // NOLINT.
+#include <string>
+#include <vector>
+
+#include "ntrip/rtcm3_frame.h"
+
+
+namespace libntrip {
+
+static_assert(sizeof(RecordFileHeader) == 96, "Record file header layout");
+static_assert(sizeof(RecordHeader) == 16, "Record header layout");
+static_assert(sizeof(IndexEntry) == 24, "Index entry layout");
+
+namespace {
+
+constexpr uint32_t kRecordFileVersion = 1;
+constexpr int64_t kNsPerMs = 1000000;
+// Wake the writer early once this much is queued.
+constexpr int64_t kWakeupBytes = 1024*1024;
+
+inline
+int64_t UnixNanoseconds(void) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Mountpoints become file names, anything that could leave the record
+// directory is refused.
+bool IsSafeFileName(std::string const& name) {
+  if (name.empty() || name == "." || name.find("..") != std::string::npos) {
+    return false;
+  }
+  for (char c : name) {
+    unsigned char u = static_cast<unsigned char>(c);
+    if (u < 0x20 || u == 0x7F || c == '/' || c == '\\' || c == ':') {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::string SegmentName(std::string const& mountpoint, int64_t start_ns,
+    int number) {
+  time_t seconds = static_cast<time_t>(start_ns / 1000000000);
+  struct tm tm_start;
+  gmtime_r(&seconds, &tm_start);
+  char datetime[32];
+  strftime(datetime, sizeof(datetime), "%Y%m%dT%H%M%S", &tm_start);
+  char number_str[16];
+  snprintf(number_str, sizeof(number_str), "%04d", number);
+  return mountpoint + "_" + datetime + "_" + number_str;
+}
+
+}  // namespace
+
+//
+// StreamRecorder.
+//
+
+bool StreamRecorder::Start(void) {
+  if (running_.load()) return true;
+  if (mkdir(options_.directory.c_str(), 0755) != 0 && errno != EEXIST) {
+    printf("Create record directory %s failed: %s\n",
+        options_.directory.c_str(), strerror(errno));
+    return false;
+  }
+  running_.store(true);
+  thread_.set_default_name("ntrip_recorder");
+  thread_.reset(&StreamRecorder::WriterHandler, this);
+  return true;
+}
+
+void StreamRecorder::Stop(void) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!running_.load()) return;
+    running_.store(false);
+  }
+  condition_.notify_one();
+  thread_.join();
+}
+
+int StreamRecorder::OpenStream(std::string const& mountpoint) {
+  if (!IsSafeFileName(mountpoint)) {
+    printf("Mountpoint %s is not recorded, unsafe file name\n",
+        mountpoint.c_str());
+    return -1;
+  }
+  if (!options_.mountpoints.empty() &&
+      std::find(options_.mountpoints.begin(), options_.mountpoints.end(),
+          mountpoint) == options_.mountpoints.end()) {
+    return -1;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (size_t i = 0; i < streams_.size(); ++i) {
+    if (streams_[i]->mountpoint == mountpoint) return static_cast<int>(i);
+  }
+  streams_.emplace_back(new Stream);
+  streams_.back()->mountpoint = mountpoint;
+  return static_cast<int>(streams_.size()-1);
+}
+
+int StreamRecorder::Append(int stream_id, char const* frame, int size) {
+  if (stream_id < 0 || size <= 0 || !running_.load()) return -1;
+  RecordHeader header;
+  header.arrival_ns = UnixNanoseconds();
+  header.size = static_cast<uint32_t>(size);
+  header.message_type = static_cast<uint16_t>(
+      size > kRtcm3HeaderLength+1 ? Rtcm3MessageType(frame) : 0);
+  header.reserved = 0;
+  int64_t record_size = sizeof(header) + size;
+  bool wakeup = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stream_id >= static_cast<int>(streams_.size()) ||
+        pending_bytes_ + record_size > options_.max_pending_bytes) {
+      ++dropped_frames_;
+      return -1;
+    }
+    std::vector<char>& pending = streams_[stream_id]->pending;
+    char const* ptr = reinterpret_cast<char const*>(&header);
+    pending.insert(pending.end(), ptr, ptr+sizeof(header));
+    pending.insert(pending.end(), frame, frame+size);
+    wakeup = (pending_bytes_ < kWakeupBytes) &&
+        (pending_bytes_ + record_size >= kWakeupBytes);
+    pending_bytes_ += record_size;
+  }
+  if (wakeup) condition_.notify_one();
+  ++frames_;
+  bytes_ += size;
+  return 0;
+}
+
+RecorderStatistics StreamRecorder::statistics(void) const {
+  RecorderStatistics stat;
+  stat.frames = frames_.load();
+  stat.bytes = bytes_.load();
+  stat.dropped_frames = dropped_frames_.load();
+  stat.segments = segments_.load();
+  stat.write_errors = write_errors_.load();
+  return stat;
+}
+
+void StreamRecorder::WriterHandler(void) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    condition_.wait_for(lock,
+        std::chrono::milliseconds(options_.flush_interval_ms));
+    bool stop = !running_.load();
+    for (size_t i = 0; i < streams_.size(); ++i) {
+      Stream* stream = streams_[i].get();
+      if (stream->pending.empty()) continue;
+      stream->writing.swap(stream->pending);
+      pending_bytes_ -= stream->writing.size();
+      // Only the disk writes happen outside the lock.
+      lock.unlock();
+      WriteRecords(stream);
+      stream->writing.clear();
+      lock.lock();
+    }
+    if (stop) break;
+  }
+  for (auto& stream : streams_) CloseSegment(stream.get());
+}
+
+void StreamRecorder::WriteRecords(Stream* stream) {
+  char const* data = stream->writing.data();
+  size_t size = stream->writing.size();
+  size_t pos = 0;
+  size_t run_begin = 0;
+  std::vector<IndexEntry> index;
+  int64_t segment_ns = static_cast<int64_t>(options_.segment_seconds) *
+      1000000000;
+  auto flush = [&] (size_t end) {
+    if (stream->fd < 0) return;
+    if (WriteAll(stream->fd, data+run_begin, end-run_begin) != 0 ||
+        (!index.empty() && WriteAll(stream->index_fd,
+            reinterpret_cast<char const*>(index.data()),
+            index.size()*sizeof(IndexEntry)) != 0)) {
+      ++write_errors_;
+    }
+    index.clear();
+  };
+  while (pos < size) {
+    RecordHeader header;
+    memcpy(&header, data+pos, sizeof(header));
+    uint64_t record_size = sizeof(header) + header.size;
+    bool roll = (stream->fd < 0) || ((stream->record_index > 0) &&
+        ((stream->segment_offset + record_size >
+          static_cast<uint64_t>(options_.segment_bytes)) ||
+         (header.arrival_ns - stream->segment_start_ns >= segment_ns)));
+    if (roll) {
+      flush(pos);
+      CloseSegment(stream);
+      if (OpenSegment(stream, header.arrival_ns) != 0) {
+        ++write_errors_;
+        return;
+      }
+      run_begin = pos;
+    }
+    if ((stream->record_index == 0) || (header.arrival_ns -
+        stream->last_index_ns >= options_.index_interval_ms*kNsPerMs)) {
+      index.push_back(IndexEntry{header.arrival_ns, stream->segment_offset,
+          stream->record_index});
+      stream->last_index_ns = header.arrival_ns;
+    }
+    stream->segment_offset += record_size;
+    ++stream->record_index;
+    pos += record_size;
+  }
+  flush(size);
+}
+
+int StreamRecorder::OpenSegment(Stream* stream, int64_t start_ns) {
+  std::string path = options_.directory + "/" + SegmentName(
+      stream->mountpoint, start_ns, stream->segment_number++);
+  stream->fd = open((path + ".rec").c_str(),
+      O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (stream->fd < 0) {
+    printf("Open record file %s.rec failed: %s\n",
+        path.c_str(), strerror(errno));
+    return -1;
+  }
+  stream->index_fd = open((path + ".idx").c_str(),
+      O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  RecordFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kRecordFileMagic, sizeof(header.magic));
+  header.version = kRecordFileVersion;
+  header.header_size = sizeof(header);
+  header.start_ns = start_ns;
+  strncpy(header.mountpoint, stream->mountpoint.c_str(),
+      sizeof(header.mountpoint)-1);
+  if (stream->index_fd < 0 || WriteAll(stream->fd,
+      reinterpret_cast<char const*>(&header), sizeof(header)) != 0) {
+    CloseSegment(stream);
+    return -1;
+  }
+  stream->segment_start_ns = start_ns;
+  stream->segment_offset = sizeof(header);
+  stream->record_index = 0;
+  ++segments_;
+  return 0;
+}
+
+void StreamRecorder::CloseSegment(Stream* stream) {
+  if (stream->fd >= 0) close(stream->fd);
+  if (stream->index_fd >= 0) close(stream->index_fd);
+  stream->fd = -1;
+  stream->index_fd = -1;
+}
+
+int StreamRecorder::WriteAll(int fd, char const* data, size_t size) {
+  while (size > 0) {
+    ssize_t ret = write(fd, data, size);
+    if (ret < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    data += ret;
+    size -= ret;
+  }
+  return 0;
+}
+
+//
+// RecordReader.
+//
+
+int RecordReader::Open(std::string const& path) {
+  Close();
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return -1;
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      st.st_size < static_cast<off_t>(sizeof(RecordFileHeader))) {
+    close(fd);
+    return -1;
+  }
+  void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) return -1;
+  data_ = static_cast<char const*>(addr);
+  size_ = st.st_size;
+  madvise(addr, size_, MADV_SEQUENTIAL);
+  auto const* header = reinterpret_cast<RecordFileHeader const*>(data_);
+  if (memcmp(header->magic, kRecordFileMagic, sizeof(header->magic)) != 0 ||
+      header->header_size < sizeof(RecordFileHeader) ||
+      header->header_size > size_) {
+    Close();
+    return -1;
+  }
+  offset_ = header->header_size;
+  // The index is optional, a segment can be replayed without it.
+  std::string index_path = path;
+  auto pos = index_path.rfind(".rec");
+  if (pos != std::string::npos) index_path.replace(pos, 4, ".idx");
+  int index_fd = open(index_path.c_str(), O_RDONLY);
+  if (index_fd >= 0) {
+    IndexEntry entry;
+    while (read(index_fd, &entry, sizeof(entry)) ==
+        static_cast<ssize_t>(sizeof(entry))) {
+      if (entry.offset < size_) index_.push_back(entry);
+    }
+    close(index_fd);
+  }
+  return 0;
+}
+
+void RecordReader::Close(void) {
+  if (data_ != nullptr) munmap(const_cast<char*>(data_), size_);
+  data_ = nullptr;
+  size_ = 0;
+  offset_ = 0;
+  index_.clear();
+}
+
+bool RecordReader::Next(Record* record) {
+  if (data_ == nullptr || offset_ + sizeof(RecordHeader) > size_) {
+    return false;
+  }
+  RecordHeader header;
+  memcpy(&header, data_+offset_, sizeof(header));
+  if (offset_ + sizeof(header) + header.size > size_) return false;
+  record->arrival_ns = header.arrival_ns;
+  record->message_type = header.message_type;
+  record->data = data_ + offset_ + sizeof(header);
+  record->size = static_cast<int>(header.size);
+  offset_ += sizeof(header) + header.size;
+  return true;
+}
+
+void RecordReader::Rewind(void) {
+  if (data_ != nullptr) {
+    offset_ = reinterpret_cast<RecordFileHeader const*>(data_)->header_size;
+  }
+}
+
+void RecordReader::Seek(int64_t arrival_ns) {
+  Rewind();
+  auto it = std::upper_bound(index_.begin(), index_.end(), arrival_ns,
+      [] (int64_t value, IndexEntry const& entry) {
+        return value < entry.arrival_ns;
+      });
+  if (it != index_.begin()) offset_ = (it-1)->offset;
+}
+
+std::string RecordReader::mountpoint(void) const {
+  if (data_ == nullptr) return "";
+  auto const* header = reinterpret_cast<RecordFileHeader const*>(data_);
+  return std::string(header->mountpoint,
+      strnlen(header->mountpoint, sizeof(header->mountpoint)));
+}
+
+int64_t RecordReader::start_ns(void) const {
+  if (data_ == nullptr) return 0;
+  return reinterpret_cast<RecordFileHeader const*>(data_)->start_ns;
+}
+
+}  // namespace libntrip
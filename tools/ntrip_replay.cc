@@ -0,0 +1,234 @@
+// MIT License
+//
+// Copyright (c) 2021 Yuming Meng
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Replay recorded mountpoint streams into a caster as NtripServer sources.
+// Segments are mapped read-only and sent in order, paced by the recorded
+// arrival times or as fast as possible. Frames that arrived together are
+// sent together.
+//
+// Usage: ntrip_replay [options] segment.rec...
+
+#include <getopt.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>  // NOLINT.
+#include <memory>
+#include <string>
+#include <thread>  // NOLINT.
+#include <vector>
+
+#include "ntrip/ntrip_server.h"
+#include "ntrip/stream_recorder.h"
+
+
+using libntrip::NtripServer;
+using libntrip::RecordReader;
+using libntrip::kSendWouldBlock;
+
+namespace {
+
+struct Options {
+  std::string host = "127.0.0.1";
+  int port = 2101;
+  std::string user = "test01";
+  std::string password = "123456";
+  std::string mountpoint;  // Defaults to the recorded one.
+  int sources = 1;
+  double speed = 1.0;  // 0 replays as fast as possible.
+  bool loop = false;
+  std::vector<std::string> files;
+};
+
+struct SourceResult {
+  uint64_t frames = 0;  // RTCM frames, one per record.
+  uint64_t sends = 0;  // Frames that arrived together go in one send.
+  uint64_t bytes = 0;
+  bool failed = false;
+};
+
+std::atomic_bool g_running{true};
+
+void OnSignal(int) {
+  g_running.store(false);
+}
+
+void ReplaySource(Options const& options, std::string const& mountpoint,
+    SourceResult* result) {
+  std::string ntrip_str = "STR;" + mountpoint + ";" + mountpoint +
+      ";RTCM 3.2;;2;GPS;REPLAY;CHN;0.00;0.00;0;0;ntrip_replay;none;B;N;0;";
+  NtripServer server;
+  server.Init(options.host, options.port, options.user, options.password,
+      mountpoint, ntrip_str);
+  if (!server.Run()) {
+    result->failed = true;
+    return;
+  }
+  std::vector<char> batch;
+  auto start = std::chrono::steady_clock::now();
+  int64_t first_arrival_ns = -1;
+  do {
+    for (auto const& file : options.files) {
+      RecordReader reader;
+      if (reader.Open(file) != 0) {
+        printf("Open %s failed\n", file.c_str());
+        result->failed = true;
+        return;
+      }
+      RecordReader::Record record;
+      bool has_record = reader.Next(&record);
+      while (has_record && g_running.load()) {
+        int64_t arrival_ns = record.arrival_ns;
+        batch.clear();
+        uint64_t frames = 0;
+        while (has_record && record.arrival_ns == arrival_ns) {
+          batch.insert(batch.end(), record.data, record.data+record.size);
+          ++frames;
+          has_record = reader.Next(&record);
+        }
+        if (first_arrival_ns < 0) first_arrival_ns = arrival_ns;
+        if (options.speed > 0) {
+          std::this_thread::sleep_until(start + std::chrono::nanoseconds(
+              static_cast<int64_t>((arrival_ns-first_arrival_ns) /
+                  options.speed)));
+        }
+        int ret;
+        // A full send backlog means the caster is behind, wait for it.
+        while (((ret = server.SendData(batch.data(),
+                    static_cast<int>(batch.size()))) == kSendWouldBlock) &&
+            g_running.load()) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if (ret == kSendWouldBlock) break;
+        if (ret != 0) {
+          printf("Source %s send failed\n", mountpoint.c_str());
+          result->failed = true;
+          return;
+        }
+        result->frames += frames;
+        result->sends += 1;
+        result->bytes += batch.size();
+      }
+    }
+    // Later loops keep the recorded cadence.
+    start = std::chrono::steady_clock::now();
+    first_arrival_ns = -1;
+  } while (options.loop && g_running.load());
+  server.Stop();
+}
+
+void PrintUsage(char const* name) {
+  printf("Usage: %s [options] segment.rec...\n"
+      "  --host IP           caster address (127.0.0.1)\n"
+      "  --port N            caster port (2101)\n"
+      "  --user NAME --password PASS\n"
+      "  --mountpoint NAME   default is the recorded mountpoint\n"
+      "  --sources N         replay as N sources NAME_0...NAME_N-1 (1)\n"
+      "  --speed X           1 is real time, 0 is as fast as possible (1)\n"
+      "  --loop              start over at the end\n", name);
+}
+
+int ParseOptions(int argc, char *argv[], Options* options) {
+  static struct option const kLongOptions[] = {
+    {"host", required_argument, nullptr, 'h'},
+    {"port", required_argument, nullptr, 'p'},
+    {"user", required_argument, nullptr, 'u'},
+    {"password", required_argument, nullptr, 'w'},
+    {"mountpoint", required_argument, nullptr, 'm'},
+    {"sources", required_argument, nullptr, 'n'},
+    {"speed", required_argument, nullptr, 's'},
+    {"loop", no_argument, nullptr, 'l'},
+    {"help", no_argument, nullptr, '?'},
+    {nullptr, 0, nullptr, 0}
+  };
+  int opt;
+  while ((opt = getopt_long(argc, argv, "", kLongOptions, nullptr)) != -1) {
+    switch (opt) {
+      case 'h': options->host = optarg; break;
+      case 'p': options->port = atoi(optarg); break;
+      case 'u': options->user = optarg; break;
+      case 'w': options->password = optarg; break;
+      case 'm': options->mountpoint = optarg; break;
+      case 'n': options->sources = atoi(optarg); break;
+      case 's': options->speed = atof(optarg); break;
+      case 'l': options->loop = true; break;
+      default: return -1;
+    }
+  }
+  for (int i = optind; i < argc; ++i) options->files.push_back(argv[i]);
+  if (options->files.empty() || options->sources < 1 || options->speed < 0) {
+    return -1;
+  }
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  Options options;
+  if (ParseOptions(argc, argv, &options) != 0) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+  if (options.mountpoint.empty()) {
+    RecordReader reader;
+    if (reader.Open(options.files.front()) != 0) {
+      printf("%s is not a record file\n", options.files.front().c_str());
+      return 1;
+    }
+    options.mountpoint = reader.mountpoint();
+  }
+  // Ctrl-C stops the replay, the totals are still printed.
+  signal(SIGINT, OnSignal);
+  std::vector<SourceResult> results(options.sources);
+  std::vector<std::thread> threads;
+  auto beg = std::chrono::steady_clock::now();
+  for (int i = 0; i < options.sources; ++i) {
+    std::string mountpoint = options.mountpoint;
+    if (options.sources > 1) mountpoint += "_" + std::to_string(i);
+    threads.emplace_back(ReplaySource, std::cref(options), mountpoint,
+        &results[i]);
+  }
+  for (auto& thread : threads) thread.join();
+  double elapsed = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - beg).count();
+  uint64_t frames = 0;
+  uint64_t sends = 0;
+  uint64_t bytes = 0;
+  int failed = 0;
+  for (auto const& result : results) {
+    frames += result.frames;
+    sends += result.sends;
+    bytes += result.bytes;
+    if (result.failed) ++failed;
+  }
+  printf("{\"sources\":%d,\"failed\":%d,\"frames\":%llu,\"sends\":%llu,"
+      "\"bytes\":%llu,\"seconds\":%.3f,\"mbit_per_s\":%.3f}\n",
+      options.sources, failed, static_cast<unsigned long long>(frames),
+      static_cast<unsigned long long>(sends),
+      static_cast<unsigned long long>(bytes), elapsed,
+      elapsed > 0 ? bytes*8/elapsed/1e6 : 0.0);
+  return failed == 0 ? 0 : 1;
+}